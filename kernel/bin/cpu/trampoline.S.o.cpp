@@ -0,0 +1,121 @@
+# 0 "cpu/trampoline.S"
+# 0 "<built-in>"
+# 0 "<command-line>"
+# 1 "/usr/include/stdc-predef.h" 1 3 4
+# 0 "<command-line>" 2
+# 1 "cpu/trampoline.S"
+# 1 "cpu/smp.h" 1
+# 2 "cpu/trampoline.S" 2
+
+ .globl ap_trampoline
+ .globl ap_trampoline_end
+ .globl ap_boot_info
+
+# address of a trampoline symbol once copied to 0x8000
+
+
+ # copied into low memory by smp_init, never run in place
+ .section .rodata
+ .align 16
+ .code16
+ap_trampoline:
+ cli
+ cld
+ xorw %ax, %ax
+ movw %ax, %ds
+
+ # load temporary gdt
+ lgdtl ((ap_gdt_pointer) - ap_trampoline + 0x8000)
+
+ # enable protected mode
+ movl %cr0, %eax
+ orl $1, %eax
+ movl %eax, %cr0
+ ljmpl $0x18, $((ap_trampoline32) - ap_trampoline + 0x8000)
+
+ .code32
+ap_trampoline32:
+ movw $0x10, %ax
+ movw %ax, %ds
+ movw %ax, %es
+ movw %ax, %ss
+
+ # enable caches, aps start with them disabled
+ movl %cr0, %eax
+ andl $~(3 << 29), %eax
+ movl %eax, %cr0
+
+ # enable page address extension
+ movl %cr4, %eax
+ orl $(1 << 5), %eax
+ movl %eax, %cr4
+
+ # load kernel page tables, smp_init clears them
+ # once it gives up waiting for us
+ movl ((ap_boot_info) - ap_trampoline + 0x8000), %eax
+ testl %eax, %eax
+ jz ap_halt
+ movl %eax, %cr3
+
+ # enable long mode
+ movl $0xC0000080, %ecx
+ rdmsr
+ orl $(1 << 8), %eax
+ wrmsr
+
+ # enable paging
+ movl %cr0, %eax
+ orl $(1 << 31), %eax
+ movl %eax, %cr0
+ ljmpl $0x08, $((ap_trampoline64) - ap_trampoline + 0x8000)
+
+ .code64
+ap_trampoline64:
+ # set segment registers
+ movw $0x10, %dx
+ movw %dx, %ds
+ movw %dx, %es
+ movw %dx, %fs
+ movw %dx, %gs
+ movw %dx, %ss
+
+ # give up if smp_init did
+ movq ((ap_boot_info) - ap_trampoline + 0x8000) + 16, %rax
+ testq %rax, %rax
+ jz ap_halt
+
+ # setup stack given by smp_init
+ movq ((ap_boot_info) - ap_trampoline + 0x8000) + 8, %rsp
+
+ # set ebp to 0 so we know where to end stack traces
+ xorq %rbp, %rbp
+
+ # call ap_main(local)
+ movq ((ap_boot_info) - ap_trampoline + 0x8000) + 24, %rdi
+ callq *%rax
+
+ap_halt:
+ cli
+ hlt
+ jmp ap_halt
+
+ # temporary gdt, selectors match the kernel gdt
+ # with a 32 bit code segment added at the end
+ .align 8
+ap_gdt:
+ .quad 0 # null
+ .quad 0x00AF9A000000FFFF # 0x08 long mode code
+ .quad 0x00CF92000000FFFF # 0x10 data
+ .quad 0x00CF9A000000FFFF # 0x18 protected mode code
+ap_gdt_pointer:
+ .word ap_gdt_pointer - ap_gdt - 1
+ .long ((ap_gdt) - ap_trampoline + 0x8000)
+
+ # filled in by smp_init before each ap is started
+ .align 8
+ap_boot_info:
+ .quad 0 # page directory
+ .quad 0 # stack
+ .quad 0 # entry point
+ .quad 0 # per cpu data
+ap_trampoline_end:
@@ -0,0 +1,12 @@
+# 0 "cpu/tss.S"
+# 0 "<built-in>"
+# 0 "<command-line>"
+# 1 "/usr/include/stdc-predef.h" 1 3 4
+# 0 "<command-line>" 2
+# 1 "cpu/tss.S"
+ .globl tss_flush
+
+tss_flush:
+ movw $0x28, %ax
+ ltr %ax
+ ret
@@ -0,0 +1,13 @@
+# 0 "font/font.S"
+# 0 "<built-in>"
+# 0 "<command-line>"
+# 1 "/usr/include/stdc-predef.h" 1 3 4
+# 0 "<command-line>" 2
+# 1 "font/font.S"
+ .globl en_font
+
+ .section .rodata
+
+ .align 8
+en_font:
+ .incbin "font/default8x16.psfu"
@@ -6,7 +6,7 @@
 #include "idt.h"
 #include "tss.h"
 
-static inline void fpu_init(void)
+static inline void x87_init(void)
 {
 	size_t cr4;
 	uint16_t cw = 0x37F;
@@ -29,6 +29,42 @@ static inline void sse_init(void)
 	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
 }
 
+static inline void pge_init(void)
+{
+	size_t cr4;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= 1 << 7; // set CR4.PGE, global pages survive cr3 loads
+	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
+}
+
+static inline void wp_init(void)
+{
+	size_t cr0;
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	cr0 |= 1 << 16; // set CR0.WP, the kernel faults on read only pages too
+	__asm__ volatile("mov %0, %%cr0" ::"r"(cr0));
+}
+
+static inline void smap_init(void)
+{
+	size_t cr4;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= 1 << 21; // set CR4.SMAP, user pages fault outside of stac
+	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
+}
+
+static inline void pcid_init(void)
+{
+	size_t cr3, cr4;
+	// can only be set while cr3 holds pcid 0
+	__asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+	if (cr3 & 0xFFF)
+		return;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= 1 << 17; // set CR4.PCIDE
+	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
+}
+
 static inline void fxsave_init(void)
 {
 	static char fxsave_region[512] __attribute__((aligned(16)));
@@ -38,9 +74,14 @@ static inline void fxsave_init(void)
 static inline void xsave_init(void)
 {
 	size_t cr4;
+	uint32_t xcr0_lo, xcr0_hi;
 	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
 	cr4 |= 1 << 18; // set CR4.OSXSAVE
 	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4));
+	// xsave x87 and sse state, avx_init adds avx
+	__asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	xcr0_lo |= 0x3;
+	__asm__ volatile("xsetbv" ::"a"(xcr0_lo), "d"(xcr0_hi), "c"(0));
 }
 
 static inline void avx_init(void)
@@ -57,17 +98,73 @@ static inline void avx_init(void)
 					 "popq %rax;");
 }
 
-void cpu_init(void)
+// offsets and sizes used by idt.S
+_Static_assert(offsetof(struct cpu_local, self) == 0,
+			   "cpu_local self pointer must be first");
+_Static_assert(offsetof(struct cpu_local, current_pcb) == 8,
+			   "cpu_local current_pcb offset changed, update idt.S");
+_Static_assert(offsetof(struct cpu_local, kernel_stack) == 16,
+			   "cpu_local kernel_stack offset changed, update idt.S");
+_Static_assert(offsetof(struct cpu_local, user_stack) == 24,
+			   "cpu_local user_stack offset changed, update idt.S");
+_Static_assert(sizeof(struct cpu_regs) == 176,
+			   "cpu_regs size changed, update idt.S");
+
+#define MSR_GS_BASE 0xC0000101
+#define MSR_KERNEL_GS_BASE 0xC0000102
+
+#define MSR_EFER 0xC0000080
+#define MSR_STAR 0xC0000081
+#define MSR_LSTAR 0xC0000082
+#define MSR_FMASK 0xC0000084
+
+#define EFER_SCE 0x1
+
+// syscall loads cs from here and ss from the next entry
+#define STAR_SYSCALL_CS 0x08ULL
+// sysret loads ss from 8 past here and cs from 16 past here
+#define STAR_SYSRET_BASE 0x10ULL
+
+// rflags cleared on syscall: TF, IF, DF and AC
+#define FMASK_FLAGS 0x40700
+
+extern char syscall_entry[];
+
+static void cpu_local_load(struct cpu_local *local)
+{
+	local->self = local;
+
+	// the isr stubs swapgs when entering from ring 3,
+	// so the kernel always sees local in the gs base
+	wrmsr(MSR_GS_BASE, (uint64_t)local);
+	wrmsr(MSR_KERNEL_GS_BASE, 0);
+
+	// both interrupts and syscalls from ring 3 start on this stack
+	local->kernel_stack = (uint64_t)tss_stack_top(local->id);
+}
+
+static void syscall_init(void)
+{
+	struct cpu_feat feats;
+	cpu_feats(&feats);
+
+	// int $0x80 still works without it
+	if (!feats.syscall)
+		return;
+
+	wrmsr(MSR_STAR, STAR_SYSCALL_CS << 32 | STAR_SYSRET_BASE << 48);
+	wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+	wrmsr(MSR_FMASK, FMASK_FLAGS);
+	wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
+static void cpu_feats_init(void)
 {
 	struct cpu_feat feats;
 	cpu_feats(&feats);
 
-	cli();
-	idt_init();
-	tss_init();
-	pic_remap();
 	if (feats.fpu)
-		fpu_init();
+		x87_init();
 	if (feats.sse) {
 		sse_init();
 		fxsave_init();
@@ -77,6 +174,35 @@ void cpu_init(void)
 		if (feats.avx)
 			avx_init();
 	}
+	if (feats.pcid)
+		pcid_init();
+	if (feats.smap)
+		smap_init();
+}
+
+void cpu_init(void)
+{
+	cli();
+	// gs must be valid before the first interrupt
+	cpu_local_load(cpu_get(0));
+	idt_init();
+	tss_init(0);
+	pic_remap();
+	pge_init();
+	wp_init();
+	cpu_feats_init();
+	syscall_init();
+}
+
+void cpu_init_ap(struct cpu_local *local)
+{
+	cpu_local_load(local);
+	idt_load();
+	tss_init(local->id);
+	pge_init();
+	wp_init();
+	cpu_feats_init();
+	syscall_init();
 }
 
 void cpu_report(void)
@@ -89,6 +215,7 @@ void cpu_report(void)
 	cpu_feats(&feats);
 
 	kprintf("CPU\n");
+	kprintf("Count: %u\n", cpu_count());
 	kprintf("Name: %.*s\n", 48, name);
 	kprintf("Vendor: %.*s\n", 12, vendor);
 	kputs("Features:");
@@ -114,29 +241,21 @@ void cpu_report(void)
 		kputs(" AVX");
 	if (feats.xsave)
 		kputs(" XSAVE");
+	if (feats.xsaveopt)
+		kputs(" XSAVEOPT");
 	if (feats.avx2)
 		kputs(" AVX2");
 	if (feats.avx512)
 		kputs(" AVX-512");
+	if (feats.tsc_deadline)
+		kputs(" TSC-DEADLINE");
+	if (feats.invariant_tsc)
+		kputs(" INVARIANT-TSC");
+	if (feats.syscall)
+		kputs(" SYSCALL");
 	kputs("\n\n");
 }
 
-static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
-						 uint32_t *ecx, uint32_t *edx)
-{
-	__asm__ volatile("cpuid"
-					 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
-					 : "0"(leaf));
-}
-
-static inline void cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
-							   uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
-{
-	__asm__ volatile("cpuid"
-					 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
-					 : "0"(leaf), "2"(subleaf));
-}
-
 void cpu_vendor(char vendor[12])
 {
 	uint32_t ignore;
@@ -161,9 +280,18 @@ void cpu_feats(struct cpu_feat *feats)
 	uint32_t ignore;
 	uint32_t ecx_1, edx_1;
 	uint32_t ebx_7;
+	uint32_t max_ext, edx_ext1 = 0, edx_ext7 = 0;
+	uint32_t eax_d1 = 0;
 
 	cpuid(1, &ignore, &ignore, &ecx_1, &edx_1);
 	cpuid_count(7, 0, &ignore, &ebx_7, &ignore, &ignore);
+	cpuid(0x80000000, &max_ext, &ignore, &ignore, &ignore);
+	if (max_ext >= 0x80000001)
+		cpuid(0x80000001, &ignore, &ignore, &ignore, &edx_ext1);
+	if (max_ext >= 0x80000007)
+		cpuid(0x80000007, &ignore, &ignore, &ignore, &edx_ext7);
+	if (ecx_1 & (1 << 26))
+		cpuid_count(0xD, 1, &eax_d1, &ignore, &ignore, &ignore);
 
 	feats->fpu = edx_1 & (1 << 0) ? 1 : 0;
 	feats->mmx = edx_1 & (1 << 23) ? 1 : 0;
@@ -176,8 +304,16 @@ void cpu_feats(struct cpu_feat *feats)
 	feats->sse4a = ecx_1 & (1 << 6) ? 1 : 0;
 	feats->avx = ecx_1 & (1 << 28) ? 1 : 0;
 	feats->xsave = ecx_1 & (1 << 26) ? 1 : 0;
+	feats->xsaveopt = eax_d1 & (1 << 0) ? 1 : 0;
 	feats->avx2 = ebx_7 & (1 << 5) ? 1 : 0;
 	feats->avx512 = ebx_7 & (7 << 16) ? 1 : 0;
+	feats->tsc_deadline = ecx_1 & (1 << 24) ? 1 : 0;
+	feats->invariant_tsc = edx_ext7 & (1 << 8) ? 1 : 0;
+	feats->syscall = edx_ext1 & (1 << 11) ? 1 : 0;
+	feats->pcid = ecx_1 & (1 << 17) ? 1 : 0;
+	feats->invpcid = ebx_7 & (1 << 10) ? 1 : 0;
+	feats->pdpe1gb = edx_ext1 & (1 << 26) ? 1 : 0;
+	feats->smap = ebx_7 & (1 << 20) ? 1 : 0;
 }
 
 void cpu_print_regs(struct cpu_regs *regs)
@@ -0,0 +1,184 @@
+#include <lib.h>
+#include <comus/asm.h>
+#include <comus/cpu.h>
+#include <comus/fpu.h>
+#include <comus/error.h>
+#include <comus/procs.h>
+
+#define CR0_TS 0x8
+
+// xsave areas must be 64 byte aligned, fxsave ones 16
+#define AREA_ALIGN 64
+
+// offsets into the legacy fxsave region, which xsave shares
+#define FXSAVE_FCW 0
+#define FXSAVE_MXCSR 24
+
+// initial control words with every exception masked
+#define FCW_INIT 0x37F
+#define MXCSR_INIT 0x1F80
+
+/// how fpu state is saved and loaded
+enum fpu_mode {
+	FPU_FXSAVE,
+	FPU_XSAVE,
+	// skips components that have not changed since they were loaded
+	FPU_XSAVEOPT,
+};
+
+static enum fpu_mode mode = FPU_FXSAVE;
+
+// bytes in a save area
+static size_t area_size = 512;
+
+// save areas of every process that has used the fpu
+static struct kcache area_cache;
+
+// state a process starts with
+static void *init_area = NULL;
+
+static inline void stts(void)
+{
+	size_t cr0;
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	if (cr0 & CR0_TS)
+		return;
+	__asm__ volatile("mov %0, %%cr0" ::"r"(cr0 | CR0_TS));
+}
+
+static inline void area_save(void *area)
+{
+	switch (mode) {
+	case FPU_FXSAVE:
+		__asm__ volatile("fxsave64 (%0)" ::"r"(area) : "memory");
+		break;
+	case FPU_XSAVE:
+		__asm__ volatile("xsave64 (%0)" ::"r"(area), "a"(~0U), "d"(~0U)
+						 : "memory");
+		break;
+	case FPU_XSAVEOPT:
+		__asm__ volatile("xsaveopt64 (%0)" ::"r"(area), "a"(~0U), "d"(~0U)
+						 : "memory");
+		break;
+	}
+}
+
+static inline void area_load(const void *area)
+{
+	if (mode == FPU_FXSAVE)
+		__asm__ volatile("fxrstor64 (%0)" ::"r"(area) : "memory");
+	else
+		__asm__ volatile("xrstor64 (%0)" ::"r"(area), "a"(~0U), "d"(~0U)
+						 : "memory");
+}
+
+void fpu_init(void)
+{
+	struct cpu_feat feats;
+	uint32_t ignore, size;
+
+	cpu_feats(&feats);
+
+	if (feats.xsave) {
+		// size needed for the features cpu_init enabled in xcr0
+		cpuid_count(0xD, 0, &ignore, &size, &ignore, &ignore);
+		area_size = size;
+		mode = feats.xsaveopt ? FPU_XSAVEOPT : FPU_XSAVE;
+	}
+
+	kcache_init(&area_cache, "fpu", area_size, AREA_ALIGN);
+
+	// an all zero xsave header puts every other component
+	// in its initial state when loaded
+	init_area = kcache_alloc(&area_cache);
+	if (init_area == NULL)
+		panic("fpu_init: cannot allocate initial fpu state");
+	memset(init_area, 0, area_size);
+	*(uint16_t *)((char *)init_area + FXSAVE_FCW) = FCW_INIT;
+	*(uint32_t *)((char *)init_area + FXSAVE_MXCSR) = MXCSR_INIT;
+}
+
+void fpu_switch(struct pcb *pcb)
+{
+	struct cpu_local *local = cpu_local();
+
+	// nothing has touched the registers since it last ran here
+	if (local->fpu_owner == pcb && pcb->fpu_cpu == local->id) {
+		clts();
+		local->fpu_dirty = true;
+		return;
+	}
+
+	fpu_flush();
+	stts();
+}
+
+void fpu_flush(void)
+{
+	struct cpu_local *local = cpu_local();
+
+	if (!local->fpu_dirty)
+		return;
+
+	// TS is clear while the owner's state is dirty
+	area_save(local->fpu_owner->fpu);
+	local->fpu_dirty = false;
+}
+
+int fpu_trap(struct pcb *pcb)
+{
+	struct cpu_local *local = cpu_local();
+
+	// first use of the fpu
+	if (pcb->fpu == NULL) {
+		pcb->fpu = kcache_alloc(&area_cache);
+		if (pcb->fpu == NULL)
+			return E_NO_MEMORY;
+		memcpy(pcb->fpu, init_area, area_size);
+	}
+
+	clts();
+
+	if (local->fpu_owner != pcb || pcb->fpu_cpu != local->id) {
+		fpu_flush();
+		area_load(pcb->fpu);
+		local->fpu_owner = pcb;
+		pcb->fpu_cpu = local->id;
+	}
+
+	local->fpu_dirty = true;
+	return SUCCESS;
+}
+
+int fpu_clone(struct pcb *child, struct pcb *parent)
+{
+	// never used the fpu, so the child starts fresh too
+	if (parent->fpu == NULL)
+		return SUCCESS;
+
+	// the registers may be newer than the parent's save area
+	fpu_flush();
+
+	child->fpu = kcache_alloc(&area_cache);
+	if (child->fpu == NULL)
+		return E_NO_MEMORY;
+	memcpy(child->fpu, parent->fpu, area_size);
+
+	return SUCCESS;
+}
+
+void fpu_release(struct pcb *pcb)
+{
+	struct cpu_local *local = cpu_local();
+
+	// other cpus can only have a stale owner, which
+	// fpu_cpu no longer matches
+	if (local->fpu_owner == pcb) {
+		local->fpu_owner = NULL;
+		local->fpu_dirty = false;
+	}
+
+	kcache_free(&area_cache, pcb->fpu);
+	pcb->fpu = NULL;
+	pcb->fpu_cpu = UINT32_MAX;
+}
@@ -5,8 +5,11 @@
 #include <comus/asm.h>
 #include <comus/cpu.h>
 #include <comus/drivers/ps2.h>
-#include <comus/drivers/pit.h>
+#include <comus/drivers/lapic.h>
 #include <comus/procs.h>
+#include <comus/tick.h>
+#include <comus/fpu.h>
+#include <comus/error.h>
 #include <comus/memory.h>
 
 #include "idt.h"
@@ -47,11 +50,6 @@ __attribute__((aligned(0x10))) static struct idt_entry idt[256];
 
 static struct idtr idtr;
 extern void *isr_stub_table[];
-extern char kern_stack_start[];
-extern char kern_stack_end[];
-
-// current register state on interrupt
-static struct cpu_regs *state;
 
 // initialize and load the IDT
 void idt_init(void)
@@ -80,11 +78,17 @@ void idt_init(void)
 			entry->flags |= RING3;
 	}
 
+	idt_load();
+}
+
+void idt_load(void)
+{
 	__asm__ volatile("lidt %0" : : "m"(idtr));
 }
 
 #define EX_DEBUG 0x01
 #define EX_BREAKPOINT 0x03
+#define EX_DEVICE_NA 0x07
 #define EX_PAGE_FAULT 0x0e
 
 // Intel manual vol 3 ch 6.3.1
@@ -126,6 +130,7 @@ char *EXCEPTIONS[] = {
 __attribute__((noreturn)) void idt_exception_handler(uint64_t exception,
 													 uint64_t code)
 {
+	struct cpu_regs *state = cpu_local()->regs;
 	uint64_t cr2;
 
 	switch (exception) {
@@ -156,18 +161,16 @@ __attribute__((noreturn)) void idt_exception_handler(uint64_t exception,
 
 void isr_save(struct cpu_regs *regs)
 {
-	// make sure were in the kernel memory context
-	if (kernel_mem_ctx)
-		mem_ctx_switch(kernel_mem_ctx);
+	// only one cpu in the kernel at a time, the kernel is mapped
+	// in every memory context so we stay in the interrupted one
+	kernel_lock();
 
 	// save pointer to registers
-	state = regs;
+	cpu_local()->regs = regs;
 
-	// if we have a kernel stack pointer
-	// we should return to not save kernel context
-	// data to userspace
-	if (regs->rsp >= (size_t)kern_stack_start &&
-		regs->rsp <= (size_t)kern_stack_end)
+	// we interrupted the kernel, do not save
+	// kernel context data to userspace
+	if ((regs->cs & 0x3) == 0)
 		return;
 
 	// save registers in current_pcb
@@ -175,6 +178,92 @@ void isr_save(struct cpu_regs *regs)
 		current_pcb->regs = *regs;
 }
 
+void syscall_save(struct cpu_regs *regs)
+{
+	struct pcb *pcb;
+
+	kernel_lock();
+
+	// the syscall instruction leaves the pgdir and segments
+	// alone, so syscall_entry does not push them
+	pcb = current_pcb;
+	regs->cr3 = pcb->regs.cr3;
+	regs->gs = pcb->regs.gs;
+	regs->fs = pcb->regs.fs;
+	regs->es = pcb->regs.es;
+	regs->ds = pcb->regs.ds;
+
+	cpu_local()->regs = regs;
+	pcb->regs = *regs;
+}
+
+void isr_restore(void)
+{
+	struct cpu_regs *regs = cpu_local()->regs;
+
+	// the pcid may have been given to another context
+	// since the process was dispatched
+	if ((regs->cs & 0x3) != 0 && current_pcb != NULL)
+		regs->cr3 = mem_ctx_cr3(current_pcb->memctx);
+
+	tick_program();
+	kernel_unlock();
+}
+
+void syscall_restore(void)
+{
+	struct pcb *pcb = current_pcb;
+
+	pcb->regs.cr3 = mem_ctx_cr3(pcb->memctx);
+
+	tick_program();
+	kernel_unlock_all();
+}
+
+void idt_page_fault(uint64_t code)
+{
+	struct cpu_local *local = cpu_local();
+	mem_ctx_t ctx = kernel_mem_ctx;
+	uint64_t cr2;
+
+	__asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+
+	// the kernel runs on the page tables of the process it
+	// interrupted, so user addresses belong to that process,
+	// or to the one a system call is copying to or from
+	if (cr2 >= USER_SPACE_START && local->uaccess_ctx != NULL)
+		ctx = local->uaccess_ctx;
+	else if (cr2 >= USER_SPACE_START && current_pcb != NULL)
+		ctx = current_pcb->memctx;
+
+	if (mem_page_fault(ctx, (void *)cr2, code) == 0)
+		return;
+
+	// bad pointers from user space fail the copy instead
+	if ((local->regs->cs & 0x3) == 0 && local->uaccess_ctx != NULL &&
+		uaccess_fixup(&local->regs->rip))
+		return;
+
+	idt_exception_handler(EX_PAGE_FAULT, code);
+}
+
+void idt_fpu_trap(void)
+{
+	struct pcb *pcb = current_pcb;
+
+	// the kernel is built without fpu instructions
+	if ((cpu_local()->regs->cs & 0x3) == 0 || pcb == NULL)
+		idt_exception_handler(EX_DEVICE_NA, 0);
+
+	if (fpu_trap(pcb) != SUCCESS) {
+		WARN("no memory for the fpu state of pid %d, killing it", pcb->pid);
+		current_pcb = NULL;
+		pcb->exit_status = 1;
+		pcb_zombify(pcb);
+		dispatch();
+	}
+}
+
 void idt_pic_eoi(uint8_t exception)
 {
 	pic_eoi(exception - PIC_REMAP_OFFSET);
@@ -182,8 +271,24 @@ void idt_pic_eoi(uint8_t exception)
 
 void idt_pic_timer(void)
 {
-	ticks++;
-	pcb_on_tick();
+	// either the periodic pit, or the hpet in its place
+	tick_handler();
+}
+
+void idt_lapic_eoi(void)
+{
+	lapic_eoi();
+}
+
+void idt_lapic_timer(void)
+{
+	tick_handler();
+}
+
+void idt_lapic_wake(void)
+{
+	// our process may have been killed by another cpu
+	pcb_on_cpu_tick();
 }
 
 void idt_pic_keyboard(void)
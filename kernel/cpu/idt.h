@@ -11,6 +11,14 @@
 
 #include <stdint.h>
 
+/**
+ * Build the IDT and load it on the current cpu
+ */
 void idt_init(void);
 
+/**
+ * Load the IDT built by idt_init on the current cpu
+ */
+void idt_load(void);
+
 #endif /* idt.h */
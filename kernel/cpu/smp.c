@@ -0,0 +1,204 @@
+#include <lib.h>
+#include <comus/asm.h>
+#include <comus/cpu.h>
+#include <comus/error.h>
+#include <comus/limits.h>
+#include <comus/memory.h>
+#include <comus/procs.h>
+#include <comus/tick.h>
+#include <comus/drivers/acpi.h>
+#include <comus/drivers/lapic.h>
+
+#include "smp.h"
+#include "tss.h"
+
+/// how long to wait for an ap to come online
+#define AP_TIMEOUT_MS 100
+
+// layout of ap_boot_info in trampoline.S
+struct ap_boot {
+	uint64_t pgdir;
+	uint64_t stack;
+	uint64_t entry;
+	uint64_t local;
+};
+
+extern char ap_trampoline[];
+extern char ap_trampoline_end[];
+extern char ap_boot_info[];
+
+// per cpu data, index 0 is the bsp
+static struct cpu_local cpus[N_CPUS];
+static uint32_t n_cpus = 1;
+
+// the big kernel lock
+static struct kspinlock big_lock;
+
+__attribute__((noreturn)) static void ap_main(struct cpu_local *local)
+{
+	cpu_init_ap(local);
+	lapic_enable(0);
+	local->online = true;
+
+	// wait for the bsp to finish booting, taking the lock
+	// flushes anything changed while we were spinning
+	kernel_lock();
+
+	tick_init_ap();
+	dispatch();
+}
+
+static int ap_start(uint32_t id, uint32_t apic_id, volatile struct ap_boot *boot)
+{
+	struct cpu_local *local = &cpus[id];
+
+	local->id = id;
+	local->apic_id = apic_id;
+	local->online = false;
+
+	boot->pgdir = (uint64_t)mem_ctx_pgdir(kernel_mem_ctx);
+	boot->stack = (uint64_t)tss_stack_top(id);
+	boot->entry = (uint64_t)ap_main;
+	boot->local = (uint64_t)local;
+
+	// INIT-SIPI-SIPI
+	lapic_send_init(apic_id);
+	kspin_milliseconds(10);
+	for (int i = 0; i < 2 && !local->online; i++) {
+		lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR >> 12);
+		kspin_milliseconds(1);
+	}
+
+	for (int ms = 0; !local->online && ms < AP_TIMEOUT_MS; ms++)
+		kspin_milliseconds(1);
+
+	if (!local->online) {
+		// the next ap gets the same slot, stack and boot info, so let
+		// this one see it was given up on if it gets to the trampoline
+		// late, and hold it in reset
+		boot->pgdir = 0;
+		boot->stack = 0;
+		boot->entry = 0;
+		boot->local = 0;
+		lapic_send_init(apic_id);
+		kspin_milliseconds(10);
+		local->online = false;
+		WARN("cpu with apic id %u did not start", apic_id);
+		return E_FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+void smp_init(void)
+{
+	struct cpu_local *bsp = &cpus[0];
+	volatile struct ap_boot *boot;
+	uint64_t lapic_addr;
+	uint32_t count;
+
+	// aps spin on the lock until init is dispatched
+	kernel_lock();
+
+	lapic_addr = acpi_lapic_addr();
+	if (lapic_addr == 0 || lapic_init(lapic_addr) != SUCCESS) {
+		WARN("no local apic, running on a single cpu");
+		bsp->online = true;
+		tick_init();
+		return;
+	}
+
+	lapic_enable(1);
+	bsp->apic_id = lapic_id();
+	bsp->online = true;
+	lapic_timer_calibrate();
+	tick_init();
+
+	// the trampoline is identity mapped, and below kernel_start
+	// so the physical allocator never hands it out
+	memcpy((void *)AP_TRAMPOLINE_ADDR, ap_trampoline,
+		   ap_trampoline_end - ap_trampoline);
+	boot = (volatile struct ap_boot *)(AP_TRAMPOLINE_ADDR +
+									   (ap_boot_info - ap_trampoline));
+
+	count = acpi_cpu_count();
+	for (uint32_t i = 0; i < count && n_cpus < N_CPUS; i++) {
+		uint32_t apic_id = acpi_cpu_apic_id(i);
+		if (apic_id == bsp->apic_id)
+			continue;
+		if (ap_start(n_cpus, apic_id, boot) == SUCCESS)
+			n_cpus++;
+	}
+}
+
+uint32_t cpu_count(void)
+{
+	return n_cpus;
+}
+
+struct cpu_local *cpu_get(uint32_t id)
+{
+	assert(id < N_CPUS, "cpu_get: invalid cpu %u", id);
+	return &cpus[id];
+}
+
+void cpu_wake_idle(void)
+{
+	for (uint32_t i = 0; i < n_cpus; i++) {
+		if (i == cpu_id() || !cpus[i].idle)
+			continue;
+		cpu_kick(i);
+		return;
+	}
+}
+
+void cpu_kick(uint32_t id)
+{
+	assert(id < n_cpus, "cpu_kick: invalid cpu %u", id);
+	if (id == cpu_id())
+		return;
+	lapic_send_ipi(cpus[id].apic_id, LAPIC_WAKE_VECTOR);
+}
+
+void kernel_lock(void)
+{
+	struct cpu_local *local = cpu_local();
+	if (local->lock_depth++ == 0) {
+		kspin_lock(&big_lock);
+		// another cpu may have changed kernel mappings
+		// while we did not hold the lock
+		mem_tlb_sync();
+	}
+}
+
+void kernel_unlock(void)
+{
+	struct cpu_local *local = cpu_local();
+	assert(local->lock_depth > 0, "kernel_unlock: lock not held");
+	if (--local->lock_depth == 0)
+		kspin_unlock(&big_lock);
+}
+
+uint32_t kernel_unlock_all(void)
+{
+	struct cpu_local *local = cpu_local();
+	uint32_t depth = local->lock_depth;
+	if (depth) {
+		local->lock_depth = 0;
+		kspin_unlock(&big_lock);
+	}
+	return depth;
+}
+
+void kernel_relock(uint32_t depth)
+{
+	struct cpu_local *local = cpu_local();
+	if (depth == 0)
+		return;
+	kspin_lock(&big_lock);
+	local->lock_depth = depth;
+
+	// another cpu may have changed kernel mappings
+	// while we did not hold the lock
+	mem_tlb_sync();
+}
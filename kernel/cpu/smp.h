@@ -0,0 +1,14 @@
+/**
+ * @file smp.h
+ *
+ * Application processor startup, shared with trampoline.S
+ */
+
+#ifndef SMP_H_
+#define SMP_H_
+
+/// physical address the ap trampoline is copied to,
+/// must be page aligned and below 1M
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+#endif /* smp.h */
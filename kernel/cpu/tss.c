@@ -1,4 +1,5 @@
 #include <comus/memory.h>
+#include <comus/limits.h>
 #include <lib.h>
 
 #include "tss.h"
@@ -39,44 +40,71 @@ struct tss {
 	uint64_t iopb : 16;
 } __attribute__((packed));
 
-// tss entry
-static volatile struct tss tss;
+// number of 8 byte entries in the gdt
+#define GDT_ENTRIES 7
 
-// gdt entries
+struct gdtr {
+	uint16_t size;
+	uint64_t address;
+} __attribute__((packed));
+
+// tss entry for each cpu
+static volatile struct tss tss[N_CPUS];
+
+// gdt entries from entry.S, copied for each cpu since every
+// cpu needs its own tss descriptor
 extern volatile uint8_t GDT[];
-static volatile struct sys_seg_descriptor *GDT_TSS;
+__attribute__((aligned(16))) static volatile uint64_t gdt[N_CPUS][GDT_ENTRIES];
 
-// kernel stack pointer
-static char interrupt_stack[PAGE_SIZE * 2];
+// kernel stack pointer for each cpu
+__attribute__((aligned(16))) static char
+	interrupt_stack[N_CPUS][PAGE_SIZE * 2];
 
-void tss_init(void)
+void tss_init(uint32_t cpu)
 {
-	uint64_t base = (uint64_t)&tss;
-	uint64_t limit = sizeof tss - 1;
+	volatile struct tss *t = &tss[cpu];
+	volatile struct sys_seg_descriptor *gdt_tss;
+	uint64_t base = (uint64_t)t;
+	uint64_t limit = sizeof(struct tss) - 1;
+	struct gdtr gdtr;
+
+	assert(cpu < N_CPUS, "tss_init: invalid cpu %u", cpu);
 
 	// setup tss entry
-	memsetv(&tss, 0, sizeof(struct tss));
-	tss.rsp0 = (uint64_t)interrupt_stack + sizeof(interrupt_stack);
-
-	// map tss into gdt
-	GDT_TSS = (volatile struct sys_seg_descriptor *)(GDT + 0x28);
-	memsetv(GDT_TSS, 0, sizeof(struct sys_seg_descriptor));
-	GDT_TSS->limit0_15 = limit & 0xFFFF;
-	GDT_TSS->base0_15 = base & 0xFFFF;
-	GDT_TSS->base16_23 = (base >> 16) & 0xFF;
-	GDT_TSS->type = 0x9;
-	GDT_TSS->DPL = 0;
-	GDT_TSS->present = 1;
-	GDT_TSS->limit16_19 = (limit >> 16) & 0xF;
-	GDT_TSS->available = 0;
-	GDT_TSS->gran = 0;
-	GDT_TSS->base24_31 = (base >> 24) & 0xFF;
-	GDT_TSS->base32_63 = (base >> 32) & 0xFFFFFFFF;
+	memsetv(t, 0, sizeof(struct tss));
+	t->rsp0 = (uint64_t)tss_stack_top(cpu);
+
+	// copy the gdt and map tss into it
+	memcpyv(gdt[cpu], GDT, sizeof(gdt[cpu]));
+	gdt_tss = (volatile struct sys_seg_descriptor *)&gdt[cpu][0x28 / 8];
+	memsetv(gdt_tss, 0, sizeof(struct sys_seg_descriptor));
+	gdt_tss->limit0_15 = limit & 0xFFFF;
+	gdt_tss->base0_15 = base & 0xFFFF;
+	gdt_tss->base16_23 = (base >> 16) & 0xFF;
+	gdt_tss->type = 0x9;
+	gdt_tss->DPL = 0;
+	gdt_tss->present = 1;
+	gdt_tss->limit16_19 = (limit >> 16) & 0xF;
+	gdt_tss->available = 0;
+	gdt_tss->gran = 0;
+	gdt_tss->base24_31 = (base >> 24) & 0xFF;
+	gdt_tss->base32_63 = (base >> 32) & 0xFFFFFFFF;
+
+	// the selectors do not change so segment registers
+	// do not need to be reloaded
+	gdtr.size = sizeof(gdt[cpu]) - 1;
+	gdtr.address = (uint64_t)gdt[cpu];
+	__asm__ volatile("lgdt %0" ::"m"(gdtr) : "memory");
 
 	tss_flush();
 }
 
-void tss_set_stack(uint64_t stack)
+void *tss_stack_top(uint32_t cpu)
+{
+	return interrupt_stack[cpu] + sizeof(interrupt_stack[cpu]);
+}
+
+void tss_set_stack(uint32_t cpu, uint64_t stack)
 {
-	tss.rsp0 = stack;
+	tss[cpu].rsp0 = stack;
 }
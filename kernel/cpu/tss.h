@@ -14,9 +14,10 @@
 #include <stdint.h>
 
 /**
- * Load the TSS selector
+ * Load a copy of the GDT with its own TSS for a cpu
+ * @param cpu - index of the running cpu
  */
-void tss_init(void);
+void tss_init(uint32_t cpu);
 
 /**
  * Flush the tss
@@ -24,8 +25,13 @@ void tss_init(void);
 void tss_flush(void);
 
 /**
- * Set the kernel stack pointer in the tss
+ * @returns the top of the interrupt stack of a cpu
  */
-void tss_set_stack(uint64_t stack);
+void *tss_stack_top(uint32_t cpu);
+
+/**
+ * Set the kernel stack pointer in the tss of a cpu
+ */
+void tss_set_stack(uint32_t cpu, uint64_t stack);
 
 #endif /* tss.h */
@@ -6,6 +6,8 @@
 #include <comus/drivers/ata.h>
 #include <comus/drivers/gpu.h>
 #include <comus/drivers/pit.h>
+#include <comus/drivers/hpet.h>
+#include <comus/tick.h>
 #include <comus/mboot.h>
 
 void drivers_init(void)
@@ -16,5 +18,7 @@ void drivers_init(void)
 	pci_init();
 	ata_init();
 	acpi_init(mboot_get_rsdp());
+	hpet_init();
+	clock_init();
 	gpu_init();
 }
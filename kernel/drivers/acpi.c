@@ -2,6 +2,7 @@
 #include <comus/drivers/acpi.h>
 #include <comus/asm.h>
 #include <comus/memory.h>
+#include <comus/limits.h>
 #include <stdint.h>
 
 struct acpi_header {
@@ -61,7 +62,9 @@ struct gas {
 	uint8_t bit_offset;
 	uint8_t access_size;
 	uint64_t address;
-};
+} __attribute__((packed));
+
+#define GAS_SYSTEM_MEMORY 0
 
 // differentiated system description table
 struct dsdt {
@@ -69,14 +72,49 @@ struct dsdt {
 	char s5_addr[];
 } __attribute__((packed));
 
+// multiple apic description table
 struct apic {
 	struct acpi_header h;
-	// todo
+	uint32_t lapic_addr;
+	uint32_t flags;
+	uint8_t entries[];
+} __attribute__((packed));
+
+// header of each entry in the madt
+struct apic_entry {
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed));
+
+#define APIC_ENTRY_LAPIC 0
+#define APIC_ENTRY_LAPIC_OVERRIDE 5
+
+// processor local apic
+struct apic_lapic {
+	struct apic_entry h;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
 } __attribute__((packed));
 
+#define LAPIC_ENABLED 0x1
+#define LAPIC_ONLINE_CAPABLE 0x2
+
+// 64 bit local apic address
+struct apic_lapic_override {
+	struct apic_entry h;
+	uint16_t reserved;
+	uint64_t lapic_addr;
+} __attribute__((packed));
+
+// high precision event timer description table
 struct hept {
 	struct acpi_header h;
-	// todo
+	uint32_t event_timer_block_id;
+	struct gas address;
+	uint8_t hpet_number;
+	uint16_t minimum_tick;
+	uint8_t page_protection;
 } __attribute__((packed));
 
 struct waet {
@@ -164,6 +202,10 @@ struct acpi_state {
 	struct waet *waet;
 	uint8_t version;
 
+	uint64_t lapic_addr;
+	uint32_t cpu_ids[N_CPUS];
+	uint32_t n_cpus;
+
 	uint16_t SLP_TYPa;
 	uint16_t SLP_TYPb;
 	uint16_t SLP_EN;
@@ -222,6 +264,45 @@ static int read_s5_addr(struct dsdt *dsdt)
 	return -1;
 }
 
+static void read_apic(struct apic *apic)
+{
+	uint8_t *ent = apic->entries;
+	uint8_t *end = (uint8_t *)apic + apic->h.length;
+
+	state.lapic_addr = apic->lapic_addr;
+	state.n_cpus = 0;
+
+	while (ent + sizeof(struct apic_entry) <= end) {
+		struct apic_entry *h = (struct apic_entry *)ent;
+		if (h->length < sizeof(struct apic_entry) || ent + h->length > end)
+			break;
+
+		switch (h->type) {
+		case APIC_ENTRY_LAPIC: {
+			struct apic_lapic *lapic = (struct apic_lapic *)h;
+			if (!(lapic->flags & (LAPIC_ENABLED | LAPIC_ONLINE_CAPABLE)))
+				break;
+			if (state.n_cpus == N_CPUS) {
+				WARN("ignoring cpu with apic id %d, N_CPUS reached",
+					 lapic->apic_id);
+				break;
+			}
+			state.cpu_ids[state.n_cpus++] = lapic->apic_id;
+			break;
+		}
+		case APIC_ENTRY_LAPIC_OVERRIDE: {
+			struct apic_lapic_override *ovr = (struct apic_lapic_override *)h;
+			state.lapic_addr = ovr->lapic_addr;
+			break;
+		}
+		default:
+			break;
+		}
+
+		ent += h->length;
+	}
+}
+
 static void acpi_load_table(uint64_t addr);
 
 static void acpi_load_rsdt_tables(struct rsdt *rsdt)
@@ -271,6 +352,7 @@ static void acpi_handle_table(struct acpi_header *header)
 		break;
 	case SIG_APIC:
 		state.apic = (struct apic *)header;
+		read_apic(state.apic);
 		break;
 	case SIG_HEPT:
 		state.hept = (struct hept *)header;
@@ -341,8 +423,9 @@ void acpi_report(void)
 		kprintf("%.*s: %#016lx\n", 4, (char *)&state.dsdt->h.signature,
 				(uintptr_t)state.dsdt);
 	if (state.apic)
-		kprintf("%.*s: %#016lx\n", 4, (char *)&state.apic->h.signature,
-				(uintptr_t)state.apic);
+		kprintf("%.*s: %#016lx (%u cpus)\n", 4,
+				(char *)&state.apic->h.signature, (uintptr_t)state.apic,
+				state.n_cpus);
 	if (state.hept)
 		kprintf("%.*s: %#016lx\n", 4, (char *)&state.hept->h.signature,
 				(uintptr_t)state.hept);
@@ -353,6 +436,31 @@ void acpi_report(void)
 	kprintf("\n");
 }
 
+uint64_t acpi_lapic_addr(void)
+{
+	return state.lapic_addr;
+}
+
+uint64_t acpi_hpet_addr(void)
+{
+	// the hpet is always memory mapped, anything else is bogus
+	if (state.hept == NULL ||
+		state.hept->address.address_space != GAS_SYSTEM_MEMORY)
+		return 0;
+	return state.hept->address.address;
+}
+
+uint32_t acpi_cpu_count(void)
+{
+	return state.n_cpus;
+}
+
+uint32_t acpi_cpu_apic_id(uint32_t idx)
+{
+	assert(idx < state.n_cpus, "acpi_cpu_apic_id: invalid cpu index");
+	return state.cpu_ids[idx];
+}
+
 void acpi_shutdown(void)
 {
 	outw((unsigned int)state.fadt->pm1_a_control_block,
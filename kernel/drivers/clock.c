@@ -12,19 +12,55 @@
 #define CMOS_REG_MDAY 0x07
 #define CMOS_REG_MON 0x08
 #define CMOS_REG_YEAR 0x09
+#define CMOS_REG_STATUS_A 0x0A
+#define CMOS_REG_STATUS_B 0x0B
 #define CMOS_REG_CEN 0x32
 
+// status a, set while the rtc is updating its registers
+#define CMOS_UPDATING 0x80
+// status b, registers are binary instead of bcd
+#define CMOS_BINARY 0x04
+// status b, hours are 0-23 instead of 1-12
+#define CMOS_24HOUR 0x02
+// set in the hour register for pm in 12 hour mode
+#define CMOS_HOUR_PM 0x80
+
+#define SEC_PER_DAY (60 * 60 * 24)
+
+// the rtc registers read at once
+struct rtc {
+	uint8_t sec;
+	uint8_t min;
+	uint8_t hour;
+	uint8_t wday;
+	uint8_t mday;
+	uint8_t mon;
+	uint8_t year;
+};
+
 static uint8_t cmos_read(uint8_t reg)
 {
-	uint8_t hex, ret;
-
 	outb(CMOS_WRITE_PORT, reg);
-	hex = inb(CMOS_READ_PORT);
+	return inb(CMOS_READ_PORT);
+}
 
-	ret = hex & 0x0F;
-	ret += (hex & 0xF0) / 16 * 10;
+static uint8_t bcd_to_bin(uint8_t bcd)
+{
+	return (bcd & 0x0F) + (bcd >> 4) * 10;
+}
 
-	return ret;
+static void rtc_read(struct rtc *rtc)
+{
+	while (cmos_read(CMOS_REG_STATUS_A) & CMOS_UPDATING)
+		;
+
+	rtc->sec = cmos_read(CMOS_REG_SEC);
+	rtc->min = cmos_read(CMOS_REG_MIN);
+	rtc->hour = cmos_read(CMOS_REG_HOUR);
+	rtc->wday = cmos_read(CMOS_REG_WDAY);
+	rtc->mday = cmos_read(CMOS_REG_MDAY);
+	rtc->mon = cmos_read(CMOS_REG_MON);
+	rtc->year = cmos_read(CMOS_REG_YEAR);
 }
 
 static int mday_offset[12] = { 0,	31,	 59,  90,  120, 151,
@@ -32,38 +68,76 @@ static int mday_offset[12] = { 0,	31,	 59,  90,  120, 151,
 
 void gettime(struct time *time)
 {
-	time->sec = cmos_read(CMOS_REG_SEC);
-	time->min = cmos_read(CMOS_REG_MIN);
-	time->hour = cmos_read(CMOS_REG_HOUR);
-	time->wday = cmos_read(CMOS_REG_WDAY) - 1;
-	time->mday = cmos_read(CMOS_REG_MDAY);
-	time->mon = cmos_read(CMOS_REG_MON) - 1;
-	time->yn = cmos_read(CMOS_REG_YEAR);
+	struct rtc rtc, last;
+	uint8_t status;
+	bool pm;
+
+	// an update can still start while the registers are read,
+	// so read until two reads agree
+	rtc_read(&rtc);
+	do {
+		last = rtc;
+		rtc_read(&rtc);
+	} while (memcmp(&rtc, &last, sizeof(struct rtc)) != 0);
+
+	status = cmos_read(CMOS_REG_STATUS_B);
+
+	pm = rtc.hour & CMOS_HOUR_PM;
+	rtc.hour &= ~CMOS_HOUR_PM;
+
+	if (!(status & CMOS_BINARY)) {
+		rtc.sec = bcd_to_bin(rtc.sec);
+		rtc.min = bcd_to_bin(rtc.min);
+		rtc.hour = bcd_to_bin(rtc.hour);
+		rtc.wday = bcd_to_bin(rtc.wday);
+		rtc.mday = bcd_to_bin(rtc.mday);
+		rtc.mon = bcd_to_bin(rtc.mon);
+		rtc.year = bcd_to_bin(rtc.year);
+	}
+
+	// 12am is hour 0, 12pm is hour 12
+	if (!(status & CMOS_24HOUR))
+		rtc.hour = rtc.hour % 12 + (pm ? 12 : 0);
+
+	time->sec = rtc.sec;
+	time->min = rtc.min;
+	time->hour = rtc.hour;
+	time->wday = rtc.wday - 1;
+	time->mday = rtc.mday;
+	time->mon = rtc.mon - 1;
+	time->yn = rtc.year;
 	time->cen = 20;
 
 	time->year = time->yn + time->cen * 100;
 
-	time->leap = time->year % 4 == 0 && time->year % 100 != 0;
+	time->leap = (time->year % 4 == 0 && time->year % 100 != 0) ||
+				 time->year % 400 == 0;
 
-	time->yday = mday_offset[time->mon] + time->mday;
+	time->yday = mday_offset[time->mon] + time->mday - 1;
 
-	if (time->leap && time->mon > 2)
+	if (time->leap && time->mon > 1)
 		time->yday++;
 
 	time->year -= 1900;
 }
 
+// number of leap days from year 1 through the end of year
+static uint64_t leap_days(uint64_t year)
+{
+	return year / 4 - year / 100 + year / 400;
+}
+
 uint64_t unixtime(void)
 {
 	struct time time;
+	uint64_t year, days;
+
 	gettime(&time);
 
-	// FIXME: probably wrong
-	uint64_t unix = 0;
-	unix += time.sec;
-	unix += time.min * 60;
-	unix += time.hour * 60 * 60;
-	unix += time.yday * 60 * 60 * 24;
-	unix += time.year * 60 * 60 * 24 * 365;
-	return unix;
+	year = time.year + 1900;
+	days = (year - 1970) * 365 + leap_days(year - 1) - leap_days(1969);
+	days += time.yday;
+
+	return days * SEC_PER_DAY + time.hour * 60 * 60 + time.min * 60 +
+		   time.sec;
 }
@@ -0,0 +1,129 @@
+#include <lib.h>
+#include <comus/error.h>
+#include <comus/memory.h>
+#include <comus/drivers/acpi.h>
+#include <comus/drivers/hpet.h>
+
+// register offsets
+#define REG_CAP 0x000
+#define REG_CONFIG 0x010
+#define REG_COUNTER 0x0F0
+#define REG_TIMER_CONFIG(n) (0x100 + 0x20 * (n))
+#define REG_TIMER_COMPARATOR(n) (0x108 + 0x20 * (n))
+
+// general capabilities
+#define CAP_COUNTER_64 (1 << 13)
+#define CAP_LEGACY_ROUTE (1 << 15)
+#define CAP_PERIOD(cap) ((cap) >> 32)
+
+// general configuration
+#define CONFIG_ENABLE 0x1
+#define CONFIG_LEGACY_ROUTE 0x2
+
+// timer configuration
+#define TIMER_INT_ENABLE 0x4
+
+// femtoseconds in a second
+#define FS_PER_SEC 1000000000000000ULL
+
+// smallest distance a comparator is set ahead of the counter
+#define MIN_DELTA_NS 10000
+
+static volatile uint64_t *regs = NULL;
+
+// main counter frequency
+static uint64_t freq = 0;
+
+// counts in MIN_DELTA_NS
+static uint64_t min_delta = 0;
+
+static inline uint64_t hpet_reg_read(uint32_t reg)
+{
+	return regs[reg / 8];
+}
+
+static inline void hpet_reg_write(uint32_t reg, uint64_t val)
+{
+	regs[reg / 8] = val;
+}
+
+int hpet_init(void)
+{
+	uint64_t phys, cap, period;
+
+	phys = acpi_hpet_addr();
+	if (phys == 0)
+		return E_FAILURE;
+
+	regs = kmapaddr((void *)(uintptr_t)phys, NULL, PAGE_SIZE,
+					F_WRITEABLE | F_CACHEDISABLE);
+	if (regs == NULL) {
+		ERROR("cannot map hpet registers");
+		return E_NO_MEMORY;
+	}
+
+	cap = hpet_reg_read(REG_CAP);
+	period = CAP_PERIOD(cap);
+
+	// a 32 bit counter wraps within minutes, and without legacy
+	// routing there is no way to get its interrupts
+	if (!(cap & CAP_COUNTER_64) || !(cap & CAP_LEGACY_ROUTE) || period == 0) {
+		WARN("hpet is not usable");
+		kunmapaddr((void *)regs);
+		regs = NULL;
+		return E_FAILURE;
+	}
+
+	freq = FS_PER_SEC / period;
+	min_delta = MAX(freq * MIN_DELTA_NS / 1000000000, 1ULL);
+
+	// start the main counter
+	hpet_reg_write(REG_TIMER_CONFIG(0), 0);
+	hpet_reg_write(REG_COUNTER, 0);
+	hpet_reg_write(REG_CONFIG, CONFIG_ENABLE);
+
+	return SUCCESS;
+}
+
+bool hpet_present(void)
+{
+	return regs != NULL;
+}
+
+uint64_t hpet_freq(void)
+{
+	return freq;
+}
+
+uint64_t hpet_read(void)
+{
+	return hpet_reg_read(REG_COUNTER);
+}
+
+void hpet_event_enable(void)
+{
+	assert(regs != NULL, "hpet_event_enable: no hpet");
+
+	// comparator 0 takes over irq 0 from the pit
+	hpet_reg_write(REG_TIMER_CONFIG(0), 0);
+	hpet_reg_write(REG_CONFIG, CONFIG_ENABLE | CONFIG_LEGACY_ROUTE);
+}
+
+void hpet_event_set(uint64_t count)
+{
+	count = MAX(count, hpet_read() + min_delta);
+	hpet_reg_write(REG_TIMER_CONFIG(0), TIMER_INT_ENABLE);
+	hpet_reg_write(REG_TIMER_COMPARATOR(0), count);
+
+	// the comparator only fires when the counter matches it exactly,
+	// so a count that passed while being written would never fire
+	while (hpet_read() >= count) {
+		count = hpet_read() + min_delta;
+		hpet_reg_write(REG_TIMER_COMPARATOR(0), count);
+	}
+}
+
+void hpet_event_stop(void)
+{
+	hpet_reg_write(REG_TIMER_CONFIG(0), 0);
+}
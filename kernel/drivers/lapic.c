@@ -0,0 +1,188 @@
+#include <lib.h>
+#include <comus/asm.h>
+#include <comus/error.h>
+#include <comus/memory.h>
+#include <comus/drivers/lapic.h>
+
+// register offsets
+#define REG_ID 0x020
+#define REG_TPR 0x080
+#define REG_EOI 0x0B0
+#define REG_SVR 0x0F0
+#define REG_ICR_LOW 0x300
+#define REG_ICR_HIGH 0x310
+#define REG_LVT_TIMER 0x320
+#define REG_LVT_LINT0 0x350
+#define REG_LVT_LINT1 0x360
+#define REG_TIMER_INIT 0x380
+#define REG_TIMER_CURR 0x390
+#define REG_TIMER_DIV 0x3E0
+
+// spurious vector register
+#define SVR_ENABLE 0x100
+
+// local vector table
+#define LVT_MASKED 0x10000
+#define LVT_EXTINT 0x700
+#define LVT_NMI 0x400
+#define LVT_TIMER_ONESHOT 0x00000
+#define LVT_TIMER_DEADLINE 0x40000
+
+// interrupt command register
+#define ICR_FIXED 0x000
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_PENDING 0x1000
+#define ICR_ASSERT 0x4000
+
+// divide the timer by 16
+#define TIMER_DIV_16 0x3
+
+// tsc value the timer fires at in tsc-deadline mode
+#define MSR_TSC_DEADLINE 0x6E0
+
+// how many ms to measure the timer over
+#define CALIBRATE_MS 10
+
+static volatile uint32_t *regs = NULL;
+
+// timer counts per millisecond
+static uint32_t timer_per_ms = 0;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+	return regs[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val)
+{
+	regs[reg / 4] = val;
+}
+
+static void lapic_send(uint32_t apic_id, uint32_t cmd)
+{
+	while (lapic_read(REG_ICR_LOW) & ICR_PENDING)
+		cpu_relax();
+	lapic_write(REG_ICR_HIGH, apic_id << 24);
+	lapic_write(REG_ICR_LOW, cmd);
+	while (lapic_read(REG_ICR_LOW) & ICR_PENDING)
+		cpu_relax();
+}
+
+int lapic_init(uint64_t phys)
+{
+	regs = kmapaddr((void *)(uintptr_t)phys, NULL, PAGE_SIZE,
+					F_WRITEABLE | F_CACHEDISABLE);
+	if (regs == NULL) {
+		ERROR("cannot map local apic registers");
+		return E_NO_MEMORY;
+	}
+	return SUCCESS;
+}
+
+void lapic_enable(int bsp)
+{
+	// accept every interrupt
+	lapic_write(REG_TPR, 0);
+
+	// the bsp still gets the legacy pic through LINT0, every other
+	// cpu only gets interrupts sent to it directly
+	if (bsp) {
+		lapic_write(REG_LVT_LINT0, LVT_EXTINT);
+		lapic_write(REG_LVT_LINT1, LVT_NMI);
+	} else {
+		lapic_write(REG_LVT_LINT0, LVT_MASKED);
+		lapic_write(REG_LVT_LINT1, LVT_MASKED);
+	}
+
+	lapic_write(REG_LVT_TIMER, LVT_MASKED);
+	lapic_write(REG_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t lapic_id(void)
+{
+	return lapic_read(REG_ID) >> 24;
+}
+
+void lapic_eoi(void)
+{
+	lapic_write(REG_EOI, 0);
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+	lapic_send(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page)
+{
+	lapic_send(apic_id, ICR_STARTUP | ICR_ASSERT | page);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+	lapic_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+bool lapic_present(void)
+{
+	return regs != NULL;
+}
+
+void lapic_timer_calibrate(void)
+{
+	uint32_t elapsed;
+
+	lapic_write(REG_TIMER_DIV, TIMER_DIV_16);
+	lapic_write(REG_LVT_TIMER, LVT_MASKED);
+
+	lapic_write(REG_TIMER_INIT, UINT32_MAX);
+	kspin_milliseconds(CALIBRATE_MS);
+	elapsed = UINT32_MAX - lapic_read(REG_TIMER_CURR);
+	lapic_write(REG_TIMER_INIT, 0);
+
+	timer_per_ms = elapsed / CALIBRATE_MS;
+	if (timer_per_ms == 0)
+		timer_per_ms = 1;
+}
+
+void lapic_timer_oneshot(bool tsc_deadline)
+{
+	assert(timer_per_ms != 0 || tsc_deadline,
+		   "lapic_timer_oneshot: timer not calibrated");
+
+	lapic_write(REG_TIMER_DIV, TIMER_DIV_16);
+	lapic_write(REG_TIMER_INIT, 0);
+	if (tsc_deadline) {
+		lapic_write(REG_LVT_TIMER, LVT_TIMER_DEADLINE | LAPIC_TIMER_VECTOR);
+		// the mode switch has to land before the deadline msr is written
+		__asm__ volatile("mfence" ::: "memory");
+		wrmsr(MSR_TSC_DEADLINE, 0);
+	} else {
+		lapic_write(REG_LVT_TIMER, LVT_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+	}
+}
+
+void lapic_timer_arm(uint64_t ns)
+{
+	uint64_t ms = ns / 1000000;
+	uint64_t count;
+
+	if (ns == 0) {
+		lapic_write(REG_TIMER_INIT, 0);
+		return;
+	}
+
+	// far off deadlines fire early and get re-armed
+	if (ms >= UINT32_MAX / timer_per_ms)
+		count = UINT32_MAX;
+	else
+		count = MAX(ns * timer_per_ms / 1000000, 1ULL);
+
+	lapic_write(REG_TIMER_INIT, count);
+}
+
+void lapic_timer_deadline(uint64_t tsc)
+{
+	wrmsr(MSR_TSC_DEADLINE, tsc);
+}
@@ -9,7 +9,11 @@
 
 #define BASE 1193180
 
-volatile uint64_t ticks = 0;
+// command byte bits
+#define SELECT(chan) (((chan) - CHAN_TIMER) << 6)
+#define ACCESS_LOHI 0x30
+#define MODE_TERMINAL 0x00
+#define MODE_SQUARE 0x06
 
 uint32_t pit_read_freq(uint8_t chan)
 {
@@ -22,16 +26,33 @@ uint32_t pit_read_freq(uint8_t chan)
 	return div * BASE;
 }
 
+uint16_t pit_read_count(void)
+{
+	uint16_t count;
+	outb(CMD, 0x00); // latch channel 0
+	count = inb(CHAN_TIMER); // low byte
+	count |= inb(CHAN_TIMER) << 8; // high byte
+	return count;
+}
+
 void pit_set_freq(uint8_t chan, uint32_t hz)
 {
 	uint16_t div = BASE / hz;
 	cli();
-	outb(CMD, 0x36);
+	outb(CMD, SELECT(chan) | ACCESS_LOHI | MODE_SQUARE);
 	outb(chan, div & 0xFF); // low byte
 	outb(chan, (div & 0xFF00) >> 8); // high byte
 	sti();
 }
 
+void pit_stop(uint8_t chan)
+{
+	// count down once from the largest count, then stay quiet
+	outb(CMD, SELECT(chan) | ACCESS_LOHI | MODE_TERMINAL);
+	outb(chan, 0);
+	outb(chan, 0);
+}
+
 void spkr_play_tone(uint32_t hz)
 {
 	uint8_t reg;
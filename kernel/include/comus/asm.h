@@ -77,6 +77,86 @@ static inline void rep_outl(uint16_t port, uint32_t *buffer, size_t count)
 		outl(port, *(buffer++));
 }
 
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	__asm__ volatile("wrmsr"
+					 :
+					 : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+						 uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ volatile("cpuid"
+					 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+					 : "0"(leaf));
+}
+
+static inline void cpuid_count(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+							   uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ volatile("cpuid"
+					 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+					 : "0"(leaf), "2"(subleaf));
+}
+
+static inline void clts(void)
+{
+	__asm__ volatile("clts");
+}
+
+static inline uint64_t read_cr3(void)
+{
+	uint64_t cr3;
+	__asm__ volatile("mov %%cr3, %0" : "=r"(cr3));
+	return cr3;
+}
+
+static inline void write_cr3(uint64_t cr3)
+{
+	__asm__ volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+}
+
+static inline uint64_t read_cr4(void)
+{
+	uint64_t cr4;
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	return cr4;
+}
+
+static inline void write_cr4(uint64_t cr4)
+{
+	__asm__ volatile("mov %0, %%cr4" ::"r"(cr4) : "memory");
+}
+
+static inline void invpcid(uint64_t type, uint64_t pcid, const void *addr)
+{
+	struct {
+		uint64_t pcid;
+		uint64_t addr;
+	} desc = { pcid, (uint64_t)addr };
+	__asm__ volatile("invpcid %0, %1" ::"m"(desc), "r"(type) : "memory");
+}
+
+static inline void cpu_relax(void)
+{
+	__asm__ volatile("pause" ::: "memory");
+}
+
 static inline void io_wait(void)
 {
 	outb(0x80, 0);
@@ -26,8 +26,19 @@ struct cpu_feat {
 	uint32_t sse4a : 1;
 	uint32_t avx : 1;
 	uint32_t xsave : 1;
+	uint32_t xsaveopt : 1;
 	uint32_t avx2 : 1;
 	uint32_t avx512 : 1;
+	// timers
+	uint32_t tsc_deadline : 1;
+	uint32_t invariant_tsc : 1;
+	// system calls
+	uint32_t syscall : 1;
+	// paging
+	uint32_t pcid : 1;
+	uint32_t invpcid : 1;
+	uint32_t pdpe1gb : 1;
+	uint32_t smap : 1;
 };
 
 struct cpu_regs {
@@ -66,11 +77,128 @@ struct cpu_regs {
 	uint64_t ss;
 };
 
+struct pcb;
+
+/// per cpu data, %gs points at the running cpu's copy while in the kernel
+struct cpu_local {
+	// pointer to this structure, so it can be loaded from %gs:0
+	struct cpu_local *self;
+	// process running on this cpu (offset is used by idt.S)
+	struct pcb *current_pcb;
+	// top of the stack the kernel is entered on (offset is used by idt.S)
+	uint64_t kernel_stack;
+	// user stack pointer saved by syscall_entry (offset is used by idt.S)
+	uint64_t user_stack;
+	// register state saved by the last interrupt
+	struct cpu_regs *regs;
+	// index of this cpu
+	uint32_t id;
+	// local apic id of this cpu
+	uint32_t apic_id;
+	// how many times this cpu has taken the kernel lock
+	uint32_t lock_depth;
+	// set once the cpu has finished booting
+	volatile bool online;
+	// set while the cpu is halted waiting for work
+	volatile bool idle;
+	// clock time the timer interrupt is programmed for
+	uint64_t next_event;
+	// clock time the running process' slice ends
+	uint64_t slice_end;
+	// process whose fpu state was last loaded on this cpu
+	struct pcb *fpu_owner;
+	// set if the fpu registers have changed since they were saved
+	bool fpu_dirty;
+	// kernel mapping generation this cpu's tlb has caught up to
+	uint64_t tlb_gen;
+	// pcid generation this cpu's tlb has caught up to
+	uint64_t pcid_gen;
+	// user memory context the kernel is copying to or from
+	struct mem_ctx_s *uaccess_ctx;
+	// user memory context loaded in cr3, NULL for the kernel's
+	struct mem_ctx_s *mem_ctx;
+};
+
+/**
+ * @returns the per cpu data of the running cpu
+ */
+static inline struct cpu_local *cpu_local(void)
+{
+	struct cpu_local *local;
+	__asm__("movq %%gs:0, %0" : "=r"(local));
+	return local;
+}
+
+/**
+ * @returns the index of the running cpu
+ */
+static inline uint32_t cpu_id(void)
+{
+	return cpu_local()->id;
+}
+
 /**
  * Initalize current cpu
  */
 void cpu_init(void);
 
+/**
+ * Initalize an application processor, called on the processor itself
+ * @param local - the per cpu data for this processor
+ */
+void cpu_init_ap(struct cpu_local *local);
+
+/**
+ * Start every application processor listed by ACPI. Returns holding
+ * the kernel lock, which is released on the first dispatch.
+ */
+void smp_init(void);
+
+/**
+ * @returns the number of cpus that are online
+ */
+uint32_t cpu_count(void);
+
+/**
+ * @returns the per cpu data of the cpu at the given index
+ */
+struct cpu_local *cpu_get(uint32_t id);
+
+/**
+ * Send a wake up interrupt to one idle cpu, so it can look for work
+ */
+void cpu_wake_idle(void);
+
+/**
+ * Send a wake up interrupt to a cpu, so it reprograms its timer and
+ * notices if its process was killed
+ */
+void cpu_kick(uint32_t id);
+
+/**
+ * Take the big kernel lock. Nested calls on the same cpu only
+ * increment the lock depth.
+ */
+void kernel_lock(void);
+
+/**
+ * Drop one level of the big kernel lock, releasing it once the
+ * depth reaches zero.
+ */
+void kernel_unlock(void);
+
+/**
+ * Release the big kernel lock no matter how deep it is held
+ * @returns the previous lock depth to be passed to kernel_relock
+ */
+uint32_t kernel_unlock_all(void);
+
+/**
+ * Take the big kernel lock back to a depth returned by
+ * kernel_unlock_all
+ */
+void kernel_relock(uint32_t depth);
+
 /**
  * Report all cpu information
  */
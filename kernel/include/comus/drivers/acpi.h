@@ -6,6 +6,8 @@
  * ACPI definitions
  */
 
+#include <stdint.h>
+
 /**
  * Loads the ACPI tables
  * https://en.wikipedia.org/wiki/ACPI
@@ -19,6 +21,28 @@ void acpi_init(void *rsdp);
  */
 void acpi_report(void);
 
+/**
+ * @returns the physical address of the local apic registers, or 0
+ * if there is no MADT
+ */
+uint64_t acpi_lapic_addr(void);
+
+/**
+ * @returns the physical address of the hpet registers, or 0
+ * if there is no HPET table
+ */
+uint64_t acpi_hpet_addr(void);
+
+/**
+ * @returns the number of usable processors listed in the MADT
+ */
+uint32_t acpi_cpu_count(void);
+
+/**
+ * @returns the local apic id of the processor at index idx in the MADT
+ */
+uint32_t acpi_cpu_apic_id(uint32_t idx);
+
 /**
  * Shutdowns down the system
  */
@@ -0,0 +1,50 @@
+/**
+ * @file hpet.h
+ *
+ * High Precision Event Timer
+ */
+
+#ifndef HPET_H_
+#define HPET_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Map the hpet registers listed by ACPI and start the main counter
+ */
+int hpet_init(void);
+
+/**
+ * @returns if a usable hpet was found
+ */
+bool hpet_present(void);
+
+/**
+ * @returns the frequency of the main counter in hz
+ */
+uint64_t hpet_freq(void);
+
+/**
+ * @returns the current value of the main counter
+ */
+uint64_t hpet_read(void);
+
+/**
+ * Route comparator 0 to the legacy timer irq in place of the PIT,
+ * leaving it disarmed
+ */
+void hpet_event_enable(void);
+
+/**
+ * Fire comparator 0 once the main counter reaches count. Counts that
+ * already passed fire as soon as possible.
+ */
+void hpet_event_set(uint64_t count);
+
+/**
+ * Disarm comparator 0
+ */
+void hpet_event_stop(void);
+
+#endif /* hpet.h */
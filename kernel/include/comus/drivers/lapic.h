@@ -0,0 +1,91 @@
+/**
+ * @file lapic.h
+ *
+ * Local Advanced Programmable Interrupt Controller
+ */
+
+#ifndef LAPIC_H_
+#define LAPIC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// interrupt vector of the local apic timer
+#define LAPIC_TIMER_VECTOR 0x30
+/// interrupt vector used to wake up idle cpus
+#define LAPIC_WAKE_VECTOR 0x31
+/// interrupt vector of spurious interrupts
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/**
+ * Map the local apic registers
+ * @param phys - physical address of the local apic registers
+ */
+int lapic_init(uint64_t phys);
+
+/**
+ * Software enable the local apic of the running cpu
+ * @param bsp - if the running cpu is the bootstrap processor, which
+ * keeps receiving legacy pic interrupts through LINT0
+ */
+void lapic_enable(int bsp);
+
+/**
+ * @returns the local apic id of the running cpu
+ */
+uint32_t lapic_id(void);
+
+/**
+ * Signal the end of a local apic interrupt
+ */
+void lapic_eoi(void);
+
+/**
+ * Send an INIT ipi to a processor
+ */
+void lapic_send_init(uint32_t apic_id);
+
+/**
+ * Send a STARTUP ipi to a processor
+ * @param page - physical page number the processor starts executing at
+ */
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+/**
+ * Send a fixed interrupt to a processor
+ */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/**
+ * @returns if the local apic registers have been mapped
+ */
+bool lapic_present(void);
+
+/**
+ * Measure the local apic timer against the kernel clock. Must be
+ * called on the bootstrap processor.
+ */
+void lapic_timer_calibrate(void);
+
+/**
+ * Put the local apic timer of the running cpu in one-shot mode,
+ * leaving it disarmed
+ * @param tsc_deadline - fire on an absolute tsc value instead of
+ * counting down
+ */
+void lapic_timer_oneshot(bool tsc_deadline);
+
+/**
+ * Fire the local apic timer of the running cpu once
+ * @param ns - nanoseconds from now to fire in, or 0 to disarm
+ */
+void lapic_timer_arm(uint64_t ns);
+
+/**
+ * Fire the local apic timer of the running cpu once, in tsc-deadline
+ * mode
+ * @param tsc - tsc value to fire at, or 0 to disarm
+ */
+void lapic_timer_deadline(uint64_t tsc);
+
+#endif /* lapic.h */
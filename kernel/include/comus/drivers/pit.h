@@ -14,18 +14,26 @@
 
 #include <stdint.h>
 
-// how many time the pit has ticked
-// not accurate time, good for spinning though
-extern volatile uint64_t ticks;
-
 /**
  * Read timer frequency
  */
 uint32_t pit_read_freq(uint8_t chan);
 
+/**
+ * Read the current count of the timer channel, which counts
+ * down once per period and then reloads
+ */
+uint16_t pit_read_count(void);
+
 /**
  * Set timer frequency
  */
 void pit_set_freq(uint8_t chan, uint32_t hz);
 
+/**
+ * Stop a timer channel from firing periodically, once another
+ * timer takes over
+ */
+void pit_stop(uint8_t chan);
+
 #endif
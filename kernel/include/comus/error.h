@@ -19,6 +19,8 @@
 #define E_NO_MEMORY (-5)
 #define E_NOT_FOUND (-6)
 #define E_NO_PROCS (-7)
+#define E_TIMEOUT (-8)
+#define E_AGAIN (-9)
 
 // kernel error codes
 #define E_EMPTY_QUEUE (-100)
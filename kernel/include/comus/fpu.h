@@ -0,0 +1,59 @@
+/**
+ * @file fpu.h
+ *
+ * Lazy saving and loading of process fpu, sse and avx state
+ */
+
+#ifndef FPU_H_
+#define FPU_H_
+
+struct pcb;
+
+/**
+ * Size the fpu save areas for the features enabled by cpu_init, must be
+ * called after the memory module has been initalized.
+ */
+void fpu_init(void);
+
+/**
+ * Called before the running cpu returns into a process. Lets the process
+ * use the fpu right away if its state is still loaded, otherwise sets
+ * CR0.TS so its first fpu instruction traps.
+ *
+ * @param pcb - the process about to run
+ */
+void fpu_switch(struct pcb *pcb);
+
+/**
+ * Save the fpu state loaded on the running cpu if it has changed, so
+ * its process can be run on any cpu
+ */
+void fpu_flush(void);
+
+/**
+ * Handle a device not available trap, loading the state of the process
+ * that caused it
+ *
+ * @param pcb - the running process
+ * @returns 0 on success or E_NO_MEMORY
+ */
+int fpu_trap(struct pcb *pcb);
+
+/**
+ * Give a child a copy of its parent's fpu state
+ *
+ * @param child - the new process
+ * @param parent - the process being cloned, running on this cpu
+ * @returns 0 on success or E_NO_MEMORY
+ */
+int fpu_clone(struct pcb *child, struct pcb *parent);
+
+/**
+ * Throw away the fpu state of a process, the next time it uses the fpu
+ * it starts from the initial state
+ *
+ * @param pcb - the process
+ */
+void fpu_release(struct pcb *pcb);
+
+#endif /* fpu.h */
@@ -6,12 +6,21 @@
  * Defined kernel limits
  */
 
-/// number of pts to identity map the kernel (1pt = 2MB)
+/// number of 2MB pages to identity map the kernel
 #define N_IDENT_PTS 64 // max 512 (1G)
 
-/// max number of processes
+/// max number of cpus brought up by smp_init
+#define N_CPUS 16
+
+/// default max number of processes, see pcb_set_limit
 #define N_PROCS 256
 
+/// number of process ids, they are reused once they run out (max 65536)
+#define N_PIDS 32768
+
+/// number of scheduler priority levels (max 64)
+#define N_PRIO_LEVELS 8
+
 /// process limits
 #define N_OPEN_FILES 64
 #define N_ARGS 64
@@ -30,6 +39,15 @@
 /// elf limits
 #define N_ELF_SEGMENTS 16
 
+/// max number of demand paged areas in a memory context
+#define N_MEM_AREAS 32
+
+/// swap space: ata device (0-3), the sector it starts at, and its length
+/// in pages. swap is left off if the device is missing or has a file system
+#define SWAP_ATA_DEVICE 1
+#define SWAP_START_LBA 0
+#define N_SWAP_PAGES 65536 // 256M
+
 /// input buffer
 #define N_KEYCODE 64
 #define N_MOUSEEV 64
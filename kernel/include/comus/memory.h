@@ -25,6 +25,17 @@
 #define F_DIRTY 0x040
 #define F_MEGABYTE 0x080
 #define F_GLOBAL 0x100
+// not a page flag, zero the pages mem_alloc_pages* hands out
+#define F_ZERO 0x200
+// not a page flag, memory shared with another process, forking keeps it
+// shared instead of copy on write
+#define F_SHARED 0x400
+
+// the kernel owns the first pml4 entry of every address space,
+// processes get everything above it in the lower half
+#define KERNEL_SPACE_END 0x8000000000
+#define USER_SPACE_START KERNEL_SPACE_END
+#define USER_SPACE_END 0x800000000000
 
 #define SEG_TYPE_FREE 0
 #define SEG_TYPE_RESERVED 1
@@ -52,6 +63,12 @@ extern mem_ctx_t kernel_mem_ctx;
  */
 void memory_init(void);
 
+/**
+ * Use the swap space set up in limits.h if it is there, called once the
+ * disks and their file systems are loaded
+ */
+void swap_init(void);
+
 /**
  * @returns how much memory the system has
  */
@@ -103,6 +120,28 @@ void mem_ctx_free(mem_ctx_t ctx);
  */
 void mem_ctx_switch(mem_ctx_t ctx);
 
+/**
+ * Flush kernel mappings that changed while another cpu held the kernel
+ * lock, called by every cpu as it takes the lock
+ */
+void mem_tlb_sync(void);
+
+/**
+ * Zero a free page ahead of time for page tables and demand paged memory,
+ * called by idle cpus without the kernel lock
+ *
+ * @returns false if there are enough zeroed pages already
+ */
+bool mem_zero_idle(void);
+
+/**
+ * Get the value to load into cr3 to switch to a context on this cpu,
+ * giving the context a pcid and flushing stale ones as needed
+ *
+ * @param ctx - the memory context
+ */
+uint64_t mem_ctx_cr3(mem_ctx_t ctx);
+
 /**
  * @returns the pgdir pointer in the memory ctx
  */
@@ -128,6 +167,76 @@ void *mem_mapaddr(mem_ctx_t ctx, void *phys, void *virt, size_t len,
  */
 void mem_unmapaddr(mem_ctx_t ctx, const void *virt);
 
+/**
+ * Map pages allocated in another context at the same vitural address, the
+ * pages are freed once every context that maps them has unmapped them
+ *
+ * @param ctx - the memory context to map the pages into
+ * @param from - the memory context the pages were allocated in
+ * @param virt - the vitural address of the pages in both contexts
+ * @param count - the number of pages, which must be physically contiguous
+ * @param flags - memory flags (F_PRESENT will always be set)
+ * @returns virt, or NULL on failure
+ */
+void *mem_mapshared(mem_ctx_t ctx, mem_ctx_t from, void *virt, size_t count,
+					unsigned int flags);
+
+/**
+ * Handles a page fault in a memory context, giving copy on write pages
+ * their own copy when they are written to, and demand paged pages their
+ * physical page when they are first touched
+ *
+ * @param ctx - the memory context that faulted
+ * @param virt - the faulting address (cr2)
+ * @param code - the page fault error code
+ * @returns 0 if the fault was handled, 1 if it is a real fault
+ */
+int mem_page_fault(mem_ctx_t ctx, const void *virt, uint64_t code);
+
+/**
+ * Copy from a user memory context into the kernel. Pages that were not
+ * touched yet are faulted in, and addresses outside of user space, or
+ * that cannot be read, fail the copy instead of the kernel. The context
+ * is left loaded. Copies from kernel_mem_ctx copy kernel memory as is.
+ *
+ * @param ctx - the memory context src is in
+ * @param dst - the kernel buffer to copy to
+ * @param src - the user address to copy from
+ * @param len - the number of bytes to copy
+ * @returns 0 on success, 1 on err
+ */
+int copy_from_user(mem_ctx_t ctx, void *dst, const void *src, size_t len);
+
+/**
+ * Copy from the kernel into a user memory context, like copy_from_user
+ *
+ * @param ctx - the memory context dst is in
+ * @param dst - the user address to copy to
+ * @param src - the kernel buffer to copy from
+ * @param len - the number of bytes to copy
+ * @returns 0 on success, 1 on err
+ */
+int copy_to_user(mem_ctx_t ctx, void *dst, const void *src, size_t len);
+
+/**
+ * Get the length of a string in a user memory context
+ *
+ * @param ctx - the memory context str is in
+ * @param str - the user address of the string
+ * @param max - the most bytes to look at
+ * @returns the length, max if there is no nul byte before it, or -1 on err
+ */
+long strnlen_user(mem_ctx_t ctx, const char *str, size_t max);
+
+/**
+ * Called by the page fault handler when the kernel faults on a user
+ * address it could not map, so the user copy returns an error
+ *
+ * @param rip - the faulting instruction, moved to the error path
+ * @returns true if the fault was in a user copy
+ */
+bool uaccess_fixup(uint64_t *rip);
+
 /**
  * Gets the physical address for a given vitural address
  * @param ctx - the memory context
@@ -164,6 +273,17 @@ void *mem_alloc_page_at(mem_ctx_t ctx, void *virt, unsigned int flags);
  */
 void *mem_alloc_pages(mem_ctx_t ctx, size_t count, unsigned int flags);
 
+/**
+ * Allocate size_t amount of contiguous virtual pages, backed by contiguous
+ * physical pages, for memory that is used by its physical address (DMA)
+ *
+ * @param ctx - the memory context
+ * @param count - the number of pages to allocate
+ * @param flags - memory flags (F_PRESENT will always be set)
+ * @returns the address allocated or NULL on failure
+ */
+void *mem_alloc_pages_contig(mem_ctx_t ctx, size_t count, unsigned int flags);
+
 /**
  * Allocate size_t amount of contiguous virtual pages at a given virtural address with the given paging structure
  *
@@ -176,10 +296,52 @@ void *mem_alloc_pages(mem_ctx_t ctx, size_t count, unsigned int flags);
 void *mem_alloc_pages_at(mem_ctx_t ctx, size_t count, void *virt,
 						 unsigned int flags);
 
+/**
+ * Reserve max vitural pages at a given vitural address. The first count
+ * pages can be used, and are given zeroed physical pages the first time
+ * they are touched.
+ *
+ * @param ctx - the memory context
+ * @param virt - the vitural address to reserve at
+ * @param count - the number of pages that can be used
+ * @param max - the number of pages to reserve
+ * @param flags - memory flags (F_PRESENT will always be set)
+ * @returns the address reserved or NULL on failure
+ */
+void *mem_area_alloc(mem_ctx_t ctx, void *virt, size_t count, size_t max,
+					 unsigned int flags);
+
+/**
+ * Reserve max vitural pages below top for a stack. The last count pages
+ * can be used, and touching the page below them makes the stack a page
+ * bigger, up to max pages. Pages are zeroed the first time they are touched.
+ *
+ * @param ctx - the memory context
+ * @param top - the address after the stack
+ * @param count - the number of pages that can be used
+ * @param max - the number of pages to reserve
+ * @param flags - memory flags (F_PRESENT will always be set)
+ * @returns the lowest address reserved or NULL on failure
+ */
+void *mem_stack_alloc(mem_ctx_t ctx, void *top, size_t count, size_t max,
+					  unsigned int flags);
+
+/**
+ * Change the number of pages that can be used in an area from
+ * mem_area_alloc, pages past the new end are freed
+ *
+ * @param ctx - the memory context
+ * @param virt - the address returned by mem_area_alloc
+ * @param count - the number of pages that can be used
+ * @returns 0 on success, 1 if count is more than was reserved
+ */
+int mem_area_resize(mem_ctx_t ctx, const void *virt, size_t count);
+
 /**
  * Free allocated pages with the given paging structure.
  *
- * @param ptr - the pointer provided by alloc_page or alloc_pages
+ * @param ptr - the pointer provided by alloc_page, alloc_pages or
+ *              mem_area_alloc
  */
 void mem_free_pages(mem_ctx_t ctx, const void *ptr);
 
@@ -206,6 +368,15 @@ void *kmapaddr(void *phys, void *virt, size_t len, unsigned int flags);
  */
 void *kmapuseraddr(mem_ctx_t ctx, const void *virt, size_t len);
 
+/**
+ * Unmaps an address mapped by kmapuseraddr, letting the context's pages
+ * be swapped out again
+ *
+ * @param ctx - the userspace memory context it was mapped from
+ * @param virt - the vitural address returned from kmapuseraddr
+ */
+void kunmapuseraddr(mem_ctx_t ctx, const void *virt);
+
 /**
  * Gets the physical address for a given vitural address
  * @param virt - the vitural address
@@ -233,6 +404,15 @@ void *kalloc_page(void);
  */
 void *kalloc_pages(size_t count);
 
+/**
+ * Allocate size_t amount of contiguous virtual pages, backed by contiguous
+ * physical pages
+ *
+ * @param count - the number of pages to allocate
+ * @returns the address allocated or NULL on failure
+ */
+void *kalloc_pages_contig(size_t count);
+
 /**
  * Free allocated pages.
  *
@@ -13,9 +13,9 @@
 #include <comus/limits.h>
 #include <comus/memory.h>
 #include <comus/syscalls.h>
+#include <comus/timer.h>
 #include <comus/fs.h>
 #include <lib.h>
-#include <elf.h>
 
 #define PCB_REG(pcb, x) ((pcb)->regs.x)
 #define PCB_RET(pcb) ((pcb)->regs.rax)
@@ -43,18 +43,43 @@ enum proc_state {
 	N_PROC_STATES,
 };
 
+/// ordering of pcb queues
+enum pcb_queue_order {
+	O_PCB_FIFO,
+	O_PCB_PRIO,
+	O_PCB_PID,
+	O_PCB_WAKEUP,
+	// sentinel
+	N_PCB_ORDERINGS,
+};
+
+/// pcb queue, linked through the pcbs it holds
+struct pcb_queue_s {
+	struct pcb *head;
+	struct pcb *tail;
+	enum pcb_queue_order order;
+};
+
+/// pcb queue structure
+typedef struct pcb_queue_s *pcb_queue_t;
+
 /// process control block
 struct pcb {
 	// context
 	mem_ctx_t memctx;
 	struct cpu_regs regs;
+	void *fpu; // fpu save area, NULL until the fpu is used
+	uint32_t fpu_cpu; // cpu the fpu state was last loaded on
 
 	// metadata
 	pid_t pid;
 	struct pcb *parent;
 	enum proc_state state;
 	size_t priority;
-	size_t ticks;
+	size_t level;
+	uint64_t slice;
+	uint64_t epoch;
+	uint32_t cpu;
 
 	// heap
 	char *heap_start;
@@ -63,18 +88,27 @@ struct pcb {
 	// open files
 	struct file *open_files[N_OPEN_FILES];
 
-	// elf metadata
-	Elf64_Ehdr elf_header;
-	Elf64_Phdr elf_segments[N_ELF_SEGMENTS];
-	Elf64_Half n_elf_segments;
-
 	// queue linkage
 	struct pcb *next; // next PDB in queue
+	struct pcb *prev; // previous PCB in queue
+	pcb_queue_t queue; // queue the PCB is in
+
+	// pid hash linkage
+	struct pcb *hash_next;
+
+	// process tree
+	struct pcb *children; // first child
+	struct pcb *sibling_next;
+	struct pcb *sibling_prev;
+	struct pcb_queue_s zombies; // children waiting to be reaped
 
 	// process state information
 	uint64_t syscall;
 	uint64_t wakeup;
+	uint64_t wait_key; // key passed to pcb_wait
+	struct timer timer;
 	uint8_t exit_status;
+	bool killed;
 
 	// pipe to check for shared memory
 	void *shared_mem;
@@ -82,34 +116,17 @@ struct pcb {
 	pid_t shared_mem_source;
 };
 
-/// ordering of pcb queues
-enum pcb_queue_order {
-	O_PCB_FIFO,
-	O_PCB_PRIO,
-	O_PCB_PID,
-	O_PCB_WAKEUP,
-	// sentinel
-	N_PCB_ORDERINGS,
-};
-
-/// pcb queue structure
-typedef struct pcb_queue_s *pcb_queue_t;
+/// multi level feedback run queue structure
+typedef struct run_queue_s *run_queue_t;
 
 /// public facing pcb queues
-extern pcb_queue_t pcb_freelist;
-extern pcb_queue_t ready_queue;
-extern pcb_queue_t zombie_queue;
+extern run_queue_t ready_queues[N_CPUS];
 extern pcb_queue_t syscall_queue[N_SYSCALLS];
 
-/// pointer to the currently-running process
-extern struct pcb *current_pcb;
+/// pointer to the process running on this cpu
+#define current_pcb (cpu_local()->current_pcb)
 /// pointer to the pcb for the 'init' process
 extern struct pcb *init_pcb;
-/// the process table
-extern struct pcb ptable[N_PROCS];
-
-/// next avaliable pid
-extern pid_t next_pid;
 
 /**
  * Initialization for the process module
@@ -117,19 +134,35 @@ extern pid_t next_pid;
 void pcb_init(void);
 
 /**
- * allocate a PCB from the free list
+ * allocate a PCB, and give it a pid
  *
- * @returns 0 on success or non zero error code
+ * @returns 0 on success, E_NO_PCBS if the process limit is reached,
+ *          or another non zero error code
  */
 int pcb_alloc(struct pcb **pcb);
 
 /**
- * free an allocted PCB back to the free list
+ * free an allocted PCB, it must not be in any queue
  *
  * @param pcb - pointer to the PCB to be deallocated
  */
 void pcb_free(struct pcb *pcb);
 
+/**
+ * @returns the max number of processes that can exist at once
+ */
+size_t pcb_limit(void);
+
+/**
+ * Set the max number of processes that can exist at once. Lowering it
+ * below the number of running processes only stops new ones from being
+ * created.
+ *
+ * @param max - the new limit, N_PROCS by default
+ * @returns 0 on success or E_BAD_PARAM if the limit is out of range
+ */
+int pcb_set_limit(size_t max);
+
 /**
  * turn the indicated process into a zombie
  *
@@ -160,6 +193,46 @@ struct pcb *pcb_find_pid(pid_t pid);
  */
 struct pcb *pcb_find_ppid(pid_t pid);
 
+/**
+ * Locate a zombie child of a process
+ *
+ * @param parent   The process whose children are searched
+ * @param pid      The PID of the child, or 0 for any child
+ * @return Pointer to the PCB, or NULL
+ */
+struct pcb *pcb_find_zombie(struct pcb *parent, pid_t pid);
+
+/**
+ * Make a process the child of another, removing it from the
+ * children of its old parent
+ *
+ * @param pcb      The process to be moved
+ * @param parent   The new parent, or NULL
+ */
+void pcb_set_parent(struct pcb *pcb, struct pcb *parent);
+
+/**
+ * Block a process until pcb_wake is called with the same key, or the
+ * clock reaches timeout. The caller must dispatch a new process.
+ *
+ * The process returns SUCCESS from its system call if it is woken, or
+ * E_TIMEOUT if it times out.
+ *
+ * @param pcb      The process to block
+ * @param key      What it is waiting on, e.g. a physical address
+ * @param timeout  Clock time to give up at, or 0 to wait forever
+ */
+void pcb_wait(struct pcb *pcb, uint64_t key, uint64_t timeout);
+
+/**
+ * Wake up processes blocked in pcb_wait, in the order they waited
+ *
+ * @param key   The key they are waiting on
+ * @param n     The most processes to wake
+ * @return The number of processes woken
+ */
+size_t pcb_wake(uint64_t key, size_t n);
+
 /**
  * Initialize a PCB queue.
  *
@@ -223,6 +296,55 @@ int pcb_queue_pop(pcb_queue_t queue, struct pcb **pcb);
  */
 int pcb_queue_remove(pcb_queue_t queue, struct pcb *pcb);
 
+/**
+ * Initialize a run queue, leaving every priority level empty.
+ *
+ * @param rq[out]  The run queue to be initialized
+ */
+void run_queue_reset(run_queue_t rq);
+
+/**
+ * Return the count of processes in the specified run queue.
+ *
+ * @param[in] rq  The run queue to check
+ * @return the count (0 if the run queue is empty)
+ */
+size_t run_queue_length(const run_queue_t rq);
+
+/**
+ * Inserts a PCB at the tail of the level given by pcb->level.
+ *
+ * @param rq[in,out]  The run queue to be used
+ * @param pcb[in]     The PCB to be inserted
+ * @return status of the insertion request
+ */
+int run_queue_insert(run_queue_t rq, struct pcb *pcb);
+
+/**
+ * Remove the PCB at the head of the highest non-empty level.
+ *
+ * @param rq[in,out]  The run queue to be used
+ * @param pcb[out]    Pointer to where the PCB pointer will be saved
+ * @return status of the removal request
+ */
+int run_queue_pop(run_queue_t rq, struct pcb **pcb);
+
+/**
+ * Remove the specified PCB from the run queue.
+ *
+ * @param rq[in,out]  The run queue to be used
+ * @param pcb[in]     Pointer to the PCB to be removed
+ * @return status of the removal request
+ */
+int run_queue_remove(run_queue_t rq, struct pcb *pcb);
+
+/**
+ * Move every queued PCB back to its base priority level.
+ *
+ * @param rq[in,out]  The run queue to be boosted
+ */
+void run_queue_boost(run_queue_t rq);
+
 /**
  * Schedule the supplied process
  *
@@ -231,13 +353,23 @@ int pcb_queue_remove(pcb_queue_t queue, struct pcb *pcb);
 void schedule(struct pcb *pcb);
 
 /**
- * Select the next process to receive the CPU
+ * Select the next process to receive this CPU, stealing one from
+ * another CPU if our run queue is empty
  */
 __attribute__((noreturn)) void dispatch(void);
 
 /**
- * Scheduler function called on every system tick
+ * Save what is left of the running process' time slice, in case it
+ * blocks before returning to userspace
+ *
+ * @param pcb   Pointer to the PCB of the process running on this CPU
+ */
+void pcb_save_slice(struct pcb *pcb);
+
+/**
+ * Scheduler function called on every timer interrupt of this CPU,
+ * ends the running process' slice once it is used up
  */
-void pcb_on_tick(void);
+void pcb_on_cpu_tick(void);
 
 #endif /* procs.h */
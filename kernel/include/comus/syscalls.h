@@ -34,9 +34,14 @@
 #define SYS_allocshared 21
 #define SYS_popsharedmem 22
 #define SYS_keypoll 23
+#define SYS_nanotime 24
+#define SYS_sleepuntil 25
+#define SYS_proclimit 26
+#define SYS_futexwait 27
+#define SYS_futexwake 28
 
 // UPDATE THIS DEFINITION IF MORE SYSCALLS ARE ADDED!
-#define N_SYSCALLS 24
+#define N_SYSCALLS 29
 
 // interrupt vector entry for system calls
 #define VEC_SYSCALL 0x80
@@ -0,0 +1,83 @@
+/**
+ * @file tick.h
+ *
+ * Monotonic kernel clock, and the one-shot timer interrupts that
+ * replace a fixed periodic tick
+ */
+
+#ifndef TICK_H_
+#define TICK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <comus/memory.h>
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+/**
+ * Pick and calibrate the clock source, an invariant TSC if the cpu has
+ * one, otherwise the HPET. Must be called with the PIT running at 1 kHz
+ * and after the HPET has been initalized.
+ */
+void clock_init(void);
+
+/**
+ * @returns if clock_init has been called
+ */
+bool clock_running(void);
+
+/**
+ * @returns nanoseconds since clock_init
+ */
+uint64_t clock_ns(void);
+
+/**
+ * @returns milliseconds since clock_init
+ */
+static inline uint64_t clock_ms(void)
+{
+	return clock_ns() / NS_PER_MS;
+}
+
+/**
+ * @returns seconds since the unix epoch, from the rtc time read
+ *          in clock_init
+ */
+uint64_t clock_unix(void);
+
+/**
+ * Map the read only time page at TIME_PAGE_ADDR, so the process
+ * can read the clock without a system call
+ *
+ * @param ctx - the process' memory context
+ * @returns 0 on success, 1 on failure
+ */
+int clock_map(mem_ctx_t ctx);
+
+/**
+ * Pick the timer interrupt source for the bootstrap processor, and stop
+ * the periodic PIT interrupt if it is no longer needed. Must be called
+ * after the local apic has been enabled and calibrated, if there is one.
+ */
+void tick_init(void);
+
+/**
+ * Start the timer interrupt source on an application processor
+ */
+void tick_init_ap(void);
+
+/**
+ * Called from the timer interrupt on the running cpu
+ */
+void tick_handler(void);
+
+/**
+ * Program the next timer interrupt of the running cpu for the end of
+ * the running process' time slice, or the next kernel timer on the
+ * bootstrap processor. Called every time the cpu leaves the kernel.
+ */
+void tick_program(void);
+
+#endif /* tick.h */
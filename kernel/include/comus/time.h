@@ -32,7 +32,8 @@ struct time {
 void gettime(struct time *time);
 
 /**
- * Return current UTC time
+ * Return current UTC time, read from the rtc. This is slow, use
+ * clock_unix once the clock is running.
  */
 uint64_t unixtime(void);
 
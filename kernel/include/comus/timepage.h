@@ -0,0 +1,36 @@
+/**
+ * @file timepage.h
+ *
+ * Read only page the kernel maps into every process, so the clock can
+ * be read without a system call. Shared with userspace.
+ */
+
+#ifndef TIMEPAGE_H_
+#define TIMEPAGE_H_
+
+#include <stdint.h>
+
+/// where the time page is mapped in every process
+#define TIME_PAGE_ADDR 0x7FFFFFFF0000
+
+/// the clock can only be read with a system call
+#define TIME_CLOCK_SYSCALL 0
+/// the clock is the tsc, which any process can read
+#define TIME_CLOCK_TSC 1
+
+struct time_page {
+	/// odd while the kernel is updating the page
+	uint32_t seq;
+	/// how the clock can be read, TIME_CLOCK_*
+	uint32_t clock;
+	/// tsc value at nanosecond zero
+	uint64_t tsc_base;
+	/// nanoseconds = ((tsc - tsc_base) * mult) >> shift
+	uint64_t mult;
+	uint32_t shift;
+	uint32_t reserved;
+	/// unix time at nanosecond zero, read from the rtc at boot
+	uint64_t boot_unix;
+};
+
+#endif /* timepage.h */
@@ -0,0 +1,74 @@
+/**
+ * @file timer.h
+ *
+ * Kernel timers, kept in a hierarchical timing wheel. Expiry times
+ * are in nanoseconds on the kernel clock (clock_ns), and are run with
+ * microsecond resolution.
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// kernel timer, embedded in the structure that owns it
+struct timer {
+	// clock time the timer expires at
+	uint64_t expires;
+	// called once the timer expires
+	void (*callback)(struct timer *timer);
+	// passed along to the callback
+	void *data;
+	// wheel slot linkage
+	struct timer *next;
+	struct timer **pprev;
+	uint32_t slot;
+};
+
+/**
+ * Initalize a timer, leaving it disarmed
+ *
+ * @param timer - the timer to initalize
+ * @param callback - called with the timer once it expires
+ * @param data - data for the callback
+ */
+void timer_init(struct timer *timer, void (*callback)(struct timer *),
+				void *data);
+
+/**
+ * Arm a timer, re-arming it if it was already armed. Timers that have
+ * already expired run on the next tick. O(1).
+ *
+ * @param timer - the timer to arm
+ * @param expires - the clock time to expire at
+ */
+void timer_arm(struct timer *timer, uint64_t expires);
+
+/**
+ * Disarm a timer, does nothing if it is not armed. O(1).
+ *
+ * @param timer - the timer to disarm
+ */
+void timer_cancel(struct timer *timer);
+
+/**
+ * @returns if the timer is armed
+ */
+bool timer_armed(const struct timer *timer);
+
+/**
+ * @returns the earliest clock time timer_tick has anything to do,
+ * which is never after the next timer expires, or UINT64_MAX if no
+ * timers are armed
+ */
+uint64_t timer_next_expiry(void);
+
+/**
+ * Run every timer that expired up to and including now
+ *
+ * @param now - the current clock time
+ */
+void timer_tick(uint64_t now);
+
+#endif /* timer.h */
@@ -10,6 +10,8 @@
 #define _KLIB_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 /**
  * converts single digit int to base 36
@@ -320,16 +322,110 @@ void *krealloc(void *ptr, size_t size);
 void kfree(void *ptr);
 
 /**
- * Assuming the PIT ticks every ms, uses how many ticks to decide when to return.
- * Returns when n*1000 ticks have passed
+ * Object cache, hands out fixed size objects from slabs of pages
+ */
+struct kcache {
+	/// name used in error messages
+	const char *name;
+	/// size of each object
+	size_t size;
+	/// bytes between objects in a slab
+	size_t stride;
+	/// offset of the first object's header in a slab
+	size_t offset;
+	/// objects in each slab
+	size_t count;
+	/// pages in each slab
+	size_t pages;
+	/// slabs with some free objects
+	struct kcache_slab *partial;
+	/// slabs with no free objects
+	struct kcache_slab *full;
+	/// a completely free slab kept for reuse, or NULL
+	struct kcache_slab *empty;
+	/// number of objects handed out
+	size_t used;
+};
+
+/**
+ * Initalizes an object cache, no memory is allocated until the first
+ * object is
+ *
+ * @param cache - the cache to initalize
+ * @param name - name of the cache
+ * @param size - the size of each object
+ * @param align - the alignment of each object, a power of two up to
+ *                PAGE_SIZE, objects are always 16 byte aligned
+ */
+void kcache_init(struct kcache *cache, const char *name, size_t size,
+				 size_t align);
+
+/**
+ * Allocates an object from a cache. The object is not zeroed.
+ *
+ * @param cache - the cache to allocate from
+ * @returns the object allocated or NULL on failure
+ */
+void *kcache_alloc(struct kcache *cache);
+
+/**
+ * Frees an object back to the cache it was allocated from
+ *
+ * @param cache - the cache the object came from
+ * @param ptr - the object to free
+ */
+void kcache_free(struct kcache *cache, void *ptr);
+
+/**
+ * Finds the cache an object was allocated from
+ *
+ * @param ptr - the object
+ * @returns the cache, or NULL if the header in front of ptr has no slab
+ */
+struct kcache *kcache_owner(const void *ptr);
+
+/**
+ * Ticket spinlock, safe to share between cpus
+ */
+struct kspinlock {
+	volatile uint32_t next;
+	volatile uint32_t owner;
+};
+
+/**
+ * Acquires a spinlock, spinning until it is free. Locks are handed
+ * out in the order they were requested.
+ *
+ * @param lock - the lock to acquire
+ */
+void kspin_lock(struct kspinlock *lock);
+
+/**
+ * Attempts to acquire a spinlock without spinning
+ *
+ * @param lock - the lock to acquire
+ * @returns true if the lock was acquired
+ */
+bool kspin_trylock(struct kspinlock *lock);
+
+/**
+ * Releases a spinlock held by the current cpu
+ *
+ * @param lock - the lock to release
+ */
+void kspin_unlock(struct kspinlock *lock);
+
+/**
+ * Spins for the given number of seconds, see kspin_milliseconds
  *
  * @param seconds - number of seconds to wait, minimum (may take longer)
  */
 void kspin_seconds(size_t seconds);
 
 /**
- * Assuming the PIT ticks every ms, uses how many ticks to decide when to return.
- * Returns when n ticks have passed
+ * Polls the kernel clock, or the PIT counter (assuming it ticks every ms) before
+ * the clock is running, to decide when to return. Does not need interrupts, so
+ * it is safe to call while holding the kernel lock.
  *
  * @param milliseconds - number of milliseconds to wait, minimum (may take longer)
  */
@@ -3,15 +3,47 @@
 
 #define MAGIC 0xBEEFCAFE
 
+// in front of every large allocation, where kcache puts the slab
+// pointer in front of its objects, which is never NULL
 struct page_header {
+	void *slab;
+	uint32_t magic;
+	uint32_t pages;
 	size_t len;
-	uint64_t magic;
 };
 
+// small allocations are rounded up to one of these, the sizes
+// between powers of two keep common structs (tar files, process
+// tables) from wasting close to half their object
+static const size_t class_size[] = {
+	16,	 32,  48,  64,	 96,   128,	 192,
+	256, 384, 512, 768, 1024, 1536, 2048,
+};
+
+#define N_CLASSES (sizeof(class_size) / sizeof(class_size[0]))
+#define MAX_CLASS_SIZE 2048
+
+static struct kcache classes[N_CLASSES];
+static bool classes_ready = false;
+
+static void classes_init(void)
+{
+	for (size_t i = 0; i < N_CLASSES; i++)
+		kcache_init(&classes[i], "kalloc", class_size[i], 16);
+	classes_ready = true;
+}
+
+static struct kcache *size_class(size_t size)
+{
+	for (size_t i = 0; i < N_CLASSES; i++)
+		if (size <= class_size[i])
+			return &classes[i];
+	return NULL;
+}
+
 static struct page_header *get_header(void *ptr)
 {
-	struct page_header *header =
-		(struct page_header *)((uintptr_t)ptr - PAGE_SIZE);
+	struct page_header *header = (struct page_header *)ptr - 1;
 
 	if (header->magic != MAGIC)
 		return NULL; // invalid pointer
@@ -19,25 +51,45 @@ static struct page_header *get_header(void *ptr)
 	return header;
 }
 
-void *kalloc(size_t size)
+// larger allocations get their own pages, plus one in front for the header
+static void *large_alloc(size_t size)
 {
 	struct page_header *header;
 	size_t pages;
+	char *base;
 
-	pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
-	header = kalloc_pages(pages + 1);
-	if (header == NULL)
+	pages = (size + PAGE_SIZE - 1) / PAGE_SIZE + 1;
+	base = kalloc_pages(pages);
+	if (base == NULL)
 		return NULL;
 
+	header = (struct page_header *)(base + PAGE_SIZE) - 1;
+	header->slab = NULL;
 	header->magic = MAGIC;
+	header->pages = pages;
 	header->len = size;
 
-	return (char *)header + PAGE_SIZE;
+	return base + PAGE_SIZE;
+}
+
+void *kalloc(size_t size)
+{
+	struct kcache *cache;
+
+	if (!classes_ready)
+		classes_init();
+
+	cache = size_class(size);
+	if (cache == NULL)
+		return large_alloc(size);
+
+	return kcache_alloc(cache);
 }
 
 void *krealloc(void *src, size_t dst_len)
 {
 	struct page_header *header;
+	struct kcache *cache;
 	size_t src_len;
 	void *dst;
 
@@ -53,15 +105,24 @@ void *krealloc(void *src, size_t dst_len)
 		return dst;
 	}
 
-	header = get_header(src);
-
-	if (header == NULL)
-		return NULL;
-
-	src_len = header->len;
-
-	if (src_len == 0)
-		return NULL;
+	cache = kcache_owner(src);
+	if (cache != NULL) {
+		src_len = cache->size;
+		// still fits in its object
+		if (dst_len <= src_len)
+			return src;
+	} else {
+		header = get_header(src);
+		if (header == NULL)
+			return NULL;
+		// still fits in its pages
+		if (dst_len > MAX_CLASS_SIZE &&
+			(dst_len + PAGE_SIZE - 1) / PAGE_SIZE + 1 == header->pages) {
+			header->len = dst_len;
+			return src;
+		}
+		src_len = header->len;
+	}
 
 	dst = kalloc(dst_len);
 
@@ -80,14 +141,21 @@ void *krealloc(void *src, size_t dst_len)
 void kfree(void *ptr)
 {
 	struct page_header *header;
+	struct kcache *cache;
 
 	if (ptr == NULL)
 		return;
 
+	cache = kcache_owner(ptr);
+	if (cache != NULL) {
+		kcache_free(cache, ptr);
+		return;
+	}
+
 	header = get_header(ptr);
 
 	if (header == NULL)
 		return;
 
-	kfree_pages(header);
+	kfree_pages((char *)ptr - PAGE_SIZE);
 }
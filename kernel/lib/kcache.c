@@ -0,0 +1,177 @@
+#include <lib.h>
+#include <comus/memory.h>
+
+/// a slab is made big enough to hold at least this many objects
+#define SLAB_MIN_OBJECTS 8
+
+#define ALIGN(n, a) (((n) + (a) - 1) & ~((size_t)(a) - 1))
+
+// in front of every object, so kcache_free can find its slab
+struct kcache_obj {
+	struct kcache_slab *slab;
+	// next free object in the slab
+	struct kcache_obj *next;
+};
+
+// at the start of every slab
+struct kcache_slab {
+	struct kcache *cache;
+	struct kcache_slab *next;
+	struct kcache_slab *prev;
+	// first free object
+	struct kcache_obj *free;
+	// objects handed out
+	size_t used;
+};
+
+static void slab_push(struct kcache_slab **list, struct kcache_slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list != NULL)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+static void slab_unlink(struct kcache_slab **list, struct kcache_slab *slab)
+{
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+static struct kcache_slab *slab_create(struct kcache *cache)
+{
+	struct kcache_slab *slab;
+	char *base;
+
+	slab = kalloc_pages(cache->pages);
+	if (slab == NULL)
+		return NULL;
+
+	slab->cache = cache;
+	slab->next = NULL;
+	slab->prev = NULL;
+	slab->free = NULL;
+	slab->used = 0;
+
+	// chain objects back to front, so they are handed out in order
+	base = (char *)slab + cache->offset;
+	for (size_t i = cache->count; i > 0; i--) {
+		struct kcache_obj *obj;
+		obj = (struct kcache_obj *)(base + (i - 1) * cache->stride);
+		obj->slab = slab;
+		obj->next = slab->free;
+		slab->free = obj;
+	}
+
+	return slab;
+}
+
+void kcache_init(struct kcache *cache, const char *name, size_t size,
+				 size_t align)
+{
+	size_t bytes, hdr;
+
+	align = MAX(align, sizeof(struct kcache_obj));
+	assert((align & (align - 1)) == 0 && align <= PAGE_SIZE,
+		   "kcache_init: bad alignment %zu for the %s cache", align, name);
+
+	cache->name = name;
+	cache->size = size;
+	cache->stride = ALIGN(sizeof(struct kcache_obj) + size, align);
+
+	// objects come right after their kcache_obj
+	hdr = sizeof(struct kcache_obj);
+	cache->offset = ALIGN(sizeof(struct kcache_slab) + hdr, align) - hdr;
+
+	bytes = cache->offset + cache->stride * SLAB_MIN_OBJECTS;
+	cache->pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+	cache->count = (cache->pages * PAGE_SIZE - cache->offset) / cache->stride;
+
+	cache->partial = NULL;
+	cache->full = NULL;
+	cache->empty = NULL;
+	cache->used = 0;
+}
+
+void *kcache_alloc(struct kcache *cache)
+{
+	struct kcache_slab *slab;
+	struct kcache_obj *obj;
+
+	assert(cache->stride != 0, "kcache_alloc: cache not initalized");
+
+	slab = cache->partial;
+	if (slab == NULL) {
+		// reuse the spare slab before asking for more pages
+		slab = cache->empty;
+		cache->empty = NULL;
+		if (slab == NULL)
+			slab = slab_create(cache);
+		if (slab == NULL)
+			return NULL;
+		slab_push(&cache->partial, slab);
+	}
+
+	obj = slab->free;
+	slab->free = obj->next;
+	slab->used++;
+	cache->used++;
+
+	if (slab->used == cache->count) {
+		slab_unlink(&cache->partial, slab);
+		slab_push(&cache->full, slab);
+	}
+
+	return obj + 1;
+}
+
+struct kcache *kcache_owner(const void *ptr)
+{
+	const struct kcache_obj *obj = (const struct kcache_obj *)ptr - 1;
+	if (obj->slab == NULL)
+		return NULL;
+	return obj->slab->cache;
+}
+
+void kcache_free(struct kcache *cache, void *ptr)
+{
+	struct kcache_slab *slab;
+	struct kcache_obj *obj;
+
+	if (ptr == NULL)
+		return;
+
+	obj = (struct kcache_obj *)ptr - 1;
+	slab = obj->slab;
+	assert(slab->cache == cache, "kcache_free: %p is not from the %s cache",
+		   ptr, cache->name);
+
+	if (slab->used == cache->count) {
+		slab_unlink(&cache->full, slab);
+		slab_push(&cache->partial, slab);
+	}
+
+	obj->next = slab->free;
+	slab->free = obj;
+	slab->used--;
+	cache->used--;
+
+	if (slab->used > 0)
+		return;
+
+	// keep one empty slab around, so a process that keeps
+	// forking short lived children does not map and unmap
+	// the same pages over and over
+	slab_unlink(&cache->partial, slab);
+	if (cache->empty == NULL)
+		cache->empty = slab;
+	else
+		kfree_pages(slab);
+}
@@ -1,6 +1,7 @@
 #include <lib.h>
 #include <comus/drivers/pit.h>
 #include <comus/asm.h>
+#include <comus/tick.h>
 
 void kspin_seconds(size_t seconds)
 {
@@ -9,7 +10,46 @@ void kspin_seconds(size_t seconds)
 
 void kspin_milliseconds(size_t milliseconds)
 {
-	uint64_t start = ticks;
-	while ((ticks - start) < milliseconds)
-		int_wait();
+	uint16_t last, now;
+	uint64_t end;
+
+	// the pit stops ticking once the clock takes over
+	if (clock_running()) {
+		end = clock_ns() + milliseconds * NS_PER_MS;
+		while (clock_ns() < end)
+			cpu_relax();
+		return;
+	}
+
+	// poll the counter instead of waiting on ticks, the cpu that
+	// counts ticks may be spinning on the kernel lock we hold
+	last = pit_read_count();
+	while (milliseconds) {
+		now = pit_read_count();
+		// the counter reloaded, one period has passed
+		if (now > last)
+			milliseconds--;
+		last = now;
+		cpu_relax();
+	}
+}
+
+void kspin_lock(struct kspinlock *lock)
+{
+	uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+	while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+}
+
+bool kspin_trylock(struct kspinlock *lock)
+{
+	uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_RELAXED);
+	uint32_t ticket = owner;
+	return __atomic_compare_exchange_n(&lock->next, &ticket, owner + 1, false,
+									   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void kspin_unlock(struct kspinlock *lock)
+{
+	__atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
 }
@@ -10,6 +10,7 @@
 #include <comus/user.h>
 #include <comus/fs.h>
 #include <comus/procs.h>
+#include <comus/fpu.h>
 #include <lib.h>
 
 void kreport(void)
@@ -74,15 +75,24 @@ __attribute__((noreturn)) void main(long magic, volatile void *mboot)
 	// initalize memory
 	memory_init();
 
+	// initalize fpu save areas
+	fpu_init();
+
 	// initalize devices
 	drivers_init();
 
 	// load file systems
 	fs_init();
 
+	// swap to a disk without a file system
+	swap_init();
+
 	// initalize processes
 	pcb_init();
 
+	// start application processors
+	smp_init();
+
 	// report system state
 	kreport();
 
@@ -2,13 +2,14 @@
 #include <comus/asm.h>
 #include <comus/mboot.h>
 #include <comus/efi.h>
-#include <comus/limits.h>
+#include <comus/cpu.h>
 #include <lib.h>
 
 #include "memory.h"
 #include "paging.h"
 #include "virtalloc.h"
 #include "physalloc.h"
+#include "swap.h"
 
 // kernel memory context
 mem_ctx_t kernel_mem_ctx;
@@ -17,9 +18,62 @@ static struct mem_ctx_s _kernel_mem_ctx;
 // kernel page tables
 extern volatile char kernel_pml4[];
 
+#define CR4_PCIDE (1 << 17)
+// keep the tlb entries of the pcid being loaded
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR3_PCID 0xFFFULL
+
+// pcid 0 is the kernel's
+#define N_PCIDS 4096
+
+_Static_assert(N_CPUS <= 32, "mem_ctx_s tlb_stale cannot hold every cpu");
+
+// if every cpu has CR4.PCIDE set
+static bool pcid_enabled = false;
+// pcids are handed out in order, once they run out a new
+// generation starts and every cpu flushes the old ones
+static uint64_t pcid_gen = 1;
+static uint16_t next_pcid = 1;
+
 // user space memory contexts
-static struct mem_ctx_s user_mem_ctx[N_PROCS];
-static struct mem_ctx_s *user_mem_ctx_next = NULL;
+static struct kcache user_mem_ctx;
+
+// every user context, the reclaim clock starts at the head
+static mem_ctx_t ctx_ring = NULL;
+static size_t ctx_ring_len = 0;
+
+static void ring_insert(mem_ctx_t ctx)
+{
+	ctx->cpus = 0;
+	ctx->kmaps = 0;
+	ctx->clock_area = 0;
+	ctx->clock_addr = 0;
+
+	// just behind the hand, so it is looked at last
+	if (ctx_ring == NULL) {
+		ctx->next = ctx;
+		ctx->prev = ctx;
+		ctx_ring = ctx;
+	} else {
+		ctx->next = ctx_ring;
+		ctx->prev = ctx_ring->prev;
+		ctx->prev->next = ctx;
+		ctx_ring->prev = ctx;
+	}
+	ctx_ring_len++;
+}
+
+static void ring_remove(mem_ctx_t ctx)
+{
+	if (ctx_ring == ctx)
+		ctx_ring = ctx->next;
+	if (ctx_ring == ctx)
+		ctx_ring = NULL;
+
+	ctx->prev->next = ctx->next;
+	ctx->next->prev = ctx->prev;
+	ctx_ring_len--;
+}
 
 void *kmapaddr(void *phys, void *virt, size_t len, unsigned int flags)
 {
@@ -31,6 +85,12 @@ void kunmapaddr(const void *virt)
 	mem_unmapaddr(kernel_mem_ctx, virt);
 }
 
+void kunmapuseraddr(mem_ctx_t ctx, const void *virt)
+{
+	mem_unmapaddr(kernel_mem_ctx, virt);
+	ctx->kmaps--;
+}
+
 void *kget_phys(const void *virt)
 {
 	return mem_get_phys(kernel_mem_ctx, virt);
@@ -46,6 +106,12 @@ void *kalloc_pages(size_t count)
 	return mem_alloc_pages(kernel_mem_ctx, count, F_PRESENT | F_WRITEABLE);
 }
 
+void *kalloc_pages_contig(size_t count)
+{
+	return mem_alloc_pages_contig(kernel_mem_ctx, count,
+								  F_PRESENT | F_WRITEABLE);
+}
+
 void kfree_pages(const void *ptr)
 {
 	mem_free_pages(kernel_mem_ctx, ptr);
@@ -53,18 +119,19 @@ void kfree_pages(const void *ptr)
 
 mem_ctx_t mem_ctx_alloc(void)
 {
-	mem_ctx_t ctx = user_mem_ctx_next;
+	mem_ctx_t ctx = kcache_alloc(&user_mem_ctx);
 	if (ctx == NULL)
 		return NULL;
 
-	if ((ctx->pml4 = pgdir_alloc()) == NULL)
+	if ((ctx->pml4 = pgdir_alloc()) == NULL) {
+		kcache_free(&user_mem_ctx, ctx);
 		return NULL;
-	virtaddr_init(&ctx->virtctx);
-
-	user_mem_ctx_next = ctx->prev;
-	if (ctx->prev)
-		ctx->prev->next = NULL;
-	ctx->prev = NULL;
+	}
+	ctx->pcid_gen = 0;
+	ctx->tlb_stale = 0;
+	memset(ctx->areas, 0, sizeof(ctx->areas));
+	virtaddr_init(&ctx->virtctx, USER_SPACE_START, USER_SPACE_END);
+	ring_insert(ctx);
 
 	return ctx;
 }
@@ -76,22 +143,32 @@ mem_ctx_t mem_ctx_clone(const mem_ctx_t old, bool cow)
 	assert(old != NULL, "memory context is null");
 	assert(old->pml4 != NULL, "pgdir is null");
 
-	new = user_mem_ctx_next;
+	new = kcache_alloc(&user_mem_ctx);
 	if (new == NULL)
 		return NULL;
 
-	if ((new->pml4 = pgdir_clone(old->pml4, cow)) == NULL)
+	if ((new->pml4 = pgdir_clone(old->pml4, cow)) == NULL) {
+		kcache_free(&user_mem_ctx, new);
 		return NULL;
+	}
 
 	if (virtaddr_clone(&old->virtctx, &new->virtctx)) {
 		pgdir_free(new->pml4);
+		kcache_free(&user_mem_ctx, new);
 		return NULL;
 	}
-
-	user_mem_ctx_next = new->prev;
-	if (new->prev)
-		new->prev->next = NULL;
-	new->prev = NULL;
+	new->pcid_gen = 0;
+	new->tlb_stale = 0;
+	memcpy(new->areas, old->areas, sizeof(new->areas));
+	ring_insert(new);
+
+	// pages shared with the new context were made read only, so drop
+	// the old context's writeable tlb entries here and on other cpus
+	if (cow) {
+		if ((read_cr3() & ~CR3_PCID) == (uint64_t)old->pml4)
+			write_cr3(read_cr3());
+		mem_ctx_unmapped(old);
+	}
 
 	return new;
 }
@@ -101,16 +178,18 @@ void mem_ctx_free(mem_ctx_t ctx)
 	assert(ctx != NULL, "memory context is null");
 	assert(ctx->pml4 != NULL, "pgdir is null");
 
+	// exec frees the context it is running on, its pcid
+	// is not handed out again until every cpu has flushed it
+	if ((read_cr3() & ~CR3_PCID) == (uint64_t)ctx->pml4)
+		mem_ctx_switch(kernel_mem_ctx);
+	assert(ctx->cpus == 0, "memory context is loaded on another cpu");
+	ring_remove(ctx);
+
 	pgdir_free(ctx->pml4);
 	virtaddr_cleanup(&ctx->virtctx);
+	ctx->pml4 = NULL;
 
-	if (user_mem_ctx_next == NULL) {
-		user_mem_ctx_next = ctx;
-	} else {
-		user_mem_ctx_next->next = ctx;
-		ctx->prev = user_mem_ctx_next;
-		user_mem_ctx_next = ctx;
-	}
+	kcache_free(&user_mem_ctx, ctx);
 }
 
 void mem_ctx_switch(mem_ctx_t ctx)
@@ -118,7 +197,116 @@ void mem_ctx_switch(mem_ctx_t ctx)
 	assert(ctx != NULL, "memory context is null");
 	assert(ctx->pml4 != NULL, "pgdir is null");
 
-	__asm__ volatile("mov %0, %%cr3" ::"r"(ctx->pml4) : "memory");
+	// kernel mappings are shared, so there is nothing to flush
+	if ((read_cr3() & ~CR3_PCID) == (uint64_t)ctx->pml4)
+		return;
+
+	write_cr3(mem_ctx_cr3(ctx));
+}
+
+uint64_t mem_ctx_cr3(mem_ctx_t ctx)
+{
+	struct cpu_local *local;
+	uint64_t cr3;
+
+	assert(ctx != NULL, "memory context is null");
+	assert(ctx->pml4 != NULL, "pgdir is null");
+
+	local = cpu_local();
+
+	// reclaim leaves alone contexts that other cpus have loaded
+	if (local->mem_ctx != ctx) {
+		if (local->mem_ctx != NULL)
+			local->mem_ctx->cpus &= ~(1U << local->id);
+		local->mem_ctx = NULL;
+		if (ctx != kernel_mem_ctx) {
+			ctx->cpus |= 1U << local->id;
+			local->mem_ctx = ctx;
+		}
+	}
+
+	cr3 = (uint64_t)ctx->pml4;
+	if (!pcid_enabled)
+		return cr3;
+
+	// everything the kernel maps is global
+	if (ctx == kernel_mem_ctx)
+		return cr3 | CR3_NOFLUSH;
+
+	if (ctx->pcid_gen != pcid_gen) {
+		if (next_pcid == N_PCIDS) {
+			pcid_gen++;
+			next_pcid = 1;
+		}
+		ctx->pcid = next_pcid++;
+		ctx->pcid_gen = pcid_gen;
+		ctx->tlb_stale = 0;
+	}
+
+	// entries from the last generation may use the same pcids
+	if (local->pcid_gen != pcid_gen) {
+		tlb_flush_all();
+		local->pcid_gen = pcid_gen;
+	}
+
+	cr3 |= ctx->pcid;
+
+	// leaving out the no flush bit drops the stale entries
+	if (ctx->tlb_stale & (1U << local->id)) {
+		ctx->tlb_stale &= ~(1U << local->id);
+		return cr3;
+	}
+
+	return cr3 | CR3_NOFLUSH;
+}
+
+void mem_ctx_unmapped(mem_ctx_t ctx)
+{
+	uint32_t self;
+
+	if (!pcid_enabled || ctx == kernel_mem_ctx)
+		return;
+
+	// invlpg already dropped them here if ctx is loaded
+	self = 1U << cpu_id();
+	if ((read_cr3() & ~CR3_PCID) == (uint64_t)ctx->pml4)
+		ctx->tlb_stale |= ~self;
+	else
+		ctx->tlb_stale = ~0U;
+}
+
+size_t mem_reclaim(size_t count)
+{
+	mem_ctx_t ctx;
+	size_t freed = 0, laps;
+	bool done;
+
+	if (!swap_enabled() || ctx_ring == NULL)
+		return 0;
+
+	// the first lap may only clear accessed bits, every page
+	// is looked at twice by the end of the third
+	laps = ctx_ring_len * 3;
+	while (freed < count && laps > 0) {
+		ctx = ctx_ring;
+		done = true;
+
+		// other cpus may be using the pages, and would keep them in
+		// their tlbs, so only contexts loaded here or nowhere are used
+		if ((ctx->cpus & ~(1U << cpu_id())) == 0 && ctx->kmaps == 0)
+			freed += ctx_reclaim(ctx, count - freed, &done);
+
+		// swap is full
+		if (!done && freed < count)
+			break;
+
+		if (done) {
+			ctx_ring = ctx->next;
+			laps--;
+		}
+	}
+
+	return freed;
 }
 
 volatile void *mem_ctx_pgdir(mem_ctx_t ctx)
@@ -132,6 +320,8 @@ volatile void *mem_ctx_pgdir(mem_ctx_t ctx)
 void memory_init(void)
 {
 	struct memory_map mmap;
+	uintptr_t phys_end;
+
 	if (mboot_get_mmap(&mmap))
 		if (efi_get_mmap(&mmap))
 			panic("failed to load memory map");
@@ -140,9 +330,28 @@ void memory_init(void)
 	kernel_mem_ctx->pml4 = kernel_pml4;
 
 	cli();
+	pcid_enabled = read_cr4() & CR4_PCIDE;
+	uaccess_init();
 	paging_init();
-	virtaddr_init(&kernel_mem_ctx->virtctx);
+	virtaddr_init(&kernel_mem_ctx->virtctx, 0, KERNEL_SPACE_END);
+	// mapped by paging_init
+	virtaddr_take(&kernel_mem_ctx->virtctx, (void *)0,
+				  IDENT_MAP_SIZE / PAGE_SIZE);
+	virtaddr_take(&kernel_mem_ctx->virtctx, (void *)PAGING_WINDOW,
+				  PAGING_WINDOW_SIZE / PAGE_SIZE);
 	physalloc_init(&mmap);
+	virtaddr_cache_init();
+
+	// page tables are edited through the direct map from here on
+	phys_end = 0;
+	for (size_t i = 0; i < mmap.entry_count; i++) {
+		struct memory_segment *seg = &mmap.entries[i];
+		if (seg->type == SEG_TYPE_FREE && seg->addr + seg->len > phys_end)
+			phys_end = seg->addr + seg->len;
+	}
+	virtaddr_take(&kernel_mem_ctx->virtctx, (void *)DIRECT_MAP,
+				  DIRECT_MAP_SIZE / PAGE_SIZE);
+	paging_direct_map(phys_end);
 	sti();
 
 	// identiy map EFI functions
@@ -150,22 +359,13 @@ void memory_init(void)
 		struct memory_segment *seg = &mmap.entries[i];
 		if (seg->type != SEG_TYPE_EFI)
 			continue;
+		// already identity mapped
+		if (seg->addr + seg->len <= IDENT_MAP_SIZE)
+			continue;
 		kmapaddr((void *)seg->addr, (void *)seg->addr, seg->len, F_WRITEABLE);
 	}
 
-	// setup user mem ctx linked list
-	for (size_t i = 0; i < N_PROCS; i++) {
-		struct mem_ctx_s *ctx = &user_mem_ctx[i];
-		ctx->next = NULL;
-		ctx->prev = NULL;
-
-		if (user_mem_ctx_next == NULL) {
-			user_mem_ctx_next = ctx;
-			continue;
-		}
-
-		user_mem_ctx_next->next = ctx;
-		ctx->prev = user_mem_ctx_next;
-		user_mem_ctx_next = ctx;
-	}
+	// user mem ctxs are allocated as processes need them
+	kcache_init(&user_mem_ctx, "mem_ctx", sizeof(struct mem_ctx_s),
+				_Alignof(struct mem_ctx_s));
 }
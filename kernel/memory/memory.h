@@ -2,12 +2,71 @@
 #include <comus/memory.h>
 #include "virtalloc.h"
 
+/// vitural addresses that get zeroed pages the first time they are touched
+struct mem_area {
+	/// first reserved address
+	uintptr_t base;
+	/// address after the last reserved address, 0 if the area is unused
+	uintptr_t limit;
+	/// addresses that can be touched
+	uintptr_t start;
+	uintptr_t end;
+	/// page flags
+	unsigned int flags;
+	/// touching the page below start moves start down
+	bool grows_down;
+};
+
 struct mem_ctx_s {
 	// page tables
 	volatile char *pml4;
 	// virt addr allocator
 	struct virt_ctx virtctx;
-	// linked list
+	// process context id, valid while pcid_gen is current
+	uint16_t pcid;
+	uint64_t pcid_gen;
+	// cpus that may still cache mappings removed from this context
+	uint32_t tlb_stale;
+	// demand paged areas
+	struct mem_area areas[N_MEM_AREAS];
+	// cpus that have this context loaded in cr3
+	uint32_t cpus;
+	// kmapuseraddr mappings, pages are not swapped out while there are any
+	uint32_t kmaps;
+	// area and address the reclaim clock looks at next
+	size_t clock_area;
+	uintptr_t clock_addr;
+	// ring of user contexts the reclaim clock goes around
 	struct mem_ctx_s *next;
 	struct mem_ctx_s *prev;
 };
+
+/**
+ * Note that mappings were removed from a context, so cpus that may have
+ * them cached flush its pcid the next time they switch to it
+ */
+void mem_ctx_unmapped(mem_ctx_t ctx);
+
+/**
+ * Swap out up to count pages of user contexts that have not been used
+ * lately, called when there is no free memory left
+ *
+ * @returns the number of pages freed
+ */
+size_t mem_reclaim(size_t count);
+
+/**
+ * Swap out up to count pages from the demand paged areas of a context,
+ * starting at its clock hand and giving pages that were accessed since it
+ * last went by a second chance
+ *
+ * @param done - set if the hand got to the end of the context's areas
+ * @returns the number of pages freed
+ */
+size_t ctx_reclaim(mem_ctx_t ctx, size_t count, bool *done);
+
+/**
+ * Check if the kernel has to allow itself to touch user pages (SMAP),
+ * called once CR4 is set up
+ */
+void uaccess_init(void);
@@ -1,10 +1,13 @@
 #include <lib.h>
+#include <comus/asm.h>
+#include <comus/cpu.h>
 #include <comus/memory.h>
 
 #include "virtalloc.h"
 #include "physalloc.h"
 #include "paging.h"
 #include "memory.h"
+#include "swap.h"
 
 // PAGE MAP LEVEL 4 ENTRY
 struct pml4e {
@@ -41,7 +44,8 @@ struct pdpte {
 	uint64_t flags : 6;
 	uint64_t : 1; // ignored
 	uint64_t page_size : 1;
-	uint64_t : 4; // ignored
+	uint64_t global : 1; // ignored, unless page_size is set
+	uint64_t : 3; // ignored
 	uint64_t address : 40;
 	uint64_t : 11; // ignored
 	uint64_t execute_disable : 1;
@@ -71,9 +75,11 @@ struct pde {
 	uint64_t flags : 6;
 	uint64_t : 1; // ignored
 	uint64_t page_size : 1;
-	uint64_t : 4; // ignored
+	uint64_t global : 1; // ignored, unless page_size is set
+	uint64_t : 3; // ignored
 	uint64_t address : 40;
-	uint64_t : 11; // ignored
+	uint64_t shm : 1; // ignored, shared memory (F_SHARED)
+	uint64_t : 10; // ignored
 	uint64_t execute_disable : 1;
 } __attribute__((packed, aligned(8)));
 
@@ -99,10 +105,16 @@ struct pd {
 // PAGE TABLE ENTRY
 struct pte {
 	uint64_t flags : 9;
-	uint64_t : 3; // ignored
+	// ignored, read only until written to, or if the page is not
+	// present, it was swapped out to the slot in address
+	uint64_t cow : 1;
+	uint64_t : 2; // ignored
 	uint64_t address : 40;
 	uint64_t : 7; // ignored
-	uint64_t protection_key : 4;
+	// protection key, ignored since CR4.PKE is never set, the first bit
+	// marks shared memory (F_SHARED)
+	uint64_t shm : 1;
+	uint64_t protection_key : 3;
 	uint64_t execute_disable : 1;
 } __attribute__((packed, aligned(8)));
 
@@ -128,7 +140,6 @@ struct pt {
 extern volatile struct pml4 kernel_pml4;
 extern volatile struct pdpt kernel_pdpt_0;
 extern volatile struct pd kernel_pd_0;
-extern volatile struct pt kernel_pd_0_ents[N_IDENT_PTS];
 extern volatile struct pd kernel_pd_1;
 extern volatile struct pt
 	paging_pt; // paging_pt should NEVER be outside of this file, NEVER i say
@@ -137,12 +148,55 @@ extern volatile struct pt
 extern char kernel_start[];
 extern char kernel_end[];
 
+// pml4 entry shared by the kernel and every process
+#define KERNEL_PML4E 0
+
+// paging_pt slots used by map_addr
+#define N_WINDOW_SLOTS 10
+
+#define CR4_PGE 0x80
+
+// a pde with page_size set maps this much
+#define HUGE_PAGE_SIZE 0x200000
+#define HUGE_PAGE_PAGES 512
+
+// page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+
+// pages swapped out at once when memory runs out, so the
+// next few allocations do not have to
+#define RECLAIM_PAGES 32
+
+// bumped whenever a kernel mapping is removed, so cpus that cached
+// it know to flush before they use the kernel's mappings again
+static uint64_t kernel_tlb_gen = 0;
+
+// last cpu to hold the kernel lock, and so to touch the paging window
+static uint32_t window_cpu = 0;
+
+// physical memory below this is mapped at DIRECT_MAP
+static uintptr_t direct_map_end = 0;
+
+// pages zeroed ahead of time by idle cpus, which fill it
+// without the kernel lock
+#define ZERO_POOL_SIZE 256
+static void *zero_pool[ZERO_POOL_SIZE];
+static size_t zero_pool_count = 0;
+static struct kspinlock zero_pool_lock = { 0 };
+
 // invalidate page cache at a vitural address
 static inline void invlpg(volatile const void *vADDR)
 {
 	__asm__ volatile("invlpg (%0)" ::"r"(vADDR) : "memory");
 }
 
+// invpcid type that invalidates every pcid, global pages included
+#define INVPCID_ALL 2
+
+// if invpcid can be used instead of toggling CR4.PGE
+static bool has_invpcid = false;
+
 /* map */
 
 // map a physical address to a virtural address
@@ -154,14 +208,18 @@ static volatile void *map_addr(volatile const void *pADDR, size_t pt_idx)
 
 	assert(pt_idx < 512, "invalid page table entry index");
 
-	vADDR = (char *)(uintptr_t)(0x40000000 + pt_idx * PAGE_SIZE);
+	if ((uintptr_t)pADDR < direct_map_end)
+		return (volatile char *)DIRECT_MAP + (uintptr_t)pADDR;
+
+	vADDR = (char *)(uintptr_t)(PAGING_WINDOW + pt_idx * PAGE_SIZE);
 	vPTE = &paging_pt.entries[pt_idx];
 
 	if ((uint64_t)pADDR >> 12 == vPTE->address)
 		return vADDR;
 
 	vPTE->address = (uint64_t)pADDR >> 12;
-	vPTE->flags = F_PRESENT | F_WRITEABLE;
+	// global, so invlpg drops it from every pcid
+	vPTE->flags = F_PRESENT | F_WRITEABLE | F_GLOBAL;
 	invlpg(vADDR);
 	return vADDR;
 }
@@ -181,6 +239,75 @@ static volatile void *map_addr(volatile const void *pADDR, size_t pt_idx)
 #define PAGE_MAP(pADDR) (volatile void *)map_addr(pADDR, 8)
 #define PAGE_MAPC(pADDR) (volatile const void *)map_addr(pADDR, 9)
 
+/* zeroed pages */
+
+// zero a page with 8 byte stores
+static void page_zero(volatile void *vADDR)
+{
+	void *dst = (void *)vADDR;
+	size_t count = PAGE_SIZE / 8;
+
+	__asm__ volatile("rep stosq"
+					 : "+D"(dst), "+c"(count)
+					 : "a"(0ULL)
+					 : "memory");
+}
+
+// zero a page with non-temporal stores, which skip the cache,
+// as the page may not be used for a while
+static void page_zero_nt(volatile void *vADDR)
+{
+	volatile uint64_t *dst = vADDR;
+
+	for (size_t i = 0; i < PAGE_SIZE / 8; i++)
+		__asm__ volatile("movnti %1, %0" : "=m"(dst[i]) : "r"(0ULL));
+	__asm__ volatile("sfence" ::: "memory");
+}
+
+// take a page from the zeroed pool
+// @returns PHYSICAL ADDRESS, or NULL if it is empty
+static void *zero_pool_take(void)
+{
+	void *pADDR = NULL;
+
+	kspin_lock(&zero_pool_lock);
+	if (zero_pool_count > 0)
+		pADDR = zero_pool[--zero_pool_count];
+	kspin_unlock(&zero_pool_lock);
+
+	return pADDR;
+}
+
+// allocate a zeroed physical page, from the pool if it has any
+// @returns PHYSICAL ADDRESS
+static void *alloc_zeroed_page(void)
+{
+	void *pADDR;
+
+	pADDR = zero_pool_take();
+	if (pADDR != NULL)
+		return pADDR;
+
+	pADDR = alloc_phys_page();
+	if (pADDR != NULL)
+		page_zero(PAGE_MAP(pADDR));
+	return pADDR;
+}
+
+// allocate a physical page that is about to be written over, the pool
+// is only used once the allocator has run out
+// @returns PHYSICAL ADDRESS
+static void *alloc_page(void)
+{
+	void *pADDR;
+
+	pADDR = alloc_phys_page();
+	if (pADDR != NULL)
+		return pADDR;
+
+	return zero_pool_take();
+}
+
 /* locate */
 
 // locate a pdpt for a vitural address
@@ -240,7 +367,8 @@ static volatile struct pt *pt_locate(volatile struct pd *pPD, const void *vADDR)
 	vPD = PD_MAP(pPD);
 	vPDE = &vPD->entries[offset];
 
-	if (vPDE->flags & F_PRESENT) {
+	// a 2M page has no pt
+	if ((vPDE->flags & F_PRESENT) && !vPDE->page_size) {
 		pPT = (volatile struct pt *)((uintptr_t)vPDE->address << 12);
 		return pPT;
 	}
@@ -248,22 +376,89 @@ static volatile struct pt *pt_locate(volatile struct pd *pPD, const void *vADDR)
 	return NULL;
 }
 
+// locate a pde for a vitural address
+// @returns VIRTUAL ADDRESS
+static volatile struct pde *pde_locate(volatile struct pml4 *pPML4,
+									   const void *vADDR)
+{
+	volatile struct pdpt *pPDPT;
+	volatile struct pd *pPD, *vPD;
+	uint64_t offset;
+
+	pPDPT = pdpt_locate(pPML4, vADDR);
+	if (pPDPT == NULL)
+		return NULL;
+
+	pPD = pd_locate(pPDPT, vADDR);
+	if (pPD == NULL)
+		return NULL;
+
+	offset = ((uint64_t)vADDR >> 21) & 0x1ff;
+	vPD = PD_MAP(pPD);
+	return &vPD->entries[offset];
+}
+
+/* huge pages */
+
+static bool pde_huge(volatile const struct pde *vPDE)
+{
+	return vPDE != NULL && (vPDE->flags & F_PRESENT) && vPDE->page_size;
+}
+
+// turn a 2M page into a pt of 4K pages mapping the same memory
+static int pde_split(volatile struct pde *vPDE)
+{
+	volatile struct pt *pPT, *vPT;
+	uint64_t address;
+	unsigned int flags;
+
+	pPT = alloc_zeroed_page();
+	if (pPT == NULL) {
+		ERROR("Could not allocate PT");
+		return 1;
+	}
+
+	address = vPDE->address;
+	flags = F_PRESENT | vPDE->flags | (vPDE->global ? F_GLOBAL : 0);
+
+	vPT = PT_MAP(pPT);
+	for (size_t i = 0; i < 512; i++) {
+		vPT->entries[i].address = address + i;
+		vPT->entries[i].flags = flags;
+		vPT->entries[i].shm = vPDE->shm;
+		vPT->entries[i].execute_disable = vPDE->execute_disable;
+	}
+	// all 512 entries wrap the count back to 0
+
+	vPDE->page_size = 0;
+	vPDE->global = 0;
+	vPDE->shm = 0;
+	vPDE->address = (uintptr_t)pPT >> 12;
+
+	return 0;
+}
+
+/* swapped pages */
+
+static bool pte_swapped(volatile const struct pte *vPTE)
+{
+	return vPTE != NULL && !(vPTE->flags & F_PRESENT) && vPTE->cow;
+}
+
 /* alloc */
 
 // allocate a pml4
 // @returns PHYSICAL ADDRESS
 static volatile struct pml4 *pml4_alloc(void)
 {
-	volatile struct pml4 *pPML4, *vPML4;
+	volatile struct pml4 *pPML4;
 
-	pPML4 = alloc_phys_page();
+	pPML4 = alloc_zeroed_page();
 	if (pPML4 == NULL) {
 		ERROR("Could not allocate PML4");
 		return NULL;
 	}
 
-	vPML4 = PML4_MAP(pPML4);
-	memsetv(vPML4, 0, sizeof(struct pml4));
 	return pPML4;
 }
 
@@ -274,7 +469,7 @@ static volatile struct pdpt *pdpt_alloc(volatile struct pml4 *pPML4,
 {
 	volatile struct pml4 *vPML4;
 	volatile struct pml4e *vPML4E;
-	volatile struct pdpt *pPDPT, *vPDPT;
+	volatile struct pdpt *pPDPT;
 	uint64_t offset;
 
 	offset = (uint64_t)vADDR >> 39;
@@ -287,14 +482,12 @@ static volatile struct pdpt *pdpt_alloc(volatile struct pml4 *pPML4,
 		return pPDPT;
 	}
 
-	pPDPT = alloc_phys_page();
+	pPDPT = alloc_zeroed_page();
 	if (pPDPT == NULL) {
 		ERROR("Could not allocate PDPT");
 		return NULL;
 	}
 
-	vPDPT = PDPT_MAP(pPDPT);
-	memsetv(vPDPT, 0, sizeof(struct pdpt));
 	vPML4E->address = (uintptr_t)pPDPT >> 12;
 	vPML4E->flags = F_PRESENT | flags;
 	vPML4->count++;
@@ -309,7 +502,7 @@ static volatile struct pd *pd_alloc(volatile struct pdpt *pPDPT, void *vADDR,
 {
 	volatile struct pdpt *vPDPT;
 	volatile struct pdpte *vPDPTE;
-	volatile struct pd *pPD, *vPD;
+	volatile struct pd *pPD;
 	uint64_t offset;
 
 	offset = ((uint64_t)vADDR >> 30) & 0x1ff;
@@ -322,14 +515,12 @@ static volatile struct pd *pd_alloc(volatile struct pdpt *pPDPT, void *vADDR,
 		return pPD;
 	}
 
-	pPD = alloc_phys_page();
+	pPD = alloc_zeroed_page();
 	if (pPD == NULL) {
 		ERROR("Could not allocate PD");
 		return NULL;
 	}
 
-	vPD = PD_MAP(pPD);
-	memsetv(vPD, 0, sizeof(struct pd));
 	vPDPTE->address = (uintptr_t)pPD >> 12;
 	vPDPTE->flags = F_PRESENT | flags;
 	vPDPT->count++;
@@ -344,27 +535,29 @@ static volatile struct pt *pt_alloc(volatile struct pd *pPD, void *vADDR,
 {
 	volatile struct pd *vPD;
 	volatile struct pde *vPDE;
-	volatile struct pt *pPT, *vPT;
+	volatile struct pt *pPT;
 	uint64_t offset;
 
 	offset = ((uint64_t)vADDR >> 21) & 0x1ff;
 	vPD = PD_MAP(pPD);
 	vPDE = &vPD->entries[offset];
 
+	// 4K pages in a 2M page need it split first
+	if (pde_huge(vPDE) && pde_split(vPDE))
+		return NULL;
+
 	pPT = pt_locate(pPD, vADDR);
 	if (pPT) {
 		vPDE->flags |= flags;
 		return pPT;
 	}
 
-	pPT = alloc_phys_page();
+	pPT = alloc_zeroed_page();
 	if (pPT == NULL) {
 		ERROR("Could not allocate PT");
 		return NULL;
 	}
 
-	vPT = PT_MAP(pPT);
-	memsetv(vPT, 0, sizeof(struct pt));
 	vPDE->address = (uintptr_t)pPT >> 12;
 	vPDE->flags = F_PRESENT | flags;
 	vPD->count++;
@@ -382,14 +575,17 @@ static void pt_free(volatile struct pt *pPT, bool force)
 	vPT = PT_MAP(pPT);
 	count = (vPT->count_high << 2) | vPT->count_low;
 
-	if (!count)
-		goto free;
-
+	// a full pt has a count of 0, so check every entry
 	for (uint64_t i = 0; i < 512; i++) {
 		volatile struct pte *vPTE;
 		void *pADDR;
 
 		vPTE = &vPT->entries[i];
+		if (pte_swapped(vPTE)) {
+			swap_free(vPTE->address);
+			count--;
+			continue;
+		}
 		if (!(vPTE->flags & F_PRESENT))
 			continue;
 
@@ -404,10 +600,28 @@ static void pt_free(volatile struct pt *pPT, bool force)
 		return;
 	}
 
-free:
 	free_phys_page((void *)(uintptr_t)pPT);
 }
 
+// free the pages of a 2M page, any of which may still be mapped by another
+// context through shared memory
+static void huge_free(void *pADDR)
+{
+	size_t i;
+
+	for (i = 0; i < HUGE_PAGE_PAGES; i++)
+		if (phys_page_shared((char *)pADDR + i * PAGE_SIZE))
+			break;
+
+	if (i == HUGE_PAGE_PAGES) {
+		free_phys_pages(pADDR, HUGE_PAGE_PAGES);
+		return;
+	}
+
+	for (i = 0; i < HUGE_PAGE_PAGES; i++)
+		free_phys_page((char *)pADDR + i * PAGE_SIZE);
+}
+
 static void pd_free(volatile struct pd *pPD, bool force)
 {
 	volatile struct pd *vPD;
@@ -427,6 +641,12 @@ static void pd_free(volatile struct pd *pPD, bool force)
 		if (!(vPDE->flags & F_PRESENT))
 			continue;
 
+		if (vPDE->page_size) {
+			huge_free((void *)((uintptr_t)vPDE->address << 12));
+			count--;
+			continue;
+		}
+
 		pPT = (volatile struct pt *)((uintptr_t)vPDE->address << 12);
 		pt_free(pPT, force);
 		count--;
@@ -493,6 +713,12 @@ static void pml4_free(volatile struct pml4 *pPML4, bool force)
 		if (!(vPML4E->flags & F_PRESENT))
 			continue;
 
+		// the kernel's tables are not ours to free
+		if (i == KERNEL_PML4E) {
+			count--;
+			continue;
+		}
+
 		pPDPT = (volatile struct pdpt *)((uintptr_t)vPML4E->address << 12);
 		pdpt_free(pPDPT, force);
 		count--;
@@ -514,14 +740,15 @@ volatile void *page_clone(volatile void *old_pADDR, bool cow)
 	volatile const void *old_vADDR;
 	volatile void *new_pADDR, *new_vADDR;
 
-	// TODO: cow
-	(void)cow;
-
 	// dont reallocate kernel memeory!!
 	if ((volatile char *)old_pADDR <= kernel_end)
 		return old_pADDR;
 
-	new_pADDR = alloc_phys_page();
+	// both mappings now point at the page until one writes to it
+	if (cow && phys_page_share((void *)old_pADDR))
+		return old_pADDR;
+
+	new_pADDR = alloc_page();
 	if (new_pADDR == NULL)
 		return NULL;
 
@@ -531,24 +758,23 @@ volatile void *page_clone(volatile void *old_pADDR, bool cow)
 	return new_pADDR;
 }
 
-volatile struct pt *pt_clone(volatile const struct pt *old_pPT, bool cow)
+volatile struct pt *pt_clone(volatile struct pt *old_pPT, bool cow)
 {
-	volatile const struct pt *old_vPT;
+	volatile struct pt *old_vPT;
 	volatile struct pt *new_pPT, *new_vPT;
 
-	new_pPT = alloc_phys_page();
+	new_pPT = alloc_zeroed_page();
 	if (new_pPT == NULL)
 		return NULL;
 
-	old_vPT = PT_MAPC(old_pPT);
+	old_vPT = (volatile struct pt *)PT_MAPC(old_pPT);
 	new_vPT = PT_MAP(new_pPT);
-	memsetv(new_vPT, 0, PAGE_SIZE);
 
 	new_vPT->count_high = old_vPT->count_high;
 	new_vPT->count_low = old_vPT->count_low;
 
 	for (size_t i = 0; i < 512; i++) {
-		volatile const struct pte *old_vPTE;
+		volatile struct pte *old_vPTE;
 		volatile struct pte *new_vPTE;
 		volatile void *old_pADDR, *new_pADDR;
 
@@ -557,18 +783,41 @@ volatile struct pt *pt_clone(volatile const struct pt *old_pPT, bool cow)
 
 		new_vPTE->execute_disable = old_vPTE->execute_disable;
 		new_vPTE->flags = old_vPTE->flags;
+
+		// both contexts read their own copy back in
+		if (pte_swapped(old_vPTE)) {
+			if (swap_dup(old_vPTE->address))
+				goto fail;
+			new_vPTE->address = old_vPTE->address;
+			new_vPTE->cow = 1;
+			continue;
+		}
 		if (!(old_vPTE->flags & F_PRESENT))
 			continue;
 
 		new_vPTE->execute_disable = old_vPTE->execute_disable;
 		new_vPTE->flags = old_vPTE->flags;
+		new_vPTE->cow = old_vPTE->cow;
+		new_vPTE->shm = old_vPTE->shm;
 
+		// shared memory stays shared, and writeable, in both contexts
 		old_pADDR = (volatile void *)((uintptr_t)old_vPTE->address << 12);
-		new_pADDR = page_clone(old_pADDR, cow);
+		new_pADDR = page_clone(old_pADDR, cow || old_vPTE->shm);
 		if (new_pADDR == NULL)
 			goto fail;
 
 		new_vPTE->address = (uint64_t)new_pADDR >> 12;
+		if (old_vPTE->shm)
+			continue;
+
+		// shared, the first write from either side copies it
+		if (new_pADDR == old_pADDR && (old_vPTE->flags & F_WRITEABLE) &&
+			phys_page_shared((void *)old_pADDR)) {
+			old_vPTE->flags &= ~F_WRITEABLE;
+			old_vPTE->cow = 1;
+			new_vPTE->flags &= ~F_WRITEABLE;
+			new_vPTE->cow = 1;
+		}
 	}
 
 	return new_pPT;
@@ -583,23 +832,22 @@ volatile struct pd *pd_clone(volatile const struct pd *old_pPD, bool cow)
 	volatile const struct pd *old_vPD;
 	volatile struct pd *new_pPD, *new_vPD;
 
-	new_pPD = alloc_phys_page();
+	new_pPD = alloc_zeroed_page();
 	if (new_pPD == NULL)
 		return NULL;
 
 	old_vPD = PD_MAPC(old_pPD);
 	new_vPD = PD_MAP(new_pPD);
-	memsetv(new_vPD, 0, PAGE_SIZE);
 
 	new_vPD->count = old_vPD->count;
 
 	for (size_t i = 0; i < 512; i++) {
-		volatile const struct pde *old_vPDE;
+		volatile struct pde *old_vPDE;
 		volatile struct pde *new_vPDE;
-		volatile const struct pt *old_pPT;
+		volatile struct pt *old_pPT;
 		volatile struct pt *new_pPT;
 
-		old_vPDE = &old_vPD->entries[i];
+		old_vPDE = (volatile struct pde *)&old_vPD->entries[i];
 		new_vPDE = &new_vPD->entries[i];
 
 		new_vPDE->execute_disable = old_vPDE->execute_disable;
@@ -607,8 +855,14 @@ volatile struct pd *pd_clone(volatile const struct pd *old_pPD, bool cow)
 		if (!(old_vPDE->flags & F_PRESENT))
 			continue;
 
-		old_pPT =
-			(volatile const struct pt *)((uintptr_t)old_vPDE->address << 12);
+		// pages are shared one at a time, so 2M pages are split
+		if (old_vPDE->page_size) {
+			if (pde_split(old_vPDE))
+				goto fail;
+			old_vPD = PD_MAPC(old_pPD);
+		}
+
+		old_pPT = (volatile struct pt *)((uintptr_t)old_vPDE->address << 12);
 		new_pPT = pt_clone(old_pPT, cow);
 		if (new_pPT == NULL)
 			goto fail;
@@ -629,13 +883,12 @@ volatile struct pdpt *pdpt_clone(volatile const struct pdpt *old_pPDPT,
 	volatile const struct pdpt *old_vPDPT;
 	volatile struct pdpt *new_pPDPT, *new_vPDPT;
 
-	new_pPDPT = alloc_phys_page();
+	new_pPDPT = alloc_zeroed_page();
 	if (new_pPDPT == NULL)
 		return NULL;
 
 	old_vPDPT = PDPT_MAPC(old_pPDPT);
 	new_vPDPT = PDPT_MAP(new_pPDPT);
-	memsetv(new_vPDPT, 0, PAGE_SIZE);
 
 	new_vPDPT->count = old_vPDPT->count;
 
@@ -698,6 +951,12 @@ volatile struct pml4 *pml4_clone(volatile const struct pml4 *old_pPML4,
 		if (!(old_vPML4E->flags & F_PRESENT))
 			continue;
 
+		// every address space shares the kernel's tables
+		if (i == KERNEL_PML4E) {
+			new_vPML4E->address = old_vPML4E->address;
+			continue;
+		}
+
 		old_pPDPT =
 			(volatile const struct pdpt *)((uintptr_t)old_vPML4E->address
 										   << 12);
@@ -717,15 +976,14 @@ fail:
 
 /* page specific */
 
-// locate a pte for a vitural address
+// locate the pte for a vitural address, mapped or not
 // @returns VIRTUAL ADDRESS
-static volatile struct pte *page_locate(volatile struct pml4 *pPML4,
-										const void *vADDR)
+static volatile struct pte *pte_locate(volatile struct pml4 *pPML4,
+									   const void *vADDR)
 {
 	volatile struct pdpt *pPDPT;
 	volatile struct pd *pPD;
 	volatile struct pt *pPT, *vPT;
-	volatile struct pte *vPTE;
 	uint64_t offset;
 
 	pPDPT = pdpt_locate(pPML4, vADDR);
@@ -742,162 +1000,786 @@ static volatile struct pte *page_locate(volatile struct pml4 *pPML4,
 
 	offset = ((uint64_t)vADDR >> 12) & 0x1ff;
 	vPT = PT_MAP(pPT);
-	vPTE = &vPT->entries[offset];
-
-	if (vPTE->flags & F_PRESENT)
-		return vPTE;
-
-	return NULL;
+	return &vPT->entries[offset];
 }
 
-// allocate a pte for a vitural address
+// locate a mapped pte for a vitural address
 // @returns VIRTUAL ADDRESS
-static volatile struct pte *page_alloc(volatile struct pml4 *pPML4, void *vADDR,
-									   unsigned int flags)
+static volatile struct pte *page_locate(volatile struct pml4 *pPML4,
+										const void *vADDR)
 {
-	volatile struct pdpt *pPDPT;
-	volatile struct pd *pPD;
-	volatile struct pt *pPT, *vPT;
 	volatile struct pte *vPTE;
-	uint64_t offset, count;
 
-	pPDPT = pdpt_alloc(pPML4, vADDR, flags);
-	if (pPDPT == NULL)
-		return NULL;
+	vPTE = pte_locate(pPML4, vADDR);
+	if (vPTE != NULL && (vPTE->flags & F_PRESENT))
+		return vPTE;
 
-	pPD = pd_alloc(pPDPT, vADDR, flags);
-	if (pPD == NULL)
-		return NULL;
+	return NULL;
+}
 
-	pPT = pt_alloc(pPD, vADDR, flags);
-	if (pPT == NULL)
-		return NULL;
+// give a copy on write page its own copy, so it can be written to
+static int page_unshare(volatile struct pte *vPTE)
+{
+	volatile void *old_pADDR, *new_pADDR;
 
-	offset = ((uint64_t)vADDR >> 12) & 0x1ff;
-	vPT = PT_MAP(pPT);
-	vPTE = &vPT->entries[offset];
+	old_pADDR = (volatile void *)((uintptr_t)vPTE->address << 12);
 
-	memsetv(vPTE, 0, sizeof(struct pte));
-	count = (vPT->count_high << 2) | vPT->count_low;
-	count++;
-	vPT->count_low = count & 0x3;
-	vPT->count_high = (count >> 2) & 0x7f;
+	// the last mapping can just keep the page
+	if (phys_page_shared((void *)old_pADDR)) {
+		new_pADDR = alloc_page();
+		if (new_pADDR == NULL)
+			return 1;
+		memcpyv(PAGE_MAP(new_pADDR), PAGE_MAPC(old_pADDR), PAGE_SIZE);
+		vPTE->address = (uint64_t)new_pADDR >> 12;
+		free_phys_page((void *)old_pADDR);
+	}
 
-	return vPTE;
+	vPTE->flags |= F_WRITEABLE;
+	vPTE->cow = 0;
+	return 0;
 }
 
-// free a pte (page) for a vitural address
-static void page_free(volatile struct pml4 *pPML4, const void *vADDR,
-					  bool deallocate)
+// physical address of the page holding a vitural address,
+// which may be part of a 2M page
+// @returns PHYSICAL ADDRESS
+static void *page_phys(volatile struct pml4 *pPML4, const void *vADDR)
 {
+	volatile struct pde *vPDE;
 	volatile struct pte *vPTE;
-	void *pADDR;
+	uintptr_t offset;
+
+	vPDE = pde_locate(pPML4, vADDR);
+	if (pde_huge(vPDE)) {
+		offset = (uintptr_t)vADDR & (HUGE_PAGE_SIZE - PAGE_SIZE);
+		return (void *)(((uintptr_t)vPDE->address << 12) + offset);
+	}
 
 	vPTE = page_locate(pPML4, vADDR);
 	if (vPTE == NULL)
-		return;
-
-	vPTE->flags = 0;
-	vPTE->address = 0;
+		return NULL;
 
-	if (deallocate) {
-		pADDR = (void *)((uintptr_t)vPTE->address << 12);
-		free_phys_page(pADDR);
-	}
+	return (void *)((uintptr_t)vPTE->address << 12);
 }
 
-/* map & unmap pages */
-
-static void unmap_pages(volatile struct pml4 *pPML4, const void *vADDR,
-						long page_count, bool deallocate)
+// add to the number of entries used in a pt
+static void pt_count_add(volatile struct pt *vPT, long n)
 {
-	for (long i = 0; i < page_count; i++) {
-		page_free(pPML4, vADDR, deallocate);
-		vADDR = (char *)vADDR + PAGE_SIZE;
-	}
+	uint64_t count;
+
+	count = (vPT->count_high << 2) | vPT->count_low;
+	count += n;
+	vPT->count_low = count & 0x3;
+	vPT->count_high = (count >> 2) & 0x7f;
 }
 
-static int map_pages(volatile struct pml4 *pPML4, void *vADDR, void *pADDR,
-					 unsigned int flags, long page_count)
-{
-	volatile struct pte *vPTE;
-	for (long i = 0; i < page_count; i++) {
-		vPTE = page_alloc(pPML4, vADDR, flags);
-		if (vPTE == NULL)
-			goto fail;
-		vPTE->address = (uint64_t)pADDR >> 12;
-		vPTE->flags = F_PRESENT | flags;
+/* range walks */
 
-		pADDR = (char *)pADDR + PAGE_SIZE;
-		vADDR = (char *)vADDR + PAGE_SIZE;
-	}
-	return 0;
+// a walk over the page tables of a range of vitural addresses, which
+// finds each table once instead of walking down from the pml4 per page
+struct page_walk {
+	/// page tables being walked
+	volatile struct pml4 *pPML4;
+	/// allocate missing tables (with flags), or skip unmapped addresses
+	bool alloc;
+	unsigned int flags;
+	/// called for each aligned 2M region of the range first, if not NULL
+	/// @returns 0 if it was handled, -1 to use 4K pages, 1 on err
+	int (*huge)(struct page_walk *walk, volatile struct pd *vPD,
+				volatile struct pde *vPDE, char *vADDR);
+	/// called for each run of entries in a single pt
+	/// @returns 0 on success, 1 on err
+	int (*pages)(struct page_walk *walk, volatile struct pt *vPT,
+				 size_t first, size_t count, char *vADDR);
+	/// state for the callbacks
+	char *pADDR;
+	unsigned int map_flags;
+	bool shm;
+	bool deallocate;
+};
 
-fail:
-	unmap_pages(pPML4, vADDR, page_count, true);
-	return 1;
-}
+// the next address past vADDR aligned to 1 << shift, no further than end
+static char *walk_next(char *vADDR, char *end, int shift)
+{
+	uintptr_t next;
 
-/* other fns */
+	next = ((uintptr_t)vADDR | ((1ULL << shift) - 1)) + 1;
+	return next < (uintptr_t)end ? (char *)next : end;
+}
 
-void paging_init(void)
+// @returns 0 on success, 1 on err
+static int page_walk(struct page_walk *walk, char *vADDR, long page_count)
 {
-	// map pdpt
-	kernel_pml4.entries[0].flags = F_PRESENT | F_WRITEABLE;
-	kernel_pml4.entries[0].address = (uint64_t)(kernel_pdpt_0.entries) >> 12;
+	volatile struct pdpt *pPDPT = NULL;
+	volatile struct pd *pPD = NULL, *vPD;
+	volatile struct pde *vPDE;
+	volatile struct pt *pPT;
+	uintptr_t pml4_idx = UINTPTR_MAX, pdpt_idx = UINTPTR_MAX;
+	char *end, *next;
+	size_t first;
+	int ret;
+
+	end = vADDR + page_count * PAGE_SIZE;
+	for (; vADDR < end; vADDR = next) {
+		// each pdpt and pd is found once per range
+		if ((uintptr_t)vADDR >> 39 != pml4_idx) {
+			pml4_idx = (uintptr_t)vADDR >> 39;
+			pdpt_idx = UINTPTR_MAX;
+			if (walk->alloc)
+				pPDPT = pdpt_alloc(walk->pPML4, vADDR, walk->flags);
+			else
+				pPDPT = pdpt_locate(walk->pPML4, vADDR);
+		}
+		if (pPDPT == NULL) {
+			if (walk->alloc)
+				return 1;
+			next = walk_next(vADDR, end, 39);
+			continue;
+		}
 
-	// map pd0 & pd1
-	kernel_pdpt_0.entries[0].flags = F_PRESENT | F_WRITEABLE;
-	kernel_pdpt_0.entries[0].address = (uint64_t)(kernel_pd_0.entries) >> 12;
-	kernel_pdpt_0.entries[1].flags = F_PRESENT | F_WRITEABLE;
-	kernel_pdpt_0.entries[1].address = (uint64_t)(kernel_pd_1.entries) >> 12;
+		if ((uintptr_t)vADDR >> 30 != pdpt_idx) {
+			pdpt_idx = (uintptr_t)vADDR >> 30;
+			if (walk->alloc)
+				pPD = pd_alloc(pPDPT, vADDR, walk->flags);
+			else
+				pPD = pd_locate(pPDPT, vADDR);
+		}
+		if (pPD == NULL) {
+			if (walk->alloc)
+				return 1;
+			next = walk_next(vADDR, end, 30);
+			continue;
+		}
 
-	// map pd0 entires (length N_IDENT_PTS)
-	for (int i = 0; i < N_IDENT_PTS; i++) {
-		kernel_pd_0.entries[i].flags = F_PRESENT | F_WRITEABLE;
-		kernel_pd_0.entries[i].address =
-			(uint64_t)(kernel_pd_0_ents[i].entries) >> 12;
-		for (size_t j = 0; j < 512; j++) {
-			kernel_pd_0_ents[i].entries[j].flags = F_PRESENT | F_WRITEABLE;
-			kernel_pd_0_ents[i].entries[j].address =
-				((i * 512 + j) * PAGE_SIZE) >> 12;
+		next = walk_next(vADDR, end, 21);
+		vPD = PD_MAP(pPD);
+		vPDE = &vPD->entries[((uintptr_t)vADDR >> 21) & 0x1ff];
+
+		if (walk->huge != NULL && next - vADDR == HUGE_PAGE_SIZE) {
+			ret = walk->huge(walk, vPD, vPDE, vADDR);
+			if (ret > 0)
+				return 1;
+			if (ret == 0)
+				continue;
 		}
-	}
 
-	// map paging_pt
-	kernel_pd_1.entries[0].flags = F_PRESENT | F_WRITEABLE;
-	kernel_pd_1.entries[0].address = (uint64_t)(paging_pt.entries) >> 12;
+		// only part of a 2M page is in the range
+		if (pde_huge(vPDE) && pde_split(vPDE))
+			return 1;
+
+		if (walk->alloc)
+			pPT = pt_alloc(pPD, vADDR, walk->flags);
+		else
+			pPT = pt_locate(pPD, vADDR);
+		if (pPT == NULL) {
+			if (walk->alloc)
+				return 1;
+			continue;
+		}
 
-	memsetv(paging_pt.entries, 0, PAGE_SIZE);
+		first = ((uintptr_t)vADDR >> 12) & 0x1ff;
+		if (walk->pages(walk, PT_MAP(pPT), first,
+						(next - vADDR) / PAGE_SIZE, vADDR))
+			return 1;
+	}
 
-	// make sure we are using THESE pagetables
-	// EFI doesnt on boot
-	__asm__ volatile("mov %0, %%cr3" ::"r"(kernel_pml4.entries) : "memory");
+	return 0;
 }
 
-volatile void *pgdir_alloc(void)
+// map a 2M page if the physical address lines up and nothing is there
+static int map_huge(struct page_walk *walk, volatile struct pd *vPD,
+					volatile struct pde *vPDE, char *vADDR)
 {
-	volatile struct pml4 *pPML4;
+	(void)vADDR;
 
-	pPML4 = pml4_alloc();
-	if (pPML4 == NULL)
-		return NULL;
+	if ((uintptr_t)walk->pADDR % HUGE_PAGE_SIZE || (vPDE->flags & F_PRESENT))
+		return -1;
 
-	if (map_pages(pPML4, kernel_start, kernel_start, F_PRESENT | F_WRITEABLE,
-				  (kernel_end - kernel_start) / PAGE_SIZE)) {
-		pml4_free(pPML4, false);
-		return NULL;
-	}
+	vPDE->address = (uint64_t)walk->pADDR >> 12;
+	vPDE->page_size = 1;
+	vPDE->global = (walk->map_flags & F_GLOBAL) != 0;
+	vPDE->shm = walk->shm;
+	vPDE->execute_disable = 0;
+	vPDE->flags = F_PRESENT | walk->map_flags;
+	vPD->count++;
 
-	return pPML4;
+	walk->pADDR += HUGE_PAGE_SIZE;
+	return 0;
 }
 
-volatile void *pgdir_clone(volatile const void *old_pgdir, bool cow)
+static int map_run(struct page_walk *walk, volatile struct pt *vPT,
+				   size_t first, size_t count, char *vADDR)
 {
-	return pml4_clone((volatile const struct pml4 *)old_pgdir, cow);
+	volatile struct pte *vPTE;
+	long added = 0;
+
+	(void)vADDR;
+
+	for (size_t i = first; i < first + count; i++) {
+		vPTE = &vPT->entries[i];
+		if (pte_swapped(vPTE))
+			swap_free(vPTE->address);
+		else if (!(vPTE->flags & F_PRESENT))
+			added++;
+		vPTE->address = (uint64_t)walk->pADDR >> 12;
+		vPTE->cow = 0;
+		vPTE->shm = walk->shm;
+		vPTE->protection_key = 0;
+		vPTE->execute_disable = 0;
+		vPTE->flags = F_PRESENT | walk->map_flags;
+		walk->pADDR += PAGE_SIZE;
+	}
+
+	pt_count_add(vPT, added);
+	return 0;
 }
 
-void pgdir_free(volatile void *addr)
+// unmap a whole 2M page
+static int unmap_huge(struct page_walk *walk, volatile struct pd *vPD,
+					  volatile struct pde *vPDE, char *vADDR)
+{
+	void *pADDR;
+
+	if (!pde_huge(vPDE))
+		return -1;
+
+	pADDR = (void *)((uintptr_t)vPDE->address << 12);
+	vPDE->flags = 0;
+	vPDE->page_size = 0;
+	vPDE->global = 0;
+	vPDE->shm = 0;
+	vPDE->address = 0;
+	vPD->count--;
+	invlpg(vADDR);
+
+	if (walk->deallocate)
+		huge_free(pADDR);
+	return 0;
+}
+
+static int unmap_run(struct page_walk *walk, volatile struct pt *vPT,
+					 size_t first, size_t count, char *vADDR)
+{
+	volatile struct pte *vPTE;
+	long removed = 0;
+	void *pADDR;
+
+	for (size_t i = first; i < first + count; i++) {
+		vPTE = &vPT->entries[i];
+
+		// the slot belongs to the mapping, whoever owns the pages
+		if (pte_swapped(vPTE)) {
+			swap_free(vPTE->address);
+			vPTE->flags = 0;
+			vPTE->cow = 0;
+			vPTE->address = 0;
+			removed++;
+			continue;
+		}
+		if (!(vPTE->flags & F_PRESENT))
+			continue;
+
+		pADDR = (void *)((uintptr_t)vPTE->address << 12);
+		vPTE->flags = 0;
+		vPTE->cow = 0;
+		vPTE->shm = 0;
+		vPTE->address = 0;
+		invlpg(vADDR + (i - first) * PAGE_SIZE);
+		removed++;
+
+		if (walk->deallocate)
+			free_phys_page(pADDR);
+	}
+
+	pt_count_add(vPT, -removed);
+	return 0;
+}
+
+/* map & unmap pages */
+
+static void unmap_pages(volatile struct pml4 *pPML4, const void *vADDR,
+						long page_count, bool deallocate)
+{
+	struct page_walk walk = {
+		.pPML4 = pPML4,
+		.alloc = false,
+		.huge = unmap_huge,
+		.pages = unmap_run,
+		.deallocate = deallocate,
+	};
+
+	// other cpus may still cache kernel mappings, they flush
+	// them the next time they take the kernel lock
+	if (pPML4 == &kernel_pml4 && page_count > 0)
+		kernel_tlb_gen++;
+
+	if (page_walk(&walk, (char *)vADDR, page_count))
+		panic("cannot split 2M page to unmap %p", vADDR);
+}
+
+static int map_pages(volatile struct pml4 *pPML4, void *vADDR, void *pADDR,
+					 unsigned int flags, long page_count)
+{
+	struct page_walk walk = {
+		.pPML4 = pPML4,
+		.alloc = true,
+		.huge = map_huge,
+		.pages = map_run,
+		.pADDR = pADDR,
+		.shm = (flags & F_SHARED) != 0,
+	};
+
+	flags &= ~F_SHARED;
+
+	// kernel mappings are the same in every address space,
+	// so they can stay cached across cr3 loads
+	if (pPML4 == &kernel_pml4)
+		flags |= F_GLOBAL;
+	walk.flags = flags & ~F_GLOBAL;
+	walk.map_flags = flags;
+
+	if (page_walk(&walk, vADDR, page_count)) {
+		// the caller still owns the physical pages
+		unmap_pages(pPML4, vADDR,
+					(walk.pADDR - (char *)pADDR) / PAGE_SIZE, false);
+		return 1;
+	}
+
+	return 0;
+}
+
+// find a free vitural address for pages, lined up with phys on 2M
+// boundaries when there are enough pages for map_pages to use 2M pages
+static void *virt_alloc(mem_ctx_t ctx, long pages, uintptr_t phys)
+{
+	uintptr_t virt;
+
+	if (pages < HUGE_PAGE_PAGES)
+		return virtaddr_alloc(&ctx->virtctx, pages);
+
+	virt = (uintptr_t)virtaddr_alloc(&ctx->virtctx,
+									 pages + HUGE_PAGE_PAGES - 1);
+	if (virt == 0)
+		return NULL;
+
+	return (void *)(virt + (phys - virt) % HUGE_PAGE_SIZE);
+}
+
+/* demand paging */
+
+// allocate a physical page, swapping pages out first if there are none
+// @returns PHYSICAL ADDRESS
+static void *alloc_reclaim(bool zero)
+{
+	void *pADDR;
+
+	pADDR = zero ? alloc_zeroed_page() : alloc_page();
+	if (pADDR != NULL || mem_reclaim(RECLAIM_PAGES) == 0)
+		return pADDR;
+
+	return zero ? alloc_zeroed_page() : alloc_page();
+}
+
+// the area holding an address, touching the guard page
+// below an area that grows down makes it one page bigger
+static struct mem_area *area_find(mem_ctx_t ctx, uintptr_t addr)
+{
+	for (size_t i = 0; i < N_MEM_AREAS; i++) {
+		struct mem_area *area = &ctx->areas[i];
+
+		if (area->limit == 0)
+			continue;
+
+		if (addr >= area->start && addr < area->end)
+			return area;
+
+		if (area->grows_down && area->start > area->base &&
+			addr < area->start && addr >= area->start - PAGE_SIZE) {
+			area->start -= PAGE_SIZE;
+			return area;
+		}
+	}
+
+	return NULL;
+}
+
+// replace a pt whose pages fill the whole 2M region around an address
+// in an area with a single 2M page
+static void area_promote(mem_ctx_t ctx, struct mem_area *area, uintptr_t addr)
+{
+	volatile struct pml4 *pPML4;
+	volatile struct pde *vPDE;
+	volatile struct pt *pPT, *vPT;
+	volatile struct pte *vPTE;
+	uint64_t first, flags;
+	uintptr_t base, pADDR;
+	bool contiguous;
+
+	pPML4 = (volatile struct pml4 *)ctx->pml4;
+	base = addr & ~(HUGE_PAGE_SIZE - 1);
+	if (base < area->start || base + HUGE_PAGE_SIZE > area->end)
+		return;
+
+	vPDE = pde_locate(pPML4, (void *)base);
+	if (vPDE == NULL || !(vPDE->flags & F_PRESENT) || vPDE->page_size)
+		return;
+
+	pPT = (volatile struct pt *)((uintptr_t)vPDE->address << 12);
+	vPT = PT_MAP(pPT);
+
+	// every page must be mapped the same way, and be this context's own
+	first = vPT->entries[0].address;
+	flags = vPT->entries[0].flags & ~(F_ACCESSED | F_DIRTY);
+	contiguous = first % HUGE_PAGE_PAGES == 0;
+	for (size_t i = 0; i < 512; i++) {
+		vPTE = &vPT->entries[i];
+		if (!(vPTE->flags & F_PRESENT) || vPTE->cow)
+			return;
+		if ((vPTE->flags & ~(F_ACCESSED | F_DIRTY)) != flags ||
+			vPTE->execute_disable != vPT->entries[0].execute_disable)
+			return;
+		if (phys_page_shared((void *)((uintptr_t)vPTE->address << 12)))
+			return;
+		if (vPTE->address != first + i)
+			contiguous = false;
+	}
+
+	// the kernel may have the pages mapped (kmapuseraddr), so they can
+	// only be moved once it is done with them
+	if (!contiguous && ctx->kmaps != 0)
+		return;
+
+	// move the pages somewhere they line up
+	pADDR = first << 12;
+	if (!contiguous) {
+		pADDR = (uintptr_t)alloc_phys_pages_exact(HUGE_PAGE_PAGES);
+		if (pADDR == 0)
+			return;
+		for (size_t i = 0; i < 512; i++) {
+			void *old = (void *)((uintptr_t)vPT->entries[i].address << 12);
+			void *new = (void *)(pADDR + i * PAGE_SIZE);
+			memcpyv(PAGE_MAP(new), PAGE_MAPC(old), PAGE_SIZE);
+			free_phys_page(old);
+		}
+	}
+
+	vPDE->execute_disable = vPT->entries[0].execute_disable;
+	vPDE->address = pADDR >> 12;
+	vPDE->flags = flags;
+	vPDE->page_size = 1;
+	free_phys_page((void *)pPT);
+
+	for (size_t i = 0; i < 512; i++)
+		invlpg((char *)base + i * PAGE_SIZE);
+	mem_ctx_unmapped(ctx);
+}
+
+// give an untouched page in an area a zeroed physical page
+// @returns 0 on success, 1 on err
+static int area_populate(mem_ctx_t ctx, const void *vADDR)
+{
+	struct mem_area *area;
+	void *pADDR, *page;
+
+	area = area_find(ctx, (uintptr_t)vADDR);
+	if (area == NULL)
+		return 1;
+
+	pADDR = alloc_reclaim(true);
+	if (pADDR == NULL) {
+		ERROR("Could not allocate page for %p", vADDR);
+		return 1;
+	}
+
+	page = (void *)((uintptr_t)vADDR / PAGE_SIZE * PAGE_SIZE);
+	if (map_pages((volatile struct pml4 *)ctx->pml4, page, pADDR, area->flags,
+				  1)) {
+		free_phys_page(pADDR);
+		return 1;
+	}
+
+	area_promote(ctx, area, (uintptr_t)page);
+	return 0;
+}
+
+/* swap */
+
+// read a swapped out page back into a new physical page
+// @returns 0 on success, 1 on err
+static int page_swap_in(mem_ctx_t ctx, const void *vADDR)
+{
+	volatile struct pte *vPTE;
+	struct mem_area *area;
+	uintptr_t page;
+	uint64_t slot;
+	void *pADDR;
+
+	pADDR = alloc_reclaim(false);
+	if (pADDR == NULL) {
+		ERROR("Could not allocate page for %p", vADDR);
+		return 1;
+	}
+
+	// found after reclaiming, which maps other page tables
+	vPTE = pte_locate((volatile struct pml4 *)ctx->pml4, vADDR);
+	slot = vPTE->address;
+	if (swap_in(slot, PAGE_MAP(pADDR))) {
+		ERROR("Could not read %p back from swap", vADDR);
+		free_phys_page(pADDR);
+		return 1;
+	}
+	swap_free(slot);
+
+	vPTE->address = (uint64_t)pADDR >> 12;
+	vPTE->cow = 0;
+	vPTE->flags |= F_PRESENT;
+
+	page = (uintptr_t)vADDR / PAGE_SIZE * PAGE_SIZE;
+	area = area_find(ctx, page);
+	if (area != NULL)
+		area_promote(ctx, area, page);
+	return 0;
+}
+
+// give an address that is not mapped its physical page, read back from
+// swap, or zeroed if it was never touched
+// @returns 0 on success, 1 on err
+static int page_fault_in(mem_ctx_t ctx, const void *vADDR)
+{
+	volatile struct pml4 *pPML4;
+
+	// another cpu already mapped it
+	pPML4 = (volatile struct pml4 *)ctx->pml4;
+	if (page_phys(pPML4, vADDR) != NULL)
+		return 0;
+
+	if (pte_swapped(pte_locate(pPML4, vADDR)))
+		return page_swap_in(ctx, vADDR);
+
+	return area_populate(ctx, vADDR);
+}
+
+// swap out pages from the clock hand up to end, in a single pt
+// @returns 0 on success, 1 if swap is full
+static int reclaim_range(mem_ctx_t ctx, uintptr_t end, size_t count,
+						 size_t *freed)
+{
+	volatile struct pml4 *pPML4;
+	volatile struct pde *vPDE;
+	volatile struct pt *pPT, *vPT;
+	volatile struct pte *vPTE;
+	uintptr_t addr;
+	uint64_t slot;
+	void *pADDR;
+	bool loaded;
+
+	pPML4 = (volatile struct pml4 *)ctx->pml4;
+	loaded = (read_cr3() & ~0xFFFULL) == (uint64_t)pPML4;
+
+	// nothing was touched, or it is a 2M page, which stays in memory
+	vPDE = pde_locate(pPML4, (void *)ctx->clock_addr);
+	if (vPDE == NULL || !(vPDE->flags & F_PRESENT) || vPDE->page_size) {
+		ctx->clock_addr = end;
+		return 0;
+	}
+
+	pPT = (volatile struct pt *)((uintptr_t)vPDE->address << 12);
+	vPT = PT_MAP(pPT);
+
+	for (addr = ctx->clock_addr; addr < end && *freed < count;
+		 addr += PAGE_SIZE) {
+		vPTE = &vPT->entries[(addr >> 12) & 0x1ff];
+		if (!(vPTE->flags & F_PRESENT) || vPTE->cow)
+			continue;
+
+		// used since the hand last went by, look again next time
+		if (vPTE->flags & F_ACCESSED) {
+			vPTE->flags &= ~F_ACCESSED;
+			continue;
+		}
+
+		pADDR = (void *)((uintptr_t)vPTE->address << 12);
+		if (phys_page_shared(pADDR))
+			continue;
+
+		if (swap_out(PAGE_MAPC(pADDR), &slot)) {
+			ctx->clock_addr = addr;
+			return 1;
+		}
+
+		vPTE->flags &= ~(F_PRESENT | F_DIRTY);
+		vPTE->cow = 1;
+		vPTE->address = slot;
+		if (loaded)
+			invlpg((void *)addr);
+		free_phys_page(pADDR);
+		(*freed)++;
+	}
+
+	ctx->clock_addr = addr;
+	return 0;
+}
+
+size_t ctx_reclaim(mem_ctx_t ctx, size_t count, bool *done)
+{
+	struct mem_area *area;
+	uintptr_t end;
+	size_t freed = 0;
+
+	*done = false;
+	while (freed < count) {
+		// back to the start for the next lap
+		if (ctx->clock_area == N_MEM_AREAS) {
+			ctx->clock_area = 0;
+			ctx->clock_addr = 0;
+			*done = true;
+			break;
+		}
+
+		area = &ctx->areas[ctx->clock_area];
+		if (area->limit == 0 || ctx->clock_addr >= area->end) {
+			ctx->clock_area++;
+			ctx->clock_addr = 0;
+			continue;
+		}
+		if (ctx->clock_addr < area->start)
+			ctx->clock_addr = area->start;
+
+		// up to the end of the pt
+		end = (ctx->clock_addr | (HUGE_PAGE_SIZE - 1)) + 1;
+		if (end > area->end)
+			end = area->end;
+
+		if (reclaim_range(ctx, end, count, &freed))
+			break;
+	}
+
+	if (freed > 0)
+		mem_ctx_unmapped(ctx);
+	return freed;
+}
+
+/* other fns */
+
+void tlb_flush_all(void)
+{
+	uint64_t cr4;
+
+	if (has_invpcid) {
+		invpcid(INVPCID_ALL, 0, NULL);
+		return;
+	}
+
+	// toggling CR4.PGE flushes everything, in every pcid
+	cr4 = read_cr4();
+	write_cr4(cr4 & ~CR4_PGE);
+	write_cr4(cr4);
+}
+
+void paging_init(void)
+{
+	struct cpu_feat feats;
+
+	cpu_feats(&feats);
+	has_invpcid = feats.invpcid;
+
+	// map pdpt
+	kernel_pml4.entries[0].flags = F_PRESENT | F_WRITEABLE;
+	kernel_pml4.entries[0].address = (uint64_t)(kernel_pdpt_0.entries) >> 12;
+
+	// map pd0 & pd1
+	kernel_pdpt_0.entries[0].flags = F_PRESENT | F_WRITEABLE;
+	kernel_pdpt_0.entries[0].address = (uint64_t)(kernel_pd_0.entries) >> 12;
+	kernel_pdpt_0.entries[1].flags = F_PRESENT | F_WRITEABLE;
+	kernel_pdpt_0.entries[1].address = (uint64_t)(kernel_pd_1.entries) >> 12;
+
+	// map pd0 entires as 2M pages (length N_IDENT_PTS)
+	for (int i = 0; i < N_IDENT_PTS; i++) {
+		kernel_pd_0.entries[i].address = (i * HUGE_PAGE_SIZE) >> 12;
+		kernel_pd_0.entries[i].page_size = 1;
+		kernel_pd_0.entries[i].global = 1;
+		kernel_pd_0.entries[i].flags = F_PRESENT | F_WRITEABLE;
+	}
+
+	// map paging_pt
+	kernel_pd_1.entries[0].flags = F_PRESENT | F_WRITEABLE;
+	kernel_pd_1.entries[0].address = (uint64_t)(paging_pt.entries) >> 12;
+
+	memsetv(paging_pt.entries, 0, PAGE_SIZE);
+
+	// make sure we are using THESE pagetables
+	// EFI doesnt on boot
+	__asm__ volatile("mov %0, %%cr3" ::"r"(kernel_pml4.entries) : "memory");
+}
+
+void paging_direct_map(uintptr_t end)
+{
+	struct cpu_feat feats;
+	volatile struct pdpte *vPDPTE;
+	volatile struct pd *pPD, *vPD;
+	uint64_t gb;
+
+	cpu_feats(&feats);
+
+	end = (end + 0x3fffffff) & ~0x3fffffffULL;
+	if (end > DIRECT_MAP_SIZE)
+		end = DIRECT_MAP_SIZE;
+
+	for (gb = 0; gb < end >> 30; gb++) {
+		vPDPTE = &kernel_pdpt_0.entries[(DIRECT_MAP >> 30) + gb];
+
+		// one pdpte maps the whole gigabyte
+		if (feats.pdpe1gb) {
+			vPDPTE->address = (gb << 30) >> 12;
+			vPDPTE->page_size = 1;
+			vPDPTE->global = 1;
+			vPDPTE->flags = F_PRESENT | F_WRITEABLE;
+			continue;
+		}
+
+		// otherwise a pd of 2M pages
+		pPD = alloc_zeroed_page();
+		if (pPD == NULL)
+			panic("cannot allocate direct map page directory");
+		vPD = PD_MAP(pPD);
+		for (uint64_t i = 0; i < 512; i++) {
+			vPD->entries[i].address = ((gb << 30) + (i << 21)) >> 12;
+			vPD->entries[i].page_size = 1;
+			vPD->entries[i].global = 1;
+			vPD->entries[i].flags = F_PRESENT | F_WRITEABLE;
+		}
+
+		vPDPTE->address = (uint64_t)pPD >> 12;
+		vPDPTE->flags = F_PRESENT | F_WRITEABLE;
+	}
+
+	direct_map_end = end;
+}
+
+volatile void *pgdir_alloc(void)
+{
+	volatile struct pml4 *pPML4, *vPML4;
+
+	pPML4 = pml4_alloc();
+	if (pPML4 == NULL)
+		return NULL;
+
+	// the kernel stays mapped, so entering it needs no cr3 load
+	vPML4 = PML4_MAP(pPML4);
+	vPML4->entries[KERNEL_PML4E].address =
+		kernel_pml4.entries[KERNEL_PML4E].address;
+	vPML4->entries[KERNEL_PML4E].flags =
+		kernel_pml4.entries[KERNEL_PML4E].flags;
+	vPML4->count++;
+
+	return pPML4;
+}
+
+volatile void *pgdir_clone(volatile const void *old_pgdir, bool cow)
+{
+	return pml4_clone((volatile const struct pml4 *)old_pgdir, cow);
+}
+
+void pgdir_free(volatile void *addr)
 {
 	pml4_free(addr, true);
 }
@@ -916,7 +1798,7 @@ void *mem_mapaddr(mem_ctx_t ctx, void *phys, void *virt, size_t len,
 
 	// get page aligned (or allocate) vitural address
 	if (virt == NULL)
-		virt = virtaddr_alloc(&ctx->virtctx, pages);
+		virt = virt_alloc(ctx, pages, (uintptr_t)aligned_phys);
 	if (virt == NULL) {
 		ERROR("Could not alloc vitural address for %zu pages", pages);
 		return NULL;
@@ -940,13 +1822,44 @@ void *mem_mapaddr(mem_ctx_t ctx, void *phys, void *virt, size_t len,
 	return (char *)virt + error;
 }
 
+void *mem_mapshared(mem_ctx_t ctx, mem_ctx_t from, void *virt, size_t count,
+					unsigned int flags)
+{
+	char *pADDR, *res;
+	size_t i;
+
+	pADDR = mem_get_phys(from, virt);
+	if (pADDR == NULL)
+		return NULL;
+
+	// mapped with a single run, so it must have been allocated as one
+	for (i = 1; i < count; i++)
+		if (mem_get_phys(from, (char *)virt + i * PAGE_SIZE) !=
+			pADDR + i * PAGE_SIZE)
+			return NULL;
+
+	// each context frees its own mapping of the pages
+	for (i = 0; i < count; i++)
+		phys_page_share(pADDR + i * PAGE_SIZE);
+
+	res = mem_mapaddr(ctx, pADDR, virt, count * PAGE_SIZE, flags | F_SHARED);
+	if (res == NULL)
+		for (i = 0; i < count; i++)
+			free_phys_page(pADDR + i * PAGE_SIZE);
+
+	return res;
+}
+
 void *kmapuseraddr(mem_ctx_t ctx, const void *usrADDR, size_t len)
 {
-	volatile struct pml4 *pml4;
+	volatile struct pml4 *pml4, *upml4;
+	volatile struct pte *vPTE;
+	const char *uADDR;
 	char *pADDR, *vADDR;
 	size_t npages, error, i;
 
 	pml4 = (volatile struct pml4 *)kernel_mem_ctx->pml4;
+	upml4 = (volatile struct pml4 *)ctx->pml4;
 	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
 	error = (size_t)usrADDR % PAGE_SIZE;
 	vADDR = virtaddr_alloc(&kernel_mem_ctx->virtctx, npages);
@@ -959,13 +1872,26 @@ void *kmapuseraddr(mem_ctx_t ctx, const void *usrADDR, size_t len)
 	assert((size_t)vADDR % PAGE_SIZE == 0,
 		   "kmapuseraddr: vitural address not page aligned");
 
+	// pages mapped by the kernel cannot be swapped out
+	// until kunmapuseraddr
+	ctx->kmaps++;
+
 	for (i = 0; i < npages; i++) {
-		pADDR = mem_get_phys(ctx, (char *)usrADDR + i * PAGE_SIZE);
-		if (pADDR == NULL)
+		uADDR = (char *)usrADDR + i * PAGE_SIZE;
+		if (page_fault_in(ctx, uADDR))
 			goto fail;
 
-		// page align
-		pADDR = (char *)(((size_t)pADDR / PAGE_SIZE) * PAGE_SIZE);
+		// the kernel may write to it, so it cannot stay shared,
+		// 2M pages have no pte and are never shared
+		vPTE = page_locate(upml4, uADDR);
+		if (vPTE != NULL && vPTE->cow) {
+			if (page_unshare(vPTE))
+				goto fail;
+			invlpg(uADDR);
+			mem_ctx_unmapped(ctx);
+		}
+
+		pADDR = page_phys(upml4, uADDR);
 
 		if (map_pages(pml4, vADDR + i * PAGE_SIZE, pADDR,
 					  F_PRESENT | F_WRITEABLE, 1))
@@ -977,6 +1903,7 @@ void *kmapuseraddr(mem_ctx_t ctx, const void *usrADDR, size_t len)
 fail:
 	unmap_pages(&kernel_pml4, vADDR, i, false);
 	virtaddr_free(&kernel_mem_ctx->virtctx, vADDR);
+	ctx->kmaps--;
 	return NULL;
 }
 
@@ -993,19 +1920,96 @@ void mem_unmapaddr(mem_ctx_t ctx, const void *virt)
 	pages = virtaddr_free(&ctx->virtctx, virt);
 	if (pages < 1)
 		return;
-	unmap_pages(&kernel_pml4, virt, pages, false);
+	unmap_pages((volatile struct pml4 *)ctx->pml4, virt, pages, false);
+	mem_ctx_unmapped(ctx);
 }
 
-void *mem_get_phys(mem_ctx_t ctx, const void *vADDR)
+int mem_page_fault(mem_ctx_t ctx, const void *vADDR, uint64_t code)
 {
-	char *pADDR;
 	volatile struct pte *vPTE;
 
+	// not touched yet, swapped out, or another cpu already mapped it
+	if (!(code & PF_PRESENT)) {
+		if (page_fault_in(ctx, vADDR))
+			return 1;
+		invlpg(vADDR);
+		return 0;
+	}
+
+	// only writes to pages that are mapped can be copy on write
+	if (!(code & PF_WRITE))
+		return 1;
+
 	vPTE = page_locate((volatile struct pml4 *)ctx->pml4, vADDR);
-	if (vPTE == NULL)
+	if (vPTE == NULL || !vPTE->cow)
+		return 1;
+
+	if (page_unshare(vPTE)) {
+		ERROR("Could not copy page for write to %p", vADDR);
+		return 1;
+	}
+
+	invlpg(vADDR);
+	mem_ctx_unmapped(ctx);
+	return 0;
+}
+
+bool mem_zero_idle(void)
+{
+	void *pADDR;
+
+	if (zero_pool_count == ZERO_POOL_SIZE || direct_map_end == 0)
+		return false;
+
+	pADDR = alloc_phys_page();
+	if (pADDR == NULL)
+		return false;
+
+	// the paging window needs the kernel lock, the direct map does not
+	if ((uintptr_t)pADDR + PAGE_SIZE > direct_map_end) {
+		free_phys_page(pADDR);
+		return false;
+	}
+
+	page_zero_nt((char *)DIRECT_MAP + (uintptr_t)pADDR);
+
+	kspin_lock(&zero_pool_lock);
+	if (zero_pool_count < ZERO_POOL_SIZE) {
+		zero_pool[zero_pool_count++] = pADDR;
+		pADDR = NULL;
+	}
+	kspin_unlock(&zero_pool_lock);
+
+	// another cpu filled the pool first
+	free_phys_page(pADDR);
+	return true;
+}
+
+void mem_tlb_sync(void)
+{
+	struct cpu_local *local = cpu_local();
+
+	if (local->tlb_gen != kernel_tlb_gen) {
+		tlb_flush_all();
+		local->tlb_gen = kernel_tlb_gen;
+	} else if (window_cpu != local->id) {
+		// map_addr skips the invlpg if a slot already
+		// holds the table, which only this cpu can know
+		for (size_t i = 0; i < N_WINDOW_SLOTS; i++)
+			invlpg((char *)PAGING_WINDOW + i * PAGE_SIZE);
+	}
+
+	window_cpu = local->id;
+}
+
+void *mem_get_phys(mem_ctx_t ctx, const void *vADDR)
+{
+	char *pADDR;
+
+	pADDR = page_phys((volatile struct pml4 *)ctx->pml4, vADDR);
+	if (pADDR == NULL)
 		return NULL;
 
-	pADDR = (void *)((uintptr_t)vPTE->address << 12);
 	pADDR += ((uint64_t)vADDR % PAGE_SIZE);
 	return pADDR;
 }
@@ -1022,7 +2026,8 @@ void *mem_alloc_page_at(mem_ctx_t ctx, void *virt, unsigned int flags)
 
 void *mem_alloc_pages(mem_ctx_t ctx, size_t count, unsigned int flags)
 {
-	void *virt = virtaddr_alloc(&ctx->virtctx, count);
+	// larger physical blocks are aligned to their size
+	void *virt = virt_alloc(ctx, count, 0);
 	if (virt == NULL)
 		return NULL;
 
@@ -1034,93 +2039,172 @@ void *mem_alloc_pages(mem_ctx_t ctx, size_t count, unsigned int flags)
 	return virt;
 }
 
-void *mem_alloc_pages_at(mem_ctx_t ctx, size_t count, void *virt,
-						 unsigned int flags)
+// back count pages at virt with whatever runs of physical pages are
+// free, or with a single run if contig is set
+static void *alloc_pages_at(mem_ctx_t ctx, size_t count, void *virt,
+							unsigned int flags, bool contig)
 {
-	void *phys = NULL;
+	volatile struct pml4 *pml4;
+	struct phys_page_slice slice;
+	size_t done;
+	bool zero;
+
+	pml4 = (volatile struct pml4 *)ctx->pml4;
+	zero = flags & F_ZERO;
+	flags &= ~F_ZERO;
 
 	if (virtaddr_take(&ctx->virtctx, virt, count)) {
 		ERROR("Could not take vitural address: %p", virt);
 		return NULL;
 	}
 
-	phys = alloc_phys_pages_exact(count);
-	if (phys == NULL) {
-		ERROR("Could not allocate %zu physical pages", count);
-		goto fail;
-	}
+	for (done = 0; done < count; done += slice.num_pages) {
+		if (contig) {
+			slice.pagestart = alloc_phys_pages_exact(count);
+			slice.num_pages = count;
+		} else {
+			slice = alloc_phys_page_withextra(count - done);
+			// the last free pages may be in this cpu's magazine,
+			// or the zeroed pool, or have to be swapped out
+			if (slice.pagestart == NULL) {
+				slice.pagestart = alloc_reclaim(false);
+				slice.num_pages = 1;
+			}
+		}
 
-	if (map_pages((volatile struct pml4 *)ctx->pml4, virt, phys, flags,
-				  count)) {
-		ERROR("Could not map pages");
-		goto fail;
+		if (slice.pagestart == NULL) {
+			ERROR("Could not allocate %zu physical pages", count - done);
+			goto fail;
+		}
+
+		for (size_t i = 0; zero && i < slice.num_pages; i++)
+			page_zero(PAGE_MAP((char *)slice.pagestart + i * PAGE_SIZE));
+
+		if (map_pages(pml4, (char *)virt + done * PAGE_SIZE, slice.pagestart,
+					  flags, slice.num_pages)) {
+			ERROR("Could not map pages");
+			free_phys_pages_slice(slice);
+			goto fail;
+		}
 	}
 
 	return virt;
 
 fail:
-	free_phys_pages(phys, count);
+	// runs mapped so far are freed along with their mappings
+	unmap_pages(pml4, virt, done, true);
 	virtaddr_free(&ctx->virtctx, virt);
 	return NULL;
+}
 
-	//	size_t pages_needed = count;
-	//
-	//	struct phys_page_slice prev_phys_block = PHYS_PAGE_SLICE_NULL;
-	//	struct phys_page_slice phys_pages;
-	//
-	//	if (virtaddr_take(&ctx->virtctx, virt, count))
-	//		return NULL;
-	//
-	//	while (pages_needed > 0) {
-	//		phys_pages = alloc_phys_page_withextra(pages_needed);
-	//		if (phys_pages.pagestart == NULL) {
-	//			goto mem_alloc_pages_at_fail;
-	//		}
-	//
-	//		{
-	//			// allocate the first page and store in it the physical address of the
-	//			// previous chunk of pages
-	//			// TODO: skip this if there are already enough pages from first alloc
-	//			void *pageone = kmapaddr(phys_pages.pagestart, NULL, 1,
-	//									 F_PRESENT | F_WRITEABLE);
-	//			if (pageone == NULL) {
-	//				panic("kernel out of virtual memory");
-	//			}
-	//			*((struct phys_page_slice *)pageone) = prev_phys_block;
-	//			prev_phys_block = phys_pages;
-	//			kunmapaddr(pageone);
-	//		}
-	//
-	//		// index into virtual page array at index [count - pages_needed]
-	//		void *vaddr = ((uint8_t *)virt) + ((count - pages_needed) * PAGE_SIZE);
-	//
-	//		assert(pages_needed >= phys_pages.num_pages, "overflow");
-	//		pages_needed -= phys_pages.num_pages;
-	//
-	//		if (map_pages((volatile struct pml4 *)ctx->pml4, vaddr,
-	//					  phys_pages.pagestart, flags, phys_pages.num_pages)) {
-	//			goto mem_alloc_pages_at_fail;
-	//		}
-	//	}
-	//
-	//	return virt;
-	//
-	//mem_alloc_pages_at_fail:
-	//	while (prev_phys_block.pagestart) {
-	//		void *virtpage = kmapaddr(prev_phys_block.pagestart, NULL, 1,
-	//								  F_PRESENT | F_WRITEABLE);
-	//		if (!virtpage) {
-	//			// memory corruption, most likely a bug
-	//			// could also ERROR here and exit with leak
-	//			panic("unable to free memory from failed mem_alloc_pages_at call");
-	//		}
-	//		struct phys_page_slice prev = *(struct phys_page_slice *)virtpage;
-	//		prev_phys_block = prev;
-	//		free_phys_pages_slice(prev);
-	//		kunmapaddr(virtpage);
-	//	}
-	//
-	//	return NULL;
+void *mem_alloc_pages_at(mem_ctx_t ctx, size_t count, void *virt,
+						 unsigned int flags)
+{
+	return alloc_pages_at(ctx, count, virt, flags, false);
+}
+
+void *mem_alloc_pages_contig(mem_ctx_t ctx, size_t count, unsigned int flags)
+{
+	// larger physical allocations are 2M aligned
+	void *virt = virt_alloc(ctx, count, 0);
+	if (virt == NULL)
+		return NULL;
+
+	if (alloc_pages_at(ctx, count, virt, flags, true) == NULL) {
+		virtaddr_free(&ctx->virtctx, virt);
+		return NULL;
+	}
+
+	return virt;
+}
+
+static void *area_alloc(mem_ctx_t ctx, uintptr_t base, uintptr_t limit,
+						uintptr_t start, uintptr_t end, unsigned int flags,
+						bool grows_down)
+{
+	struct mem_area *area = NULL;
+
+	for (size_t i = 0; i < N_MEM_AREAS; i++) {
+		if (ctx->areas[i].limit == 0) {
+			area = &ctx->areas[i];
+			break;
+		}
+	}
+
+	if (area == NULL) {
+		ERROR("Too many demand paged areas");
+		return NULL;
+	}
+
+	if (virtaddr_take(&ctx->virtctx, (void *)base,
+					  (limit - base) / PAGE_SIZE)) {
+		ERROR("Could not take vitural address: %p", (void *)base);
+		return NULL;
+	}
+
+	area->base = base;
+	area->limit = limit;
+	area->start = start;
+	area->end = end;
+	area->flags = flags;
+	area->grows_down = grows_down;
+
+	return (void *)base;
+}
+
+void *mem_area_alloc(mem_ctx_t ctx, void *virt, size_t count, size_t max,
+					 unsigned int flags)
+{
+	uintptr_t base = (uintptr_t)virt;
+
+	if (count > max || max < 1)
+		return NULL;
+
+	return area_alloc(ctx, base, base + max * PAGE_SIZE, base,
+					  base + count * PAGE_SIZE, flags, false);
+}
+
+void *mem_stack_alloc(mem_ctx_t ctx, void *top, size_t count, size_t max,
+					  unsigned int flags)
+{
+	uintptr_t limit = (uintptr_t)top;
+
+	if (count > max || max < 1)
+		return NULL;
+
+	return area_alloc(ctx, limit - max * PAGE_SIZE, limit,
+					  limit - count * PAGE_SIZE, limit, flags, true);
+}
+
+int mem_area_resize(mem_ctx_t ctx, const void *virt, size_t count)
+{
+	struct mem_area *area = NULL;
+	uintptr_t end;
+
+	for (size_t i = 0; i < N_MEM_AREAS; i++) {
+		if (ctx->areas[i].limit != 0 &&
+			ctx->areas[i].base == (uintptr_t)virt) {
+			area = &ctx->areas[i];
+			break;
+		}
+	}
+
+	if (area == NULL || area->grows_down)
+		return 1;
+
+	end = area->start + count * PAGE_SIZE;
+	if (end > area->limit)
+		return 1;
+
+	// give back what was touched past the new end
+	if (end < area->end) {
+		unmap_pages((volatile struct pml4 *)ctx->pml4, (void *)end,
+					(area->end - end) / PAGE_SIZE, true);
+		mem_ctx_unmapped(ctx);
+	}
+
+	area->end = end;
+	return 0;
 }
 
 void mem_free_pages(mem_ctx_t ctx, const void *virt)
@@ -1128,6 +2212,11 @@ void mem_free_pages(mem_ctx_t ctx, const void *virt)
 	if (virt == NULL)
 		return;
 
+	for (size_t i = 0; i < N_MEM_AREAS; i++)
+		if (ctx->areas[i].base == (uintptr_t)virt)
+			ctx->areas[i].limit = 0;
+
 	long pages = virtaddr_free(&ctx->virtctx, virt);
 	unmap_pages((volatile struct pml4 *)ctx->pml4, virt, pages, true);
+	mem_ctx_unmapped(ctx);
 }
@@ -10,9 +10,35 @@
 #define PAGING_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <comus/limits.h>
+
+// bytes paging_init identity maps from address 0
+#define IDENT_MAP_SIZE (N_IDENT_PTS * 0x200000ULL)
+
+// where the page tables being edited are mapped, until the direct
+// map is set up or for memory past its end
+#define PAGING_WINDOW 0x40000000
+#define PAGING_WINDOW_SIZE 0x200000
+
+// all physical memory is mapped here, at a fixed offset
+#define DIRECT_MAP 0x4000000000ULL
+#define DIRECT_MAP_SIZE 0x4000000000ULL
 
 void paging_init(void);
 
+/**
+ * Map physical memory up to end at DIRECT_MAP, the page tables are
+ * then edited through it instead of the paging window
+ */
+void paging_direct_map(uintptr_t end);
+
+/**
+ * Invalidate every tlb entry on this cpu, in every pcid and including
+ * global pages
+ */
+void tlb_flush_all(void);
+
 volatile void *pgdir_alloc(void);
 volatile void *pgdir_clone(volatile const void *pdir, bool cow);
 void pgdir_free(volatile void *addr);
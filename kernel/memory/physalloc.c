@@ -2,6 +2,7 @@
 #include <comus/memory.h>
 #include <comus/asm.h>
 #include <comus/mboot.h>
+#include <comus/cpu.h>
 #include <stdint.h>
 
 #include "physalloc.h"
@@ -10,16 +11,71 @@ extern char kernel_start[];
 extern char kernel_end[];
 static void *kernel_real_end = NULL;
 
-// between memory_start and kernel_start will be the bitmap
+// between kernel_real_end and memory_start will be the page structs
 static uintptr_t memory_start = 0;
 
-static uint64_t *bitmap = NULL;
+// largest block is 2^MAX_ORDER pages (4M)
+#define MAX_ORDER 10
+#define ORDER_PAGES(order) ((size_t)1 << (order))
+
+// end of a free list
+#define PAGE_NONE UINT32_MAX
+
+/// state of one physical page
+struct phys_page {
+	/// next and prev free block of the same order, if this page is
+	/// the first page of a free block
+	uint32_t next;
+	uint32_t prev;
+	/// order of the free block this page starts
+	uint8_t order;
+	/// set if this page is the first page of a free block
+	uint8_t free;
+	/// number of extra mappings of this page, from copy on write or shared
+	/// memory
+	uint16_t shared;
+};
+
+/// a contiguous range of usable physical memory
+struct phys_zone {
+	/// physical address of the first page, aligned to the largest block
+	/// so blocks are aligned to their size in physical memory
+	uintptr_t start;
+	/// first usable address, the pages before it are never free
+	uintptr_t usable;
+	/// number of pages in the zone
+	size_t pages;
+	/// page structs, indexed by page number in the zone
+	struct phys_page *page;
+	/// first free block of each order
+	uint32_t free_list[MAX_ORDER + 1];
+};
+
+static struct phys_zone zones[N_MMAP_ENTRY];
+static uint32_t zone_count = 0;
+static bool zones_ready = false;
+
+// taken around any change to the zones' free lists
+static struct kspinlock zone_lock;
+
+// pages moved between a magazine and the zones at once
+#define MAG_BATCH 32
+// a magazine is drained back down to MAG_BATCH once it is full
+#define MAG_SIZE (MAG_BATCH * 2)
+
+/// free single pages kept by one cpu, only touched by that cpu
+struct page_magazine {
+	/// number of pages in the magazine
+	uint32_t count;
+	/// physical addresses of the pages
+	void *pages[MAG_SIZE];
+};
+
+static struct page_magazine magazines[N_CPUS];
+
 static uint64_t total_memory;
 static uint64_t free_memory;
-static uint64_t page_count;
-static uint64_t segment_count;
 struct memory_map phys_mmap;
-struct memory_segment *page_start = NULL;
 
 static const char *segment_type_str[] = {
 	[SEG_TYPE_FREE] = "Free",			[SEG_TYPE_RESERVED] = "Reserved",
@@ -27,168 +83,407 @@ static const char *segment_type_str[] = {
 	[SEG_TYPE_DEFECTIVE] = "Defective", [SEG_TYPE_EFI] = "EFI Reserved",
 };
 
-static int n_pages(const struct memory_segment *m)
+static uintptr_t page_align(uintptr_t ptr)
 {
-	return (m->len + PAGE_SIZE - 1) / PAGE_SIZE;
+	return (ptr + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
 }
 
-static void *page_at(size_t i)
+// smallest order that holds count pages
+static uint32_t count_order(size_t count)
 {
-	size_t cur_page = 0;
-	const struct memory_segment *m = page_start;
-	for (uint64_t idx = 0; idx < segment_count; idx++) {
-		size_t pages = n_pages(m);
-		if (i - cur_page < pages) {
-			return (void *)(m->addr + (PAGE_SIZE * (i - cur_page)));
-		}
-		cur_page += pages;
-		m++;
+	uint32_t order = 0;
+	while (ORDER_PAGES(order) < count)
+		order++;
+	return order;
+}
+
+static struct phys_zone *zone_of(uintptr_t addr)
+{
+	for (uint32_t i = 0; i < zone_count; i++) {
+		struct phys_zone *zone = &zones[i];
+		if (addr >= zone->usable &&
+			addr < zone->start + zone->pages * PAGE_SIZE)
+			return zone;
 	}
 	return NULL;
 }
 
-static long page_idx(void *page)
+// the page struct of a page, or NULL if it is not managed by us
+static struct phys_page *page_of(uintptr_t addr)
 {
-	uintptr_t addr = (uintptr_t)page;
-	int cur_page = 0;
-	const struct memory_segment *m = page_start;
-	for (uint64_t idx = 0; idx < segment_count; idx++) {
-		if (addr < m->addr) {
-			return -1;
+	struct phys_zone *zone;
+
+	if (!zones_ready)
+		return NULL;
+
+	zone = zone_of(addr);
+	if (zone == NULL)
+		return NULL;
+
+	return &zone->page[(addr - zone->start) / PAGE_SIZE];
+}
+
+static void *block_addr(struct phys_zone *zone, size_t idx)
+{
+	return (void *)(zone->start + idx * PAGE_SIZE);
+}
+
+/* free lists */
+
+static void list_push(struct phys_zone *zone, size_t idx, uint32_t order)
+{
+	struct phys_page *page = &zone->page[idx];
+	uint32_t head = zone->free_list[order];
+
+	page->next = head;
+	page->prev = PAGE_NONE;
+	page->order = order;
+	page->free = true;
+	if (head != PAGE_NONE)
+		zone->page[head].prev = idx;
+	zone->free_list[order] = idx;
+}
+
+static void list_remove(struct phys_zone *zone, size_t idx)
+{
+	struct phys_page *page = &zone->page[idx];
+
+	if (page->prev != PAGE_NONE)
+		zone->page[page->prev].next = page->next;
+	else
+		zone->free_list[page->order] = page->next;
+	if (page->next != PAGE_NONE)
+		zone->page[page->next].prev = page->prev;
+	page->free = false;
+}
+
+/* buddy */
+
+// free a block, merging it with its buddy for as long as the buddy is free
+static void block_free(struct phys_zone *zone, size_t idx, uint32_t order)
+{
+	assert(!zone->page[idx].free, "physical page %p freed twice",
+		   block_addr(zone, idx));
+
+	free_memory += ORDER_PAGES(order) * PAGE_SIZE;
+
+	while (order < MAX_ORDER) {
+		size_t buddy = idx ^ ORDER_PAGES(order);
+		if (buddy + ORDER_PAGES(order) > zone->pages)
+			break;
+		if (!zone->page[buddy].free || zone->page[buddy].order != order)
+			break;
+		list_remove(zone, buddy);
+		if (buddy < idx)
+			idx = buddy;
+		order++;
+	}
+
+	list_push(zone, idx, order);
+}
+
+// free any range of pages as the largest aligned blocks that fit
+static void range_free(struct phys_zone *zone, size_t idx, size_t count)
+{
+	while (count > 0) {
+		uint32_t order = 0;
+		while (order < MAX_ORDER && (idx & ORDER_PAGES(order)) == 0 &&
+			   ORDER_PAGES(order + 1) <= count)
+			order++;
+		block_free(zone, idx, order);
+		idx += ORDER_PAGES(order);
+		count -= ORDER_PAGES(order);
+	}
+}
+
+// take a free block of at least the given order, splitting it down
+static bool block_alloc(struct phys_zone *zone, uint32_t order, size_t *idx)
+{
+	uint32_t found;
+
+	for (found = order; found <= MAX_ORDER; found++)
+		if (zone->free_list[found] != PAGE_NONE)
+			break;
+	if (found > MAX_ORDER)
+		return false;
+
+	*idx = zone->free_list[found];
+	list_remove(zone, *idx);
+
+	// give back the upper half until it is the right size
+	while (found > order) {
+		found--;
+		list_push(zone, *idx + ORDER_PAGES(found), found);
+	}
+
+	free_memory -= ORDER_PAGES(order) * PAGE_SIZE;
+	return true;
+}
+
+// find count contiguous pages made of free max order blocks
+static bool run_alloc(struct phys_zone *zone, size_t count, size_t *idx)
+{
+	size_t blocks =
+		(count + ORDER_PAGES(MAX_ORDER) - 1) / ORDER_PAGES(MAX_ORDER);
+
+	for (uint32_t i = zone->free_list[MAX_ORDER]; i != PAGE_NONE;
+		 i = zone->page[i].next) {
+		size_t n;
+
+		// only start at the beginning of a run
+		if (i >= ORDER_PAGES(MAX_ORDER)) {
+			struct phys_page *prev = &zone->page[i - ORDER_PAGES(MAX_ORDER)];
+			if (prev->free && prev->order == MAX_ORDER)
+				continue;
 		}
-		if ((uintptr_t)m + m->len > addr) {
-			return cur_page + ((addr - m->addr) / PAGE_SIZE);
+
+		for (n = 1; n < blocks; n++) {
+			size_t next = i + n * ORDER_PAGES(MAX_ORDER);
+			if (next + ORDER_PAGES(MAX_ORDER) > zone->pages)
+				break;
+			if (!zone->page[next].free || zone->page[next].order != MAX_ORDER)
+				break;
 		}
-		cur_page += n_pages(m);
-		m++;
+		if (n < blocks)
+			continue;
+
+		*idx = i;
+		for (n = 0; n < blocks; n++)
+			list_remove(zone, i + n * ORDER_PAGES(MAX_ORDER));
+		free_memory -= blocks * ORDER_PAGES(MAX_ORDER) * PAGE_SIZE;
+
+		// the end of the last block is not needed
+		range_free(zone, i + count, blocks * ORDER_PAGES(MAX_ORDER) - count);
+		return true;
+	}
+
+	return false;
+}
+
+// take count contiguous pages from the zones, the zone lock must be held
+static void *zones_alloc(size_t pages)
+{
+	uint32_t order;
+	size_t idx;
+
+	if (pages > ORDER_PAGES(MAX_ORDER)) {
+		for (uint32_t i = 0; i < zone_count; i++)
+			if (run_alloc(&zones[i], pages, &idx))
+				return block_addr(&zones[i], idx);
+		return NULL;
+	}
+
+	order = count_order(pages);
+	for (uint32_t i = 0; i < zone_count; i++) {
+		struct phys_zone *zone = &zones[i];
+		if (!block_alloc(zone, order, &idx))
+			continue;
+		// give back what rounding up to a power of two added
+		range_free(zone, idx + pages, ORDER_PAGES(order) - pages);
+		return block_addr(zone, idx);
 	}
-	return -1;
+
+	return NULL;
 }
 
-static inline bool bitmap_get(size_t i)
+// give back pages to the zones, the zone lock must be held
+static void zones_free(struct phys_zone *zone, void *ptr, size_t pages)
 {
-	return (bitmap[i / 64] >> (i % 64)) & 1;
+	size_t idx;
+
+	idx = ((uintptr_t)ptr - zone->start) / PAGE_SIZE;
+	assert(idx + pages <= zone->pages, "freed pages run past their zone");
+	range_free(zone, idx, pages);
 }
 
-static inline void bitmap_set(size_t i, bool v)
+// move up to count pages from the zones into a magazine
+static void magazine_refill(struct page_magazine *mag, uint32_t count)
 {
-	if (v)
-		free_memory -= PAGE_SIZE;
-	else
-		free_memory += PAGE_SIZE;
-	size_t idx = i / 64;
-	bitmap[idx] &= ~(1 << (i % 64));
-	bitmap[idx] |= (v << (i % 64));
+	kspin_lock(&zone_lock);
+	while (mag->count < count) {
+		void *page = zones_alloc(1);
+		if (page == NULL)
+			break;
+		mag->pages[mag->count++] = page;
+	}
+	kspin_unlock(&zone_lock);
+}
+
+// move pages from a magazine back to the zones until count are left
+static void magazine_drain(struct page_magazine *mag, uint32_t count)
+{
+	kspin_lock(&zone_lock);
+	while (mag->count > count) {
+		void *page = mag->pages[--mag->count];
+		zones_free(zone_of((uintptr_t)page), page, 1);
+	}
+	kspin_unlock(&zone_lock);
 }
 
 void *alloc_phys_page(void)
 {
-	return alloc_phys_pages_exact(1);
+	struct page_magazine *mag;
+
+	if (!zones_ready)
+		return alloc_phys_pages_exact(1);
+
+	mag = &magazines[cpu_id()];
+	if (mag->count == 0)
+		magazine_refill(mag, MAG_BATCH);
+	if (mag->count == 0)
+		return NULL;
+
+	return mag->pages[--mag->count];
 }
 
 void *alloc_phys_pages_exact(size_t pages)
 {
+	void *addr;
+
 	if (pages < 1)
 		return NULL;
 
-	if (bitmap == NULL || page_start == NULL) {
+	if (!zones_ready) {
 		// temporary bump allocator
-		void *addr = (void *)memory_start;
+		addr = (void *)memory_start;
 		assert(pages == 1,
 			   "caller expects more pages, but is only getting one");
 		memory_start += PAGE_SIZE;
 		return addr;
 	}
 
-	size_t n_contiguous = 0;
-	size_t free_region_start = 0;
-	for (size_t i = 0; i < page_count; i++) {
-		bool free = !bitmap_get(i);
-
-		if (free) {
-			if (n_contiguous == 0)
-				free_region_start = i;
-			n_contiguous++;
-			if (n_contiguous == pages) {
-				void *pADDR;
-				pADDR = page_at(free_region_start);
-
-				if (pADDR == NULL) {
-					n_contiguous = 0;
-					continue;
-				}
-
-				for (size_t j = 0; j < pages; j++)
-					bitmap_set(free_region_start + j, true);
-				return pADDR;
-			}
-		} else
-			n_contiguous = 0;
-	}
+	if (pages == 1)
+		return alloc_phys_page();
 
-	return NULL;
+	kspin_lock(&zone_lock);
+	addr = zones_alloc(pages);
+	kspin_unlock(&zone_lock);
+	if (addr != NULL)
+		return addr;
+
+	// pages held by our magazine may be what is missing
+	magazine_drain(&magazines[cpu_id()], 0);
+
+	kspin_lock(&zone_lock);
+	addr = zones_alloc(pages);
+	kspin_unlock(&zone_lock);
+	return addr;
 }
 
 struct phys_page_slice alloc_phys_page_withextra(size_t max_pages)
 {
-	panic("please dont use this its broken i think?!\n");
-	if (max_pages == 0)
-		return PHYS_PAGE_SLICE_NULL;
+	struct phys_page_slice out = PHYS_PAGE_SLICE_NULL;
+	uint32_t order;
 
-	for (size_t i = 0; i < page_count; i++) {
-		const bool free = !bitmap_get(i);
-		if (!free)
-			continue;
+	if (max_pages == 0)
+		return out;
 
-		// now allocated
-		bitmap_set(i, true);
-
-		// found at least one page, guaranteed to return valid slice at this
-		// point
-		struct phys_page_slice out = {
-			.pagestart = page_at(i),
-			.num_pages = 1,
-		};
-
-		// add some extra pages if possible
-		for (; out.num_pages < MIN(page_count - i, max_pages);
-			 ++out.num_pages) {
-			// early return if max_pages isn't available
-			if (bitmap_get(i + out.num_pages)) {
-				return out;
-			}
-			bitmap_set(i + out.num_pages, true);
+	// the biggest block that is free, up to max_pages
+	order = count_order(max_pages);
+	if (order > MAX_ORDER)
+		order = MAX_ORDER;
+	if (ORDER_PAGES(order) > max_pages)
+		order--;
+
+	kspin_lock(&zone_lock);
+	for (;; order--) {
+		for (uint32_t i = 0; i < zone_count; i++) {
+			struct phys_zone *zone = &zones[i];
+			size_t idx;
+			if (!block_alloc(zone, order, &idx))
+				continue;
+			out.pagestart = block_addr(zone, idx);
+			out.num_pages = ORDER_PAGES(order);
+			goto done;
 		}
-
-		return out;
+		if (order == 0)
+			break;
 	}
 
-	// only reachable if there is not a single free page in the bitmap
-	return PHYS_PAGE_SLICE_NULL;
+done:
+	kspin_unlock(&zone_lock);
+	return out;
 }
 
 void free_phys_page(void *ptr)
 {
-	free_phys_pages(ptr, 1);
+	struct page_magazine *mag;
+	struct phys_page *page;
+	uint16_t shared;
+
+	if (ptr == NULL)
+		return;
+
+	// not managed by us, i.e. the kernel or mmio
+	page = page_of((uintptr_t)ptr);
+	if (page == NULL)
+		return;
+
+	// still mapped somewhere else
+	shared = __atomic_load_n(&page->shared, __ATOMIC_RELAXED);
+	while (shared > 0)
+		if (__atomic_compare_exchange_n(&page->shared, &shared, shared - 1,
+										false, __ATOMIC_ACQ_REL,
+										__ATOMIC_RELAXED))
+			return;
+
+	mag = &magazines[cpu_id()];
+	if (mag->count == MAG_SIZE)
+		magazine_drain(mag, MAG_BATCH);
+	mag->pages[mag->count++] = ptr;
+}
+
+bool phys_page_share(void *ptr)
+{
+	struct phys_page *page;
+	uint16_t shared;
+
+	page = page_of((uintptr_t)ptr);
+	if (page == NULL)
+		return false;
+
+	shared = __atomic_fetch_add(&page->shared, 1, __ATOMIC_RELAXED);
+	assert(shared != UINT16_MAX, "physical page %p shared too many times",
+		   ptr);
+	return true;
+}
+
+bool phys_page_shared(void *ptr)
+{
+	struct phys_page *page;
+
+	page = page_of((uintptr_t)ptr);
+	if (page == NULL)
+		return false;
+
+	return __atomic_load_n(&page->shared, __ATOMIC_ACQUIRE) > 0;
 }
 
 void free_phys_pages_slice(struct phys_page_slice slice)
 {
-	panic("please dont use this its broken i think?!\n");
 	free_phys_pages(slice.pagestart, slice.num_pages);
 }
 
 void free_phys_pages(void *ptr, size_t pages)
 {
+	struct phys_zone *zone;
+
+	if (pages == 1) {
+		free_phys_page(ptr);
+		return;
+	}
+
 	if (ptr == NULL)
 		return;
 
-	long idx = page_idx(ptr);
-	if (idx == -1)
+	// not managed by us, i.e. the kernel or mmio
+	zone = zone_of((uintptr_t)ptr);
+	if (zone == NULL)
 		return;
 
-	for (size_t i = 0; i < pages; i++)
-		bitmap_set(idx + i, false);
+	kspin_lock(&zone_lock);
+	zones_free(zone, ptr, pages);
+	kspin_unlock(&zone_lock);
 }
 
 static bool segment_invalid(const struct memory_segment *segment)
@@ -206,96 +501,102 @@ static bool segment_invalid(const struct memory_segment *segment)
 	return false;
 }
 
+// page aligned part of a segment that is past the kernel and anything
+// allocated for the page structs, may have no pages
 static struct memory_segment clamp_segment(const struct memory_segment *segment)
 {
-	uint64_t length = segment->len;
-	uintptr_t addr = segment->addr;
+	struct memory_segment temp;
+	uintptr_t start, end;
 
-	uintptr_t start;
 	if (memory_start)
 		start = memory_start;
 	else
 		start = (uintptr_t)kernel_real_end;
 
-	if (segment->addr < start) {
-		addr = start;
-		length -= addr - segment->addr;
-	} else {
-		addr = segment->addr;
-	}
+	end = (segment->addr + segment->len) / PAGE_SIZE * PAGE_SIZE;
+	start = page_align(MAX(segment->addr, start));
 
-	struct memory_segment temp;
-	temp.len = length;
-	temp.addr = addr;
+	temp.addr = start;
+	temp.len = end > start ? end - start : 0;
+	temp.type = segment->type;
 
 	return temp;
 }
 
-static uintptr_t page_align(uintptr_t ptr)
-{
-	return (ptr + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
-}
-
 void physalloc_init(struct memory_map *map)
 {
-	bitmap = NULL;
+	struct phys_page *page_area;
+	size_t page_count, page_area_size, used;
+
 	total_memory = 0;
 	free_memory = 0;
 	page_count = 0;
-	page_start = NULL;
+	zone_count = 0;
+	zones_ready = false;
 	phys_mmap = *map;
 
-	segment_count = 0;
-
 	kernel_real_end = mboot_end();
 	if ((char *)kernel_real_end < kernel_end)
 		kernel_real_end = kernel_end;
 
+	// most pages there could be
 	for (uint32_t i = 0; i < map->entry_count; i++) {
 		struct memory_segment *segment = &map->entries[i];
+		struct memory_segment temp;
 
 		if (segment_invalid(segment))
 			continue;
 
-		struct memory_segment temp = clamp_segment(segment);
-		page_count += n_pages(&temp);
-		segment_count++;
+		temp = clamp_segment(segment);
+		total_memory += temp.len / PAGE_SIZE * PAGE_SIZE;
+		// and the pages aligning its zone
+		page_count += temp.len / PAGE_SIZE + ORDER_PAGES(MAX_ORDER);
 	}
 
-	long bitmap_pages = (page_count / 64 / PAGE_SIZE) + 1;
-	long bitmap_size = bitmap_pages * PAGE_SIZE;
-	bitmap = (uint64_t *)page_align((uintptr_t)kernel_real_end);
-
-	long page_area_size = segment_count * sizeof(struct memory_segment);
-	char *page_area_addr = (char *)bitmap + bitmap_size;
-	page_area_addr = (char *)page_align((uintptr_t)page_area_addr);
-
-	memory_start = page_align((uintptr_t)page_area_addr + page_area_size);
-
-	bitmap = kmapaddr(bitmap, NULL, bitmap_size, F_WRITEABLE);
-	memset(bitmap, 0, bitmap_size);
-	page_area_addr =
-		kmapaddr(page_area_addr, NULL, page_area_size, F_WRITEABLE);
-	memset(page_area_addr, 0, page_area_size);
+	// page structs go right after the kernel, mapping them takes page
+	// tables from the bump allocator which continues after them
+	page_area_size = page_count * sizeof(struct phys_page);
+	page_area = (struct phys_page *)page_align((uintptr_t)kernel_real_end);
+	memory_start = page_align((uintptr_t)page_area + page_area_size);
 
-	page_start = (struct memory_segment *)page_area_addr;
-
-	struct memory_segment *area = page_start;
+	page_area = kmapaddr(page_area, NULL, page_area_size, F_WRITEABLE);
+	if (page_area == NULL)
+		panic("cannot map physical page structs");
 
+	// every zone starts past what was used above
+	used = 0;
 	for (uint32_t i = 0; i < map->entry_count; i++) {
 		struct memory_segment *segment = &map->entries[i];
+		struct memory_segment temp;
+		struct phys_zone *zone;
 
 		if (segment_invalid(segment))
 			continue;
 
-		struct memory_segment temp = clamp_segment(segment);
-		*area = temp;
-		area++;
+		temp = clamp_segment(segment);
+		if (temp.len == 0)
+			continue;
+
+		zone = &zones[zone_count++];
+		zone->usable = temp.addr;
+		zone->start = temp.addr & ~(ORDER_PAGES(MAX_ORDER) * PAGE_SIZE - 1);
+		zone->pages = (temp.addr + temp.len - zone->start) / PAGE_SIZE;
+		zone->page = page_area + used;
+		used += zone->pages;
+		for (uint32_t order = 0; order <= MAX_ORDER; order++)
+			zone->free_list[order] = PAGE_NONE;
+		memset(zone->page, 0, zone->pages * sizeof(struct phys_page));
+	}
+
+	assert(used <= page_count, "physical zones grew while mapping them");
+
+	for (uint32_t i = 0; i < zone_count; i++) {
+		struct phys_zone *zone = &zones[i];
+		size_t first = (zone->usable - zone->start) / PAGE_SIZE;
+		range_free(zone, first, zone->pages - first);
 	}
 
-	total_memory = page_count * PAGE_SIZE;
-	page_count -= bitmap_pages;
-	free_memory = page_count * PAGE_SIZE;
+	zones_ready = true;
 }
 
 uint64_t memory_total(void)
@@ -305,12 +606,18 @@ uint64_t memory_total(void)
 
 uint64_t memory_free(void)
 {
-	return free_memory;
+	uint64_t free = free_memory;
+
+	// pages cached by cpus are free too
+	for (uint32_t i = 0; i < N_CPUS; i++)
+		free += magazines[i].count * PAGE_SIZE;
+
+	return free;
 }
 
 uint64_t memory_used(void)
 {
-	return total_memory - free_memory;
+	return total_memory - memory_free();
 }
 
 void memory_report(void)
@@ -56,7 +56,21 @@ void *alloc_phys_pages_exact(size_t count);
 void free_phys_page(void *ptr);
 
 /**
- * Frees count physical pages in memory
+ * Adds a mapping to a physical page, which then takes one more
+ * free_phys_page call to actually be freed
+ * @param ptr - the physical address of the page
+ * @returns false if the page is not managed by the allocator (kernel, mmio)
+ */
+bool phys_page_share(void *ptr);
+
+/**
+ * @param ptr - the physical address of the page
+ * @returns if the page is mapped more than once
+ */
+bool phys_page_shared(void *ptr);
+
+/**
+ * Frees count physical pages in memory, none of them may be shared
  * @param ptr - the physical address of the first page
  * @param count - the number of pages in the list
  */
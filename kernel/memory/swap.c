@@ -0,0 +1,119 @@
+#include <lib.h>
+#include <comus/memory.h>
+#include <comus/drivers/ata.h>
+#include <comus/fs.h>
+
+#include "swap.h"
+
+// sectors in a page
+#define PAGE_SECTS (PAGE_SIZE / ATA_SECT_SIZE)
+
+_Static_assert(SWAP_ATA_DEVICE < 4, "SWAP_ATA_DEVICE is not an ata device");
+_Static_assert((uint64_t)SWAP_START_LBA + (uint64_t)N_SWAP_PAGES * PAGE_SECTS <=
+				   UINT32_MAX,
+			   "swap space does not fit in 32 bit lbas");
+
+// set once the swap space has been checked
+static bool enabled = false;
+
+// number of ptes pointing at each slot, 0 if it is free
+static uint16_t slot_refs[N_SWAP_PAGES];
+static size_t free_slots = N_SWAP_PAGES;
+// where the search for a free slot starts
+static size_t next_slot = 0;
+
+static uint32_t slot_lba(uint64_t slot)
+{
+	return SWAP_START_LBA + slot * PAGE_SECTS;
+}
+
+void swap_init(void)
+{
+	uint16_t sect[ATA_SECT_SIZE / 2];
+	char buf[20];
+
+	// never write over a file system
+	for (size_t i = 0; i < N_DISKS; i++) {
+		struct disk *disk = &fs_disks[i];
+		if (disk->d_present && disk->d_type == DISK_TYPE_ATA &&
+			disk->ide == SWAP_ATA_DEVICE &&
+			fs_loaded_file_systems[i].fs_present) {
+			WARN("ata device %d has a file system, swap is off",
+				 SWAP_ATA_DEVICE);
+			return;
+		}
+	}
+
+	// the last sector must be on the device
+	if (ide_device_read_sectors(SWAP_ATA_DEVICE, 1,
+								slot_lba(N_SWAP_PAGES) - 1, sect)) {
+		WARN("no room for swap on ata device %d, swap is off",
+			 SWAP_ATA_DEVICE);
+		return;
+	}
+
+	enabled = true;
+	INFO("%s of swap on ata device %d",
+		 btoa((size_t)N_SWAP_PAGES * PAGE_SIZE, buf), SWAP_ATA_DEVICE);
+}
+
+bool swap_enabled(void)
+{
+	return enabled;
+}
+
+int swap_out(volatile const void *vADDR, uint64_t *slot)
+{
+	size_t i;
+
+	if (!enabled || free_slots == 0)
+		return 1;
+
+	for (i = next_slot; slot_refs[i] != 0; i = (i + 1) % N_SWAP_PAGES)
+		;
+
+	// the ata driver reads from the page with pio, so it can be
+	// written from wherever it is mapped
+	if (ide_device_write_sectors(SWAP_ATA_DEVICE, PAGE_SECTS, slot_lba(i),
+								 (uint16_t *)(uintptr_t)vADDR))
+		return 1;
+
+	slot_refs[i] = 1;
+	free_slots--;
+	next_slot = (i + 1) % N_SWAP_PAGES;
+	*slot = i;
+	return 0;
+}
+
+int swap_in(uint64_t slot, volatile void *vADDR)
+{
+	assert(slot < N_SWAP_PAGES && slot_refs[slot] != 0,
+		   "swap slot %lu is not in use", slot);
+
+	if (ide_device_read_sectors(SWAP_ATA_DEVICE, PAGE_SECTS, slot_lba(slot),
+								(uint16_t *)(uintptr_t)vADDR))
+		return 1;
+
+	return 0;
+}
+
+int swap_dup(uint64_t slot)
+{
+	assert(slot < N_SWAP_PAGES && slot_refs[slot] != 0,
+		   "swap slot %lu is not in use", slot);
+
+	if (slot_refs[slot] == UINT16_MAX)
+		return 1;
+
+	slot_refs[slot]++;
+	return 0;
+}
+
+void swap_free(uint64_t slot)
+{
+	assert(slot < N_SWAP_PAGES && slot_refs[slot] != 0,
+		   "swap slot %lu is not in use", slot);
+
+	if (--slot_refs[slot] == 0)
+		free_slots++;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file swap.h
+ *
+ * @author Freya Murphy <freya@freyacat.org>
+ *
+ * Swap space functions
+ */
+
+#ifndef SWAP_H_
+#define SWAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @returns if there is swap space to write pages to
+ */
+bool swap_enabled(void);
+
+/**
+ * Write a page out to a free swap slot
+ *
+ * @param vADDR - the page to write
+ * @param slot - set to the slot the page was written to
+ * @returns 0 on success, 1 if swap is full or the write failed
+ */
+int swap_out(volatile const void *vADDR, uint64_t *slot);
+
+/**
+ * Read a page back from a swap slot
+ *
+ * @param slot - the slot to read
+ * @param vADDR - the page to read into
+ * @returns 0 on success, 1 on err
+ */
+int swap_in(uint64_t slot, volatile void *vADDR);
+
+/**
+ * Note another pte points at a slot, used when a context is cloned
+ *
+ * @returns 0 on success, 1 if the slot has too many mappings
+ */
+int swap_dup(uint64_t slot);
+
+/**
+ * Drop a pte's mapping of a slot, the slot is free once none are left
+ */
+void swap_free(uint64_t slot);
+
+#endif /* swap.h */
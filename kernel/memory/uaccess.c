@@ -0,0 +1,184 @@
+#include <comus/memory.h>
+#include <comus/asm.h>
+#include <comus/cpu.h>
+#include <lib.h>
+
+#include "memory.h"
+
+#define CR4_SMAP (1 << 21)
+
+// faulting instruction in a user copy, and where it continues instead
+struct uaccess_fixup {
+	uint64_t rip;
+	uint64_t fixup;
+};
+
+// filled in by the .uaccess_fixup entries in the copy functions
+extern const struct uaccess_fixup uaccess_fixup_start[];
+extern const struct uaccess_fixup uaccess_fixup_end[];
+
+// if every cpu has CR4.SMAP set, also read by the isr stubs
+bool smap_enabled = false;
+
+// allow the kernel to touch user pages, and tell the page
+// fault handler which context they belong to
+// @returns the context to load again in uaccess_end
+static mem_ctx_t uaccess_begin(mem_ctx_t ctx)
+{
+	mem_ctx_t prev;
+
+	prev = cpu_local()->mem_ctx;
+	if (prev == NULL)
+		prev = kernel_mem_ctx;
+
+	mem_ctx_switch(ctx);
+	cpu_local()->uaccess_ctx = ctx;
+	if (smap_enabled)
+		__asm__ volatile("stac" ::: "memory");
+
+	return prev;
+}
+
+static void uaccess_end(mem_ctx_t prev)
+{
+	if (smap_enabled)
+		__asm__ volatile("clac" ::: "memory");
+	cpu_local()->uaccess_ctx = NULL;
+	mem_ctx_switch(prev);
+}
+
+// if [addr, addr + len) is all in user space
+static bool user_range(const void *addr, size_t len)
+{
+	uintptr_t start = (uintptr_t)addr;
+
+	return start >= USER_SPACE_START && start <= USER_SPACE_END &&
+		   len <= USER_SPACE_END - start;
+}
+
+// @returns 0 on success, 1 if it faulted
+static int uaccess_copy(void *dst, const void *src, size_t len)
+{
+	int ret;
+
+	__asm__ volatile("1:	rep movsb\n"
+					 "	xorl %0, %0\n"
+					 "	jmp 3f\n"
+					 "2:	movl $1, %0\n"
+					 "3:\n"
+					 "	.pushsection .uaccess_fixup, \"a\"\n"
+					 "	.quad 1b, 2b\n"
+					 "	.popsection\n"
+					 : "=r"(ret), "+D"(dst), "+S"(src), "+c"(len)
+					 :
+					 : "memory");
+
+	return ret;
+}
+
+// @returns the string length, max if it is longer, or -1 if it faulted
+static long uaccess_strnlen(const char *str, size_t max)
+{
+	long len;
+
+	__asm__ volatile("	xorq %0, %0\n"
+					 "1:	cmpq %2, %0\n"
+					 "	je 3f\n"
+					 "2:	cmpb $0, (%1,%0)\n"
+					 "	je 3f\n"
+					 "	incq %0\n"
+					 "	jmp 1b\n"
+					 "4:	movq $-1, %0\n"
+					 "3:\n"
+					 "	.pushsection .uaccess_fixup, \"a\"\n"
+					 "	.quad 2b, 4b\n"
+					 "	.popsection\n"
+					 : "=&r"(len)
+					 : "r"(str), "r"(max)
+					 : "memory", "cc");
+
+	return len;
+}
+
+void uaccess_init(void)
+{
+	smap_enabled = read_cr4() & CR4_SMAP;
+}
+
+int copy_from_user(mem_ctx_t ctx, void *dst, const void *src, size_t len)
+{
+	mem_ctx_t prev;
+	int ret;
+
+	if (ctx == kernel_mem_ctx) {
+		memcpy(dst, src, len);
+		return 0;
+	}
+
+	if (!user_range(src, len))
+		return 1;
+
+	prev = uaccess_begin(ctx);
+	ret = uaccess_copy(dst, src, len);
+	uaccess_end(prev);
+
+	return ret;
+}
+
+int copy_to_user(mem_ctx_t ctx, void *dst, const void *src, size_t len)
+{
+	mem_ctx_t prev;
+	int ret;
+
+	if (ctx == kernel_mem_ctx) {
+		memcpy(dst, src, len);
+		return 0;
+	}
+
+	if (!user_range(dst, len))
+		return 1;
+
+	prev = uaccess_begin(ctx);
+	ret = uaccess_copy(dst, src, len);
+	uaccess_end(prev);
+
+	return ret;
+}
+
+long strnlen_user(mem_ctx_t ctx, const char *str, size_t max)
+{
+	mem_ctx_t prev;
+	long len;
+
+	if (ctx == kernel_mem_ctx) {
+		len = strlen(str);
+		return (size_t)len < max ? len : (long)max;
+	}
+
+	if (!user_range(str, 0))
+		return -1;
+
+	// stop at the end of user space
+	if (max > USER_SPACE_END - (uintptr_t)str)
+		max = USER_SPACE_END - (uintptr_t)str;
+
+	prev = uaccess_begin(ctx);
+	len = uaccess_strnlen(str, max);
+	uaccess_end(prev);
+
+	return len;
+}
+
+bool uaccess_fixup(uint64_t *rip)
+{
+	const struct uaccess_fixup *ent;
+
+	for (ent = uaccess_fixup_start; ent < uaccess_fixup_end; ent++) {
+		if (ent->rip == *rip) {
+			*rip = ent->fixup;
+			return true;
+		}
+	}
+
+	return false;
+}
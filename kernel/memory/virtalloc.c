@@ -4,275 +4,403 @@
 
 #include "virtalloc.h"
 
-extern char kernel_start[];
-extern char kernel_end[];
+// nodes kept in a context's pool for the allocations that filling the
+// pool makes itself, each take needs at most two
+#define NODE_RESERVE 8
 
-static struct virt_addr_node *get_node_idx(struct virt_ctx *ctx, int idx)
+// heap allocated nodes, shared by every context
+static struct kcache node_cache;
+static bool node_cache_ready = false;
+
+/* node pool */
+
+static bool is_bootstrap(struct virt_ctx *ctx, struct virt_addr_node *node)
+{
+	return node >= ctx->bootstrap_nodes &&
+		   node < ctx->bootstrap_nodes + BOOTSTRAP_VIRT_ALLOC_NODES;
+}
+
+static void put_node(struct virt_ctx *ctx, struct virt_addr_node *node)
+{
+	node->left = ctx->free_nodes;
+	ctx->free_nodes = node;
+	ctx->free_node_count++;
+}
+
+static struct virt_addr_node *get_node(struct virt_ctx *ctx)
+{
+	struct virt_addr_node *node = ctx->free_nodes;
+
+	if (node == NULL)
+		panic("could not get virtaddr node");
+
+	ctx->free_nodes = node->left;
+	ctx->free_node_count--;
+	return node;
+}
+
+// grow the pool to count nodes, never while the tree is being changed,
+// as the pages for new nodes may be allocated in this same context
+static bool fill_nodes(struct virt_ctx *ctx, size_t count)
 {
-	if (idx < BOOTSTRAP_VIRT_ALLOC_NODES) {
-		return &ctx->bootstrap_nodes[idx];
-	} else {
-		return &ctx->alloc_nodes[idx - BOOTSTRAP_VIRT_ALLOC_NODES];
+	if (!node_cache_ready || ctx->is_allocating)
+		return ctx->free_node_count >= count;
+
+	ctx->is_allocating = true;
+	while (ctx->free_node_count < count) {
+		struct virt_addr_node *node = kcache_alloc(&node_cache);
+		if (node == NULL)
+			break;
+		put_node(ctx, node);
 	}
+	ctx->is_allocating = false;
+
+	return ctx->free_node_count >= count;
 }
 
-static void update_node_ptrs(struct virt_addr_node *old,
-							 struct virt_addr_node *new, int old_len,
-							 int new_len)
+/* avl tree */
+
+static uintptr_t free_len(const struct virt_addr_node *node)
 {
-	if (old == NULL)
-		return;
-	int idx = 0;
-	for (int i = 0; i < old_len; i++) {
-		struct virt_addr_node *o = &old[i];
-		if (o && !o->is_used)
-			continue;
-		struct virt_addr_node *n = &new[idx++];
-		*n = *o;
-		if (n->prev != NULL)
-			n->prev->next = n;
-		if (n->next != NULL)
-			n->next->prev = n;
+	return node->is_alloc ? 0 : node->end - node->start;
+}
+
+static uint8_t height(const struct virt_addr_node *node)
+{
+	return node ? node->height : 0;
+}
+
+static uintptr_t max_free(const struct virt_addr_node *node)
+{
+	return node ? node->max_free : 0;
+}
+
+static void update(struct virt_addr_node *node)
+{
+	node->height = MAX(height(node->left), height(node->right)) + 1;
+	node->max_free = MAX(free_len(node),
+						 MAX(max_free(node->left), max_free(node->right)));
+}
+
+static struct virt_addr_node *rotate_right(struct virt_addr_node *node)
+{
+	struct virt_addr_node *left = node->left;
+	node->left = left->right;
+	left->right = node;
+	update(node);
+	update(left);
+	return left;
+}
+
+static struct virt_addr_node *rotate_left(struct virt_addr_node *node)
+{
+	struct virt_addr_node *right = node->right;
+	node->right = right->left;
+	right->left = node;
+	update(node);
+	update(right);
+	return right;
+}
+
+static struct virt_addr_node *balance(struct virt_addr_node *node)
+{
+	int diff;
+
+	update(node);
+	diff = height(node->left) - height(node->right);
+
+	if (diff > 1) {
+		if (height(node->left->left) < height(node->left->right))
+			node->left = rotate_left(node->left);
+		return rotate_right(node);
 	}
-	for (int i = idx; i < new_len; i++) {
-		struct virt_addr_node *n = &new[idx++];
-		n->is_used = false;
+
+	if (diff < -1) {
+		if (height(node->right->right) < height(node->right->left))
+			node->right = rotate_right(node->right);
+		return rotate_left(node);
 	}
+
+	return node;
 }
 
-static struct virt_addr_node *get_node(struct virt_ctx *ctx)
+static struct virt_addr_node *tree_insert(struct virt_addr_node *root,
+										  struct virt_addr_node *node)
 {
-	size_t count = BOOTSTRAP_VIRT_ALLOC_NODES + ctx->alloc_node_count;
-
-	if (!ctx->is_allocating && ctx->used_node_count + 16 >= count) {
-		ctx->is_allocating = true;
-		int new_alloc = ctx->alloc_node_count * 2;
-		if (new_alloc < 8)
-			new_alloc = 8;
-		struct virt_addr_node *new_nodes;
-		new_nodes = kalloc(sizeof(struct virt_addr_node) * new_alloc);
-		if (new_nodes == NULL)
-			panic("virt addr alloc nodes is null");
-		update_node_ptrs(ctx->alloc_nodes, new_nodes, ctx->alloc_node_count,
-						 new_alloc);
-		kfree(ctx->alloc_nodes);
-		ctx->alloc_nodes = new_nodes;
-		ctx->alloc_node_count = new_alloc;
-		ctx->is_allocating = false;
-		count = BOOTSTRAP_VIRT_ALLOC_NODES + ctx->alloc_node_count;
+	if (root == NULL) {
+		node->left = NULL;
+		node->right = NULL;
+		update(node);
+		return node;
 	}
 
-	size_t idx = ctx->free_node_start;
-	for (; idx < count; idx++) {
-		struct virt_addr_node *node = get_node_idx(ctx, idx);
-		if (!node->is_used) {
-			node->is_used = true;
-			ctx->used_node_count++;
-			return node;
-		}
+	if (node->start < root->start)
+		root->left = tree_insert(root->left, node);
+	else
+		root->right = tree_insert(root->right, node);
+
+	return balance(root);
+}
+
+// unlink the lowest node of a subtree into *min
+static struct virt_addr_node *tree_remove_min(struct virt_addr_node *root,
+											  struct virt_addr_node **min)
+{
+	if (root->left == NULL) {
+		*min = root;
+		return root->right;
 	}
 
-	panic("could not get virtaddr node");
+	root->left = tree_remove_min(root->left, min);
+	return balance(root);
 }
 
-static void free_node(struct virt_ctx *ctx, struct virt_addr_node *node)
+// unlink the node starting at start into *out
+static struct virt_addr_node *tree_remove(struct virt_addr_node *root,
+										  uintptr_t start,
+										  struct virt_addr_node **out)
 {
-	node->is_used = false;
+	struct virt_addr_node *min;
+
+	if (root == NULL)
+		return NULL;
+
+	if (start < root->start) {
+		root->left = tree_remove(root->left, start, out);
+		return balance(root);
+	}
+
+	if (start > root->start) {
+		root->right = tree_remove(root->right, start, out);
+		return balance(root);
+	}
+
+	*out = root;
+	if (root->left == NULL)
+		return root->right;
+	if (root->right == NULL)
+		return root->left;
+
+	// the next node up takes this one's place
+	root->right = tree_remove_min(root->right, &min);
+	min->left = root->left;
+	min->right = root->right;
+	return balance(min);
+}
+
+// the node holding an address
+static struct virt_addr_node *tree_find(struct virt_addr_node *root,
+										uintptr_t addr)
+{
+	while (root != NULL) {
+		if (addr < root->start)
+			root = root->left;
+		else if (addr >= root->end)
+			root = root->right;
+		else
+			return root;
+	}
+
+	return NULL;
+}
+
+// replace the node starting at start with a new one
+static void ctx_remove(struct virt_ctx *ctx, uintptr_t start)
+{
+	struct virt_addr_node *node = NULL;
+
+	ctx->root = tree_remove(ctx->root, start, &node);
+	assert(node != NULL, "virtaddr node %p is not in the tree", (void *)start);
 	ctx->used_node_count--;
+	put_node(ctx, node);
 }
 
-void virtaddr_init(struct virt_ctx *ctx)
+static void ctx_insert(struct virt_ctx *ctx, uintptr_t start, uintptr_t end,
+					   bool is_alloc)
 {
-	struct virt_addr_node init = {
-		.start = 0x0,
-		.end = 0x1000000000000, // 48bit memory address max
-		.next = NULL,
-		.prev = NULL,
-		.is_alloc = false,
-		.is_used = true,
-	};
-	memset(ctx, 0, sizeof(struct virt_ctx));
-	ctx->bootstrap_nodes[0] = init;
-	ctx->alloc_nodes = NULL;
-	ctx->start_node = &ctx->bootstrap_nodes[0];
-	ctx->free_node_start = 0;
-	ctx->alloc_node_count = 0;
-	ctx->used_node_count = 0;
-	ctx->is_allocating = false;
+	struct virt_addr_node *node = get_node(ctx);
 
-	virtaddr_take(ctx, (void *)0,
-				  ((uint64_t)kernel_end + PAGE_SIZE - 1) / PAGE_SIZE *
-					  PAGE_SIZE);
+	node->start = start;
+	node->end = end;
+	node->is_alloc = is_alloc;
+	ctx->root = tree_insert(ctx->root, node);
+	ctx->used_node_count++;
 }
 
-int virtaddr_clone(struct virt_ctx *old, struct virt_ctx *new)
+static struct virt_addr_node *
+tree_clone(struct virt_ctx *ctx, const struct virt_addr_node *old)
 {
-	// copy over data
-	memcpy(new, old, sizeof(struct virt_ctx));
+	struct virt_addr_node *node;
 
-	// allocate new space
-	new->alloc_nodes =
-		kalloc(sizeof(struct virt_addr_node) * new->alloc_node_count);
-	if (new->alloc_nodes == NULL)
-		return 1;
+	if (old == NULL)
+		return NULL;
 
-	// update prev/next in new allocation space
-	update_node_ptrs(old->alloc_nodes, new->alloc_nodes, old->alloc_node_count,
-					 new->alloc_node_count);
+	node = get_node(ctx);
+	*node = *old;
+	node->left = tree_clone(ctx, old->left);
+	node->right = tree_clone(ctx, old->right);
+	return node;
+}
 
-	// update bootstrap nodes
-	for (size_t i = 0; i < new->used_node_count; i++) {
-		struct virt_addr_node *prev, *next;
+static void tree_cleanup(struct virt_ctx *ctx, struct virt_addr_node *node)
+{
+	if (node == NULL)
+		return;
 
-		if (i >= BOOTSTRAP_VIRT_ALLOC_NODES)
-			break;
+	tree_cleanup(ctx, node->left);
+	tree_cleanup(ctx, node->right);
+	if (!is_bootstrap(ctx, node))
+		kcache_free(&node_cache, node);
+}
 
-		// get prev
-		prev = i > 0 ? &new->bootstrap_nodes[i - 1] : NULL;
-		next = i < BOOTSTRAP_VIRT_ALLOC_NODES - 1 ?
-				   &new->bootstrap_nodes[i + 1] :
-				   NULL;
+/* allocator */
 
-		new->bootstrap_nodes[i].prev = prev;
-		new->bootstrap_nodes[i].next = next;
-	}
+void virtaddr_init(struct virt_ctx *ctx, uintptr_t start, uintptr_t end)
+{
+	memset(ctx, 0, sizeof(struct virt_ctx));
+	ctx->root = NULL;
+	ctx->free_nodes = NULL;
+	ctx->free_node_count = 0;
+	ctx->used_node_count = 0;
+	ctx->is_allocating = false;
 
-	// get starting node
-	new->start_node = &new->bootstrap_nodes[0]; // for now
+	for (size_t i = 0; i < BOOTSTRAP_VIRT_ALLOC_NODES; i++)
+		put_node(ctx, &ctx->bootstrap_nodes[i]);
 
-	return 0;
+	ctx_insert(ctx, start, end, false);
 }
 
-static void merge_back(struct virt_ctx *ctx, struct virt_addr_node *node)
+void virtaddr_cache_init(void)
 {
-	struct virt_addr_node *prev;
-	for (prev = node->prev; prev != NULL; prev = prev->prev) {
-		if (prev->is_alloc)
-			break;
-		node->start = prev->start;
-		node->prev = prev->prev;
-		if (node->prev)
-			node->prev->next = node;
-		free_node(ctx, prev);
-	}
-	if (node->prev == NULL)
-		ctx->start_node = node;
+	kcache_init(&node_cache, "virtaddr_node", sizeof(struct virt_addr_node),
+				_Alignof(struct virt_addr_node));
+	node_cache_ready = true;
 }
 
-static void merge_forward(struct virt_ctx *ctx, struct virt_addr_node *node)
+int virtaddr_clone(struct virt_ctx *old, struct virt_ctx *new)
 {
-	struct virt_addr_node *next;
-	for (next = node->next; next != NULL; next = next->next) {
-		if (next->is_alloc)
-			break;
-		node->end = next->end;
-		node->next = next->next;
-		if (node->next)
-			node->next->prev = node;
-		free_node(ctx, next);
+	memset(new, 0, sizeof(struct virt_ctx));
+	for (size_t i = 0; i < BOOTSTRAP_VIRT_ALLOC_NODES; i++)
+		put_node(new, &new->bootstrap_nodes[i]);
+
+	if (!fill_nodes(new, old->used_node_count + NODE_RESERVE)) {
+		virtaddr_cleanup(new);
+		return 1;
 	}
+
+	new->root = tree_clone(new, old->root);
+	new->used_node_count = old->used_node_count;
+
+	return 0;
 }
 
-void *virtaddr_alloc(struct virt_ctx *ctx, int n_pages)
+void *virtaddr_alloc(struct virt_ctx *ctx, long n_pages)
 {
+	uintptr_t n_length;
+	struct virt_addr_node *node;
+
 	if (n_pages < 1)
 		return NULL;
-	long n_length = n_pages * PAGE_SIZE;
-	struct virt_addr_node *node = ctx->start_node;
+	n_length = n_pages * PAGE_SIZE;
 
-	for (; node != NULL; node = node->next) {
-		long length = node->end - node->start;
-		if (node->is_alloc)
-			continue;
-
-		if (length < n_length)
-			continue;
+	// lowest node that is free and big enough
+	node = ctx->root;
+	if (max_free(node) < n_length)
+		return NULL;
 
-		return (void *)node->start;
+	while (node != NULL) {
+		if (max_free(node->left) >= n_length)
+			node = node->left;
+		else if (free_len(node) >= n_length)
+			return (void *)node->start;
+		else
+			node = node->right;
 	}
 
 	return NULL;
 }
 
-int virtaddr_take(struct virt_ctx *ctx, const void *virt, int n_pages)
+int virtaddr_take(struct virt_ctx *ctx, const void *virt, long n_pages)
 {
+	struct virt_addr_node *node;
+	uintptr_t start, end, node_start, node_end;
+
 	if (n_pages < 1)
 		return 0;
 
-	long n_length = n_pages * PAGE_SIZE;
-	struct virt_addr_node *node = ctx->start_node;
-
-	for (; node != NULL; node = node->next) {
-		if (node->is_alloc)
-			continue;
-
-		if (node->start > (uintptr_t)virt ||
-			node->end < (uintptr_t)virt + n_length)
-			continue;
-
-		// create new node on left
-		if (node->start < (uintptr_t)virt) {
-			struct virt_addr_node *left = get_node(ctx);
-			left->next = node;
-			left->prev = node->prev;
-			left->start = node->start;
-			left->end = (uintptr_t)virt;
-			left->is_alloc = false;
-			if (node->prev)
-				node->prev->next = left;
-			node->prev = left;
-		}
-
-		// create new node on right
-		if (node->end > (uintptr_t)virt + n_length) {
-			struct virt_addr_node *right = get_node(ctx);
-			right->prev = node;
-			right->next = node->next;
-			right->start = (uintptr_t)virt + n_length;
-			right->end = node->end;
-			right->is_alloc = false;
-			if (node->next)
-				node->next->prev = right;
-			node->next = right;
-		}
-
-		node->start = (uintptr_t)virt;
-		node->end = node->start + n_length;
-		node->is_alloc = true;
+	start = (uintptr_t)virt;
+	end = start + n_pages * PAGE_SIZE;
 
-		return 0;
-	}
+	node = tree_find(ctx->root, start);
+	if (node == NULL || node->is_alloc || node->end < end)
+		return 1;
+
+	node_start = node->start;
+	node_end = node->end;
 
-	return 1;
+	// split the free node around the new one
+	ctx_remove(ctx, node_start);
+	if (node_start < start)
+		ctx_insert(ctx, node_start, start, false);
+	ctx_insert(ctx, start, end, true);
+	if (node_end > end)
+		ctx_insert(ctx, end, node_end, false);
+
+	fill_nodes(ctx, NODE_RESERVE * 2);
+	return 0;
 }
 
 long virtaddr_free(struct virt_ctx *ctx, const void *virtaddr)
 {
+	struct virt_addr_node *node, *prev, *next;
+	uintptr_t virt, start, end;
+	long pages;
+
 	if (virtaddr == NULL)
 		return -1;
 
-	uintptr_t virt = (uintptr_t)virtaddr;
+	virt = (uintptr_t)virtaddr;
 
 	if (virt % PAGE_SIZE)
 		return -1; // not page aligned, we did not give this out!!!
 
-	struct virt_addr_node *node = ctx->start_node;
-
-	for (; node != NULL; node = node->next) {
-		if (node->start == virt) {
-			int length = node->end - node->start;
-			int pages = length / PAGE_SIZE;
-			node->is_alloc = false;
-			merge_back(ctx, node);
-			merge_forward(ctx, node);
-			return pages;
-		}
+	node = tree_find(ctx->root, virt);
+	if (node == NULL || node->start != virt || !node->is_alloc)
+		return -1;
+
+	start = node->start;
+	end = node->end;
+	pages = (end - start) / PAGE_SIZE;
+
+	// free nodes next to it merge into it
+	prev = virt > 0 ? tree_find(ctx->root, virt - 1) : NULL;
+	next = tree_find(ctx->root, end);
+
+	ctx_remove(ctx, start);
+	if (prev != NULL && !prev->is_alloc) {
+		start = prev->start;
+		ctx_remove(ctx, start);
+	}
+	if (next != NULL && !next->is_alloc) {
+		uintptr_t next_start = next->start;
+		end = next->end;
+		ctx_remove(ctx, next_start);
 	}
+	ctx_insert(ctx, start, end, false);
 
-	return -1;
+	return pages;
 }
 
 void virtaddr_cleanup(struct virt_ctx *ctx)
 {
-	kfree(ctx->alloc_nodes);
+	struct virt_addr_node *node;
+
+	tree_cleanup(ctx, ctx->root);
+	ctx->root = NULL;
+
+	while (ctx->free_nodes != NULL) {
+		node = get_node(ctx);
+		if (!is_bootstrap(ctx, node))
+			kcache_free(&node_cache, node);
+	}
 }
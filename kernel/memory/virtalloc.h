@@ -13,35 +13,35 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define BOOTSTRAP_VIRT_ALLOC_NODES 256
+#define BOOTSTRAP_VIRT_ALLOC_NODES 32
 
 struct virt_addr_node {
 	/// first virtural address
 	uintptr_t start;
-	/// last virtural address
+	/// address after the last virtural address
 	uintptr_t end;
-	/// next node in linked list
-	struct virt_addr_node *next;
-	/// prev node in linked list
-	struct virt_addr_node *prev;
+	/// nodes with lower addresses, or the next node in the free pool
+	struct virt_addr_node *left;
+	/// nodes with higher addresses
+	struct virt_addr_node *right;
+	/// length of the largest free node in this subtree
+	uintptr_t max_free;
+	/// height of this subtree
+	uint8_t height;
 	/// if this node is storing any allocated data
 	uint8_t is_alloc;
-	/// if this node is in use by virtalloc
-	uint8_t is_used;
 };
 
 struct virt_ctx {
 	/// bootstrap nodes for the context (not in heap)
 	struct virt_addr_node bootstrap_nodes[BOOTSTRAP_VIRT_ALLOC_NODES];
-	/// heap allocated nodes
-	struct virt_addr_node *alloc_nodes;
-	/// start node
-	struct virt_addr_node *start_node;
-	/// index of first free node
-	size_t free_node_start;
-	/// number of heap allocated nodes
-	size_t alloc_node_count;
-	/// number of used nodes
+	/// avl tree of nodes, covering the whole address range
+	struct virt_addr_node *root;
+	/// nodes ready to be put in the tree
+	struct virt_addr_node *free_nodes;
+	/// number of nodes in free_nodes
+	size_t free_node_count;
+	/// number of nodes in the tree
 	size_t used_node_count;
 	/// if we are currently allocating (recursion check)
 	bool is_allocating;
@@ -49,8 +49,16 @@ struct virt_ctx {
 
 /**
  * Initalizes the virtual address allocator
+ * @param start - the first address it may hand out
+ * @param end - the address after the last one it may hand out
  */
-void virtaddr_init(struct virt_ctx *ctx);
+void virtaddr_init(struct virt_ctx *ctx, uintptr_t start, uintptr_t end);
+
+/**
+ * Lets contexts grow past their bootstrap nodes, called once the
+ * physical page allocator is ready
+ */
+void virtaddr_cache_init(void);
 
 /**
  * Clone the virtual address allocator
@@ -58,11 +66,12 @@ void virtaddr_init(struct virt_ctx *ctx);
 int virtaddr_clone(struct virt_ctx *old, struct virt_ctx *new);
 
 /**
- * Allocate a virtual address of length x pages
+ * Find the lowest free virtual address of length x pages, it must still
+ * be taken with virtaddr_take
  * @param pages - x pages
  * @returns virt addr
  */
-void *virtaddr_alloc(struct virt_ctx *ctx, int pages);
+void *virtaddr_alloc(struct virt_ctx *ctx, long pages);
 
 /**
  * Take (yoink) a predefined virtual address of length x pages
@@ -70,7 +79,7 @@ void *virtaddr_alloc(struct virt_ctx *ctx, int pages);
  * @param pages - x pages
  * @returns 0 on success, 1 on err
  */
-int virtaddr_take(struct virt_ctx *ctx, const void *virt, int pages);
+int virtaddr_take(struct virt_ctx *ctx, const void *virt, long pages);
 
 /**
  * Free the virtual address from virtaddr_alloc
@@ -1,42 +1,88 @@
-#include <comus/drivers/pit.h>
 #include <comus/syscalls.h>
 #include <comus/memory.h>
 #include <comus/procs.h>
 #include <comus/error.h>
 #include <comus/cpu.h>
 #include <comus/asm.h>
+#include <comus/tick.h>
+#include <comus/fpu.h>
 
 #define PCB_QUEUE_EMPTY(q) ((q)->head == NULL)
 
-struct pcb_queue_s {
-	struct pcb *head;
-	struct pcb *tail;
-	enum pcb_queue_order order;
+/// ms given to a process on the highest priority level, each
+/// level below it doubles the slice length
+#define MLFQ_SLICE_BASE 2
+#define MLFQ_SLICE(level) (((uint64_t)MLFQ_SLICE_BASE << (level)) * NS_PER_MS)
+
+/// how often (in ms) every process is boosted back to its base level
+#define MLFQ_BOOST_MS 1000
+
+/// number of pid hash buckets, independent of the process limit
+#define N_PID_HASH 1024
+
+/// bucket of the pid hash a pid is in
+#define PID_HASH(pid) ((pid) % N_PID_HASH)
+
+/// number of wait queues pcb_wait hashes keys into
+#define N_WAIT_HASH 256
+
+/// wait queue a key is in, keys are usually word aligned addresses
+#define WAIT_HASH(key) (((key) >> 2) % N_WAIT_HASH)
+
+_Static_assert(N_PRIO_LEVELS > 0 && N_PRIO_LEVELS <= 64,
+			   "run queue bitmap only supports up to 64 levels");
+_Static_assert(N_PIDS % 64 == 0 && N_PIDS <= 65536,
+			   "pid bitmap needs whole words of pids that fit in pid_t");
+_Static_assert(N_PROCS < N_PIDS, "every process needs its own pid");
+_Static_assert(offsetof(struct pcb, regs) == 8, "offset is used by idt.S");
+
+struct run_queue_s {
+	// bit n is set if levels[n] is not empty
+	uint64_t bitmap;
+	// one fifo queue per priority level
+	struct pcb_queue_s levels[N_PRIO_LEVELS];
+	// number of pcbs in all levels
+	size_t count;
 };
 
 // collection of queues
-static struct pcb_queue_s _pcb_freelist;
-static struct pcb_queue_s _ready_queue;
-static struct pcb_queue_s _zombie_queue;
+static struct run_queue_s _ready_queues[N_CPUS];
 static struct pcb_queue_s _syscall_queue[N_SYSCALLS];
+static struct pcb_queue_s wait_queues[N_WAIT_HASH];
 
 // public facing queue handels
-pcb_queue_t pcb_freelist;
-pcb_queue_t ready_queue;
-pcb_queue_t zombie_queue;
+run_queue_t ready_queues[N_CPUS];
 pcb_queue_t syscall_queue[N_SYSCALLS];
 
-/// pointer to the currently-running process
-struct pcb *current_pcb = NULL;
-
 /// pointer to the pcb for the 'init' process
 struct pcb *init_pcb = NULL;
 
-/// the process table
-struct pcb ptable[N_PROCS];
+/// pcbs are allocated from here
+static struct kcache pcb_cache;
 
-/// next avaliable pid
-pid_t next_pid = 1;
+/// max number of allocated pcbs
+static size_t pcb_max = N_PROCS;
+
+/// bit n is set if pid n is in use
+static uint64_t pid_bitmap[N_PIDS / 64];
+
+/// last pid handed out, the search for the next one starts after it
+static pid_t last_pid = 0;
+
+/// allocated pcbs, chained through hash_next
+static struct pcb *pid_hash[N_PID_HASH];
+
+/// incremented on every priority boost
+static uint64_t boost_epoch = 0;
+
+/// fires every priority boost
+static struct timer boost_timer;
+
+// the highest level a process is allowed to run at
+static size_t base_level(struct pcb *pcb)
+{
+	return MIN(pcb->priority, (size_t)(N_PRIO_LEVELS - 1));
+}
 
 static struct pcb *find_prev_wakeup(pcb_queue_t queue, struct pcb *pcb)
 {
@@ -83,6 +129,107 @@ static struct pcb *find_prev_pid(pcb_queue_t queue, struct pcb *pcb)
 	return prev;
 }
 
+// hand out the next unused pid after the last one, wrapping around
+static pid_t pid_alloc(void)
+{
+	size_t start = ((size_t)last_pid + 1) % N_PIDS;
+	size_t word = start / 64;
+	uint64_t mask = ~0ULL << (start % 64);
+
+	// one extra word to get the pids before start in its word
+	for (size_t i = 0; i <= N_PIDS / 64; i++) {
+		uint64_t free = ~pid_bitmap[word] & mask;
+		if (free) {
+			size_t pid = word * 64 + __builtin_ctzll(free);
+			pid_bitmap[word] |= 1ULL << (pid % 64);
+			last_pid = pid;
+			return pid;
+		}
+		word = (word + 1) % (N_PIDS / 64);
+		mask = ~0ULL;
+	}
+
+	panic("pid_alloc: out of pids");
+}
+
+static void pid_free(pid_t pid)
+{
+	pid_bitmap[pid / 64] &= ~(1ULL << (pid % 64));
+}
+
+static void pid_hash_insert(struct pcb *pcb)
+{
+	struct pcb **bucket = &pid_hash[PID_HASH(pcb->pid)];
+	pcb->hash_next = *bucket;
+	*bucket = pcb;
+}
+
+static void pid_hash_remove(struct pcb *pcb)
+{
+	struct pcb **link = &pid_hash[PID_HASH(pcb->pid)];
+	while (*link != pcb) {
+		assert(*link != NULL, "pid_hash_remove: pcb not in hash");
+		link = &(*link)->hash_next;
+	}
+	*link = pcb->hash_next;
+	pcb->hash_next = NULL;
+}
+
+// finish the waitpid a parent is blocked in,
+// if one of its zombie children satisfies it
+static void pcb_reap(struct pcb *parent)
+{
+	struct pcb *zombie;
+	pid_t pid;
+	int *status;
+
+	if (parent->queue != syscall_queue[SYS_waitpid])
+		return;
+
+	pid = (pid_t)PCB_ARG1(parent);
+	status = (int *)PCB_ARG2(parent);
+
+	zombie = pcb_find_zombie(parent, pid);
+	if (zombie == NULL)
+		return;
+
+	assert(pcb_queue_remove(syscall_queue[SYS_waitpid], parent) == SUCCESS,
+		   "pcb_reap: cannot remove parent process from waitpid queue");
+
+	// set exited pid and exist status in the parent's waitpid call
+	PCB_RET(parent) = zombie->pid;
+	// a bad pointer only loses the status
+	if (status != NULL)
+		copy_to_user(parent->memctx, status, &zombie->exit_status,
+					 sizeof(int));
+
+	schedule(parent);
+	pcb_cleanup(zombie);
+}
+
+// timer callback for sleeping processes, and
+// ones in pcb_wait that timed out
+static void pcb_wakeup(struct timer *timer)
+{
+	struct pcb *pcb = timer->data;
+
+	if (pcb->queue != NULL)
+		assert(pcb_queue_remove(pcb->queue, pcb) == SUCCESS,
+			   "pcb_wakeup: cannot remove process from its wait queue");
+	schedule(pcb);
+}
+
+// timer callback that periodically moves everyone back
+// up so cpu bound processes cannot starve forever
+static void pcb_boost(struct timer *timer)
+{
+	boost_epoch++;
+	for (size_t i = 0; i < N_CPUS; i++)
+		run_queue_boost(ready_queues[i]);
+
+	timer_arm(timer, timer->expires + MLFQ_BOOST_MS * NS_PER_MS);
+}
+
 // a macro to simplify queue setup
 #define QINIT(q, s)                         \
 	q = &_##q;                              \
@@ -96,33 +243,57 @@ void pcb_init(void)
 	current_pcb = NULL;
 
 	// set up the external links to the queues
-	QINIT(pcb_freelist, O_PCB_FIFO);
-	QINIT(ready_queue, O_PCB_PRIO);
-	QINIT(zombie_queue, O_PCB_PID);
 	for (size_t i = 0; i < N_SYSCALLS; i++) {
 		QINIT(syscall_queue[i], O_PCB_PID);
 	}
-
-	// setup pcb linked list (free list)
-	// this can be done by calling pcb_free :)
-	struct pcb *ptr = ptable;
-	for (int i = 0; i < N_PROCS; ++i) {
-		pcb_free(ptr);
-		++ptr;
+	for (size_t i = 0; i < N_WAIT_HASH; i++) {
+		if (pcb_queue_reset(&wait_queues[i], O_PCB_FIFO) != SUCCESS)
+			panic("pcb_init can't reset wait_queues");
 	}
+	for (size_t i = 0; i < N_CPUS; i++) {
+		ready_queues[i] = &_ready_queues[i];
+		run_queue_reset(ready_queues[i]);
+	}
+
+	// pcbs are allocated as processes are created
+	kcache_init(&pcb_cache, "pcb", sizeof(struct pcb),
+				_Alignof(struct pcb));
+
+	// pid 0 is never handed out
+	pid_bitmap[0] |= 1;
+
+	timer_init(&boost_timer, pcb_boost, NULL);
+	timer_arm(&boost_timer, clock_ns() + MLFQ_BOOST_MS * NS_PER_MS);
 }
 
 int pcb_alloc(struct pcb **pcb)
 {
 	assert(pcb != NULL, "pcb_alloc: allocating a non free pcb pointer");
 
-	// remove the first PCB from the free list
 	struct pcb *tmp;
-	if (pcb_queue_pop(pcb_freelist, &tmp) != SUCCESS)
+	if (pcb_cache.used >= pcb_max)
 		return E_NO_PCBS;
 
-	tmp->pid = next_pid++;
+	tmp = kcache_alloc(&pcb_cache);
+	if (tmp == NULL)
+		return E_NO_MEMORY;
+
+	memset(tmp, 0, sizeof(struct pcb));
+	tmp->pid = pid_alloc();
+	pid_hash_insert(tmp);
+	tmp->parent = NULL;
+	tmp->children = NULL;
+	tmp->sibling_next = NULL;
+	tmp->sibling_prev = NULL;
+	pcb_queue_reset(&tmp->zombies, O_PCB_FIFO);
 	tmp->state = PROC_STATE_NEW;
+	tmp->level = 0;
+	tmp->slice = 0;
+	tmp->epoch = boost_epoch;
+	tmp->cpu = cpu_id();
+	tmp->killed = false;
+	tmp->fpu_cpu = UINT32_MAX;
+	timer_init(&tmp->timer, pcb_wakeup, tmp);
 	*pcb = tmp;
 	return SUCCESS;
 }
@@ -130,19 +301,42 @@ int pcb_alloc(struct pcb **pcb)
 void pcb_free(struct pcb *pcb)
 {
 	if (pcb != NULL) {
-		// mark the PCB as available
-		pcb->state = PROC_STATE_UNUSED;
+		// leave the process tree, and give back the pid
+		pcb_set_parent(pcb, NULL);
+		if (pcb->pid != 0) {
+			pid_hash_remove(pcb);
+			pid_free(pcb->pid);
+			pcb->pid = 0;
+		}
 
-		// add it to the free list
-		int status = pcb_queue_insert(pcb_freelist, pcb);
+		// a queue would be left pointing at freed memory
+		if (pcb->queue != NULL)
+			panic("pcb_free(%16p) pcb is still queued", (void *)pcb);
 
-		// if that failed, we're in trouble
-		if (status != SUCCESS) {
-			panic("pcb_free(%16p) status %d", (void *)pcb, status);
-		}
+		// give it back to the cache
+		fpu_release(pcb);
+		pcb->state = PROC_STATE_UNUSED;
+		kcache_free(&pcb_cache, pcb);
 	}
 }
 
+size_t pcb_limit(void)
+{
+	return pcb_max;
+}
+
+int pcb_set_limit(size_t max)
+{
+	// every process needs its own pid, and pid 0 is never used
+	if (max < 1 || max >= N_PIDS)
+		return E_BAD_PARAM;
+
+	// processes over the new limit keep running,
+	// no more can be created until enough have exited
+	pcb_max = max;
+	return SUCCESS;
+}
+
 void pcb_zombify(struct pcb *victim)
 {
 	if (victim == NULL)
@@ -153,91 +347,21 @@ void pcb_zombify(struct pcb *victim)
 	assert(victim->parent != NULL, "pcb_zombify: process missing a parent");
 
 	struct pcb *parent = victim->parent;
-	struct pcb *zchild = NULL;
-	struct pcb *curr = ptable;
+	struct pcb *child;
 
-	// find all children of victim and reparent
-	for (int i = 0; i < N_PROCS; ++i, ++curr) {
-		// is this a valid entry?
-		if (curr->state == PROC_STATE_UNUSED)
-			continue;
-
-		// is this not our child?
-		if (curr->parent != victim)
-			continue;
-
-		// reparent to init
-		curr->parent = init_pcb;
-
-		// if this child is a zombie
-		if (curr->state == PROC_STATE_ZOMBIE) {
-			// if it's already a zombie, remember it, so we
-			// can pass it on to 'init'; also, if there are
-			// two or more zombie children, it doesn't matter
-			// which one we pick here, as the others will be
-			// collected when 'init' loops
-			zchild = curr;
-		}
-	}
-
-	// schedule init if zombie child found
-	if (zchild != NULL && init_pcb->syscall == SYS_waitpid) {
-		pid_t pid;
-		int *status;
-
-		assert(pcb_queue_remove(zombie_queue, zchild) == SUCCESS,
-			   "pcb_zombify: cannot remove zombie process from queue");
-		assert(pcb_queue_remove(syscall_queue[SYS_waitpid], init_pcb) ==
-				   SUCCESS,
-			   "pcb_zombify: cannot remove waiting process from queue");
-
-		pid = (pid_t)PCB_ARG1(init_pcb);
-		status = (int *)PCB_ARG2(init_pcb);
-
-		// set exited pid and exist status in init's waitpid call
-		if (pid == 0 || pid == zchild->pid) {
-			PCB_RET(init_pcb) = zchild->pid;
-			if (status != NULL) {
-				mem_ctx_switch(init_pcb->memctx);
-				*status = zchild->exit_status;
-				mem_ctx_switch(kernel_mem_ctx);
-			}
-			schedule(init_pcb);
-		}
-
-		pcb_cleanup(zchild);
-	}
-
-	// if the parent is waiting, wake it up and clean the victim,
-	// otherwise the victim will become a zombie
-	if (parent->syscall == SYS_waitpid) {
-		pid_t pid;
-		int *status;
-
-		pid = (pid_t)PCB_ARG1(parent);
-		status = (int *)PCB_ARG2(parent);
-
-		if (pid == 0 || pid == victim->pid) {
-			PCB_RET(parent) = victim->pid;
-
-			assert(
-				pcb_queue_remove(syscall_queue[SYS_waitpid], parent) == SUCCESS,
-				"pcb_zombify: cannot remove parent process from waitpid queue");
-
-			if (status != NULL) {
-				mem_ctx_switch(parent->memctx);
-				*status = victim->exit_status;
-				mem_ctx_switch(kernel_mem_ctx);
-			}
-			schedule(parent);
-			pcb_cleanup(victim);
-			return;
-		}
-	}
+	// reparent all children of victim to init, zombie children
+	// move to init's zombies and are collected when 'init' loops
+	while ((child = victim->children) != NULL)
+		pcb_set_parent(child, init_pcb);
+	pcb_reap(init_pcb);
 
 	victim->state = PROC_STATE_ZOMBIE;
-	assert(pcb_queue_insert(zombie_queue, victim) == SUCCESS,
+	assert(pcb_queue_insert(&parent->zombies, victim) == SUCCESS,
 		   "cannot insert victim process into zombie queue");
+
+	// if the parent is waiting, wake it up and clean the victim,
+	// otherwise the victim stays a zombie
+	pcb_reap(parent);
 }
 
 void pcb_cleanup(struct pcb *pcb)
@@ -254,31 +378,117 @@ struct pcb *pcb_find_pid(pid_t pid)
 	if (pid < 1)
 		return NULL;
 
-	struct pcb *p = ptable;
-	for (int i = 0; i < N_PROCS; ++i, ++p) {
-		if (p->pid == pid && p->state != PROC_STATE_UNUSED) {
-			return p;
-		}
-	}
+	struct pcb *p = pid_hash[PID_HASH(pid)];
+	while (p != NULL && p->pid != pid)
+		p = p->hash_next;
 
-	return NULL;
+	return p;
 }
 
 struct pcb *pcb_find_ppid(pid_t pid)
 {
-	if (pid < 1)
+	struct pcb *parent = pcb_find_pid(pid);
+	if (parent == NULL)
 		return NULL;
+	return parent->children;
+}
 
-	struct pcb *p = ptable;
-	for (int i = 0; i < N_PROCS; ++i, ++p) {
-		assert(p->parent != NULL,
-			   "pcb_find_ppid: process does not have a parent");
-		if (p->parent->pid == pid && p->parent->state != PROC_STATE_UNUSED) {
-			return p;
-		}
+struct pcb *pcb_find_zombie(struct pcb *parent, pid_t pid)
+{
+	struct pcb *child;
+
+	assert(parent != NULL, "pcb_find_zombie: parent is null");
+
+	if (pid == 0)
+		return pcb_queue_peek(&parent->zombies);
+
+	child = pcb_find_pid(pid);
+	if (child == NULL || child->parent != parent ||
+		child->state != PROC_STATE_ZOMBIE)
+		return NULL;
+
+	return child;
+}
+
+void pcb_set_parent(struct pcb *pcb, struct pcb *parent)
+{
+	struct pcb *old;
+	bool zombie;
+
+	assert(pcb != NULL, "pcb_set_parent: pcb is null");
+
+	old = pcb->parent;
+	zombie = pcb->state == PROC_STATE_ZOMBIE;
+
+	// unlink from the old parent's children
+	if (old != NULL) {
+		if (pcb->sibling_prev != NULL)
+			pcb->sibling_prev->sibling_next = pcb->sibling_next;
+		else
+			old->children = pcb->sibling_next;
+		if (pcb->sibling_next != NULL)
+			pcb->sibling_next->sibling_prev = pcb->sibling_prev;
+		if (zombie)
+			assert(pcb_queue_remove(&old->zombies, pcb) == SUCCESS,
+				   "pcb_set_parent: cannot remove zombie from old parent");
+	}
+
+	pcb->parent = parent;
+	pcb->sibling_prev = NULL;
+	pcb->sibling_next = NULL;
+
+	// link to the front of the new parent's children
+	if (parent != NULL) {
+		pcb->sibling_next = parent->children;
+		if (parent->children != NULL)
+			parent->children->sibling_prev = pcb;
+		parent->children = pcb;
+		if (zombie)
+			assert(pcb_queue_insert(&parent->zombies, pcb) == SUCCESS,
+				   "pcb_set_parent: cannot insert zombie into new parent");
 	}
+}
+
+void pcb_wait(struct pcb *pcb, uint64_t key, uint64_t timeout)
+{
+	assert(pcb != NULL, "pcb_wait: pcb is null");
+
+	pcb->wait_key = key;
+	pcb->state = PROC_STATE_BLOCKED;
+
+	// left alone if the timer wakes it up
+	PCB_RET(pcb) = (uint64_t)E_TIMEOUT;
+
+	assert(pcb_queue_insert(&wait_queues[WAIT_HASH(key)], pcb) == SUCCESS,
+		   "pcb_wait: cannot add process to wait queue");
 
-	return NULL;
+	if (timeout != 0) {
+		pcb->wakeup = timeout;
+		timer_arm(&pcb->timer, timeout);
+	}
+}
+
+size_t pcb_wake(uint64_t key, size_t n)
+{
+	pcb_queue_t queue = &wait_queues[WAIT_HASH(key)];
+	struct pcb *pcb, *next;
+	size_t woken = 0;
+
+	// other keys can hash to the same queue
+	for (pcb = queue->head; pcb != NULL && woken < n; pcb = next) {
+		next = pcb->next;
+		if (pcb->wait_key != key)
+			continue;
+
+		assert(pcb_queue_remove(queue, pcb) == SUCCESS,
+			   "pcb_wake: cannot remove process from wait queue");
+		timer_cancel(&pcb->timer);
+		PCB_RET(pcb) = SUCCESS;
+		schedule(pcb);
+		woken++;
+	}
+
+	return woken;
 }
 
 int pcb_queue_reset(pcb_queue_t queue, enum pcb_queue_order style)
@@ -318,53 +528,51 @@ int pcb_queue_insert(pcb_queue_t queue, struct pcb *pcb)
 	assert(queue != NULL, "pcb_queue_insert: queue is null");
 	assert(pcb != NULL, "pcb_queue_insert: pcb is null");
 
-	if (pcb->next != NULL)
+	// already in a queue
+	if (pcb->queue != NULL)
 		return E_BAD_PARAM;
 
-	if (queue->head == NULL) {
-		queue->head = queue->tail = pcb;
-		return SUCCESS;
-	}
-	assert(queue->tail != NULL, "pcb_queue_insert: queue tail is null");
-
 	struct pcb *prev = NULL;
-	switch (queue->order) {
-	case O_PCB_FIFO:
-		prev = queue->tail;
-		break;
-	case O_PCB_PRIO:
-		prev = find_prev_priority(queue, pcb);
-		break;
-	case O_PCB_PID:
-		prev = find_prev_pid(queue, pcb);
-		break;
-	case O_PCB_WAKEUP:
-		prev = find_prev_wakeup(queue, pcb);
-		break;
-	default:
-		return E_BAD_PARAM;
+	if (queue->head != NULL) {
+		assert(queue->tail != NULL, "pcb_queue_insert: queue tail is null");
+
+		switch (queue->order) {
+		case O_PCB_FIFO:
+			prev = queue->tail;
+			break;
+		case O_PCB_PRIO:
+			prev = find_prev_priority(queue, pcb);
+			break;
+		case O_PCB_PID:
+			prev = find_prev_pid(queue, pcb);
+			break;
+		case O_PCB_WAKEUP:
+			prev = find_prev_wakeup(queue, pcb);
+			break;
+		default:
+			return E_BAD_PARAM;
+		}
 	}
 
 	// found the predecessor node, time to do the insertion
+	pcb->prev = prev;
 	if (prev == NULL) {
 		// there is no predecessor, so we're
 		// inserting at the front of the queue
 		pcb->next = queue->head;
-		if (queue->head == NULL) {
-			// empty queue!?! - should we panic?
-			queue->tail = pcb;
-		}
 		queue->head = pcb;
-	} else if (prev->next == NULL) {
-		// append at end
-		prev->next = pcb;
-		queue->tail = pcb;
 	} else {
 		// insert between prev & prev->next
 		pcb->next = prev->next;
 		prev->next = pcb;
 	}
 
+	if (pcb->next == NULL)
+		queue->tail = pcb;
+	else
+		pcb->next->prev = pcb;
+
+	pcb->queue = queue;
 	return SUCCESS;
 }
 
@@ -378,11 +586,15 @@ int pcb_queue_pop(pcb_queue_t queue, struct pcb **pcb)
 
 	struct pcb *tmp = queue->head;
 	queue->head = tmp->next;
-	tmp->next = NULL;
 	if (queue->head == NULL) {
 		queue->tail = NULL;
+	} else {
+		queue->head->prev = NULL;
 	}
 
+	tmp->next = NULL;
+	tmp->prev = NULL;
+	tmp->queue = NULL;
 	*pcb = tmp;
 	return SUCCESS;
 }
@@ -395,50 +607,26 @@ int pcb_queue_remove(pcb_queue_t queue, struct pcb *pcb)
 	if (PCB_QUEUE_EMPTY(queue))
 		return E_EMPTY_QUEUE;
 
-	struct pcb *prev = NULL;
-	struct pcb *curr = queue->head;
-	while (curr != NULL && curr != pcb) {
-		prev = curr;
-		curr = curr->next;
-	}
-
-	// case  prev  curr  next   interpretation
-	// ====  ====  ====  ====   ============================
-	//   1.    0     0    --    *** CANNOT HAPPEN ***
-	//   2.    0    !0     0    removing only element
-	//   3.    0    !0    !0    removing first element
-	//   4.   !0     0    --    *** NOT FOUND ***
-	//   5.   !0    !0     0    removing from end
-	//   6.   !0    !0    !0    removing from middle
-
-	if (curr == NULL) {
-		// case 1
-		assert(prev != NULL, "pcb_queue_remove: prev element in queue is null");
-		// case 4
+	// the pcb knows which queue it is in, so
+	// there is no need to search for it
+	if (pcb->queue != queue)
 		return E_NOT_FOUND;
-	}
 
 	// connect predecessor to successor
-	if (prev != NULL) {
-		// not the first element
-		// cases 5 and 6
-		prev->next = curr->next;
-	} else {
-		// removing first element
-		// cases 2 and 3
-		queue->head = curr->next;
-	}
+	if (pcb->prev != NULL)
+		pcb->prev->next = pcb->next;
+	else
+		queue->head = pcb->next;
 
-	// if this was the last node (cases 2 and 5),
-	// also need to reset the tail pointer
-	if (curr->next == NULL) {
-		// if this was the only entry (2), prev is NULL,
-		// so this works for that case, too
-		queue->tail = prev;
-	}
+	if (pcb->next != NULL)
+		pcb->next->prev = pcb->prev;
+	else
+		queue->tail = pcb->prev;
 
 	// unlink current from queue
-	curr->next = NULL;
+	pcb->next = NULL;
+	pcb->prev = NULL;
+	pcb->queue = NULL;
 
 	// there's a possible consistancy problem here if somehow
 	// one of the queue pointers is NULL and the other one
@@ -460,6 +648,113 @@ struct pcb *pcb_queue_peek(const pcb_queue_t queue)
 	return queue->head;
 }
 
+void run_queue_reset(run_queue_t rq)
+{
+	assert(rq != NULL, "run_queue_reset: run queue is null");
+
+	rq->bitmap = 0;
+	rq->count = 0;
+	for (size_t i = 0; i < N_PRIO_LEVELS; i++)
+		pcb_queue_reset(&rq->levels[i], O_PCB_FIFO);
+}
+
+size_t run_queue_length(const run_queue_t rq)
+{
+	assert(rq != NULL, "run_queue_length: run queue is null");
+	return rq->count;
+}
+
+int run_queue_insert(run_queue_t rq, struct pcb *pcb)
+{
+	int status;
+
+	assert(rq != NULL, "run_queue_insert: run queue is null");
+	assert(pcb != NULL, "run_queue_insert: pcb is null");
+
+	if (pcb->level >= N_PRIO_LEVELS)
+		return E_BAD_PARAM;
+
+	status = pcb_queue_insert(&rq->levels[pcb->level], pcb);
+	if (status != SUCCESS)
+		return status;
+
+	rq->bitmap |= 1ULL << pcb->level;
+	rq->count++;
+	return SUCCESS;
+}
+
+int run_queue_pop(run_queue_t rq, struct pcb **pcb)
+{
+	pcb_queue_t level;
+	int status;
+
+	assert(rq != NULL, "run_queue_pop: run queue is null");
+	assert(pcb != NULL, "run_queue_pop: pcb is null");
+
+	if (rq->bitmap == 0)
+		return E_EMPTY_QUEUE;
+
+	// lowest set bit is the highest priority non empty level
+	level = &rq->levels[__builtin_ctzll(rq->bitmap)];
+	status = pcb_queue_pop(level, pcb);
+	if (status != SUCCESS)
+		return status;
+
+	if (PCB_QUEUE_EMPTY(level))
+		rq->bitmap &= ~(1ULL << (level - rq->levels));
+	rq->count--;
+	return SUCCESS;
+}
+
+int run_queue_remove(run_queue_t rq, struct pcb *pcb)
+{
+	pcb_queue_t level;
+	int status;
+
+	assert(rq != NULL, "run_queue_remove: run queue is null");
+	assert(pcb != NULL, "run_queue_remove: pcb is null");
+
+	if (pcb->level >= N_PRIO_LEVELS)
+		return E_BAD_PARAM;
+
+	level = &rq->levels[pcb->level];
+	status = pcb_queue_remove(level, pcb);
+	if (status != SUCCESS)
+		return status;
+
+	if (PCB_QUEUE_EMPTY(level))
+		rq->bitmap &= ~(1ULL << pcb->level);
+	rq->count--;
+	return SUCCESS;
+}
+
+void run_queue_boost(run_queue_t rq)
+{
+	struct pcb_queue_s drained;
+	struct pcb *pcb;
+
+	assert(rq != NULL, "run_queue_boost: run queue is null");
+
+	// nothing can be moved up from the top level
+	if ((rq->bitmap & ~1ULL) == 0)
+		return;
+
+	pcb_queue_reset(&drained, O_PCB_FIFO);
+
+	// drain in priority order so each level stays fifo
+	while (run_queue_pop(rq, &pcb) == SUCCESS) {
+		pcb->level = base_level(pcb);
+		pcb->slice = 0;
+		pcb->epoch = boost_epoch;
+		if (pcb_queue_insert(&drained, pcb) != SUCCESS)
+			panic("run_queue_boost: insert fail");
+	}
+
+	while (pcb_queue_pop(&drained, &pcb) == SUCCESS)
+		if (run_queue_insert(rq, pcb) != SUCCESS)
+			panic("run_queue_boost: insert fail");
+}
+
 void schedule(struct pcb *pcb)
 {
 	assert(pcb != NULL, "schedule: pcb is null");
@@ -471,66 +766,135 @@ void schedule(struct pcb *pcb)
 	pcb->state = PROC_STATE_READY;
 	pcb->syscall = 0;
 
-	if (pcb_queue_insert(ready_queue, pcb) != SUCCESS)
+	// processes that were blocked during a boost get it on wakeup
+	if (pcb->epoch != boost_epoch) {
+		pcb->epoch = boost_epoch;
+		pcb->level = 0;
+		pcb->slice = 0;
+	}
+
+	// never run above the priority set by the process
+	if (pcb->level < base_level(pcb)) {
+		pcb->level = base_level(pcb);
+		pcb->slice = 0;
+	}
+
+	// stay on the cpu it last ran on, idle cpus steal it if needed
+	if (run_queue_insert(ready_queues[pcb->cpu], pcb) != SUCCESS)
 		panic("schedule insert fail");
+
+	cpu_wake_idle();
+}
+
+// take a process from the cpu with the most queued work
+static int pcb_steal(struct pcb **pcb)
+{
+	run_queue_t busiest = NULL;
+	size_t most = 0;
+
+	for (uint32_t i = 0; i < cpu_count(); i++) {
+		size_t len;
+		if (i == cpu_id())
+			continue;
+		len = run_queue_length(ready_queues[i]);
+		if (len > most) {
+			most = len;
+			busiest = ready_queues[i];
+		}
+	}
+
+	if (busiest == NULL)
+		return E_EMPTY_QUEUE;
+
+	return run_queue_pop(busiest, pcb);
 }
 
 __attribute__((noreturn)) void dispatch(void)
 {
+	uint32_t depth;
 	int status;
 
+	// interrupts stay off in the kernel outside the idle loop
+	cli();
+
 	assert(current_pcb == NULL, "dispatch: current process is not null");
 
+	// the last process may be cleaned up by another cpu once
+	// we drop the lock, so stop using its page tables
+	mem_ctx_switch(kernel_mem_ctx);
+
 	// wait for a process to schedule
 	do {
-		status = pcb_queue_pop(ready_queue, &current_pcb);
-		if (status == SUCCESS) {
+		status = run_queue_pop(ready_queues[cpu_id()], &current_pcb);
+		if (status == SUCCESS)
 			break;
-		}
-		int_wait();
+		status = pcb_steal(&current_pcb);
+		if (status == SUCCESS)
+			break;
+
+		// let other cpus into the kernel while we sleep, the
+		// process whose fpu state is loaded may run on one of them
+		fpu_flush();
+		tick_program();
+		cpu_local()->idle = true;
+		depth = kernel_unlock_all();
+		// zero a page for later instead of sleeping, and
+		// look for work again once it is done
+		if (!mem_zero_idle())
+			int_wait();
+		cli();
+		kernel_relock(depth);
+		cpu_local()->idle = false;
 	} while (1);
 
 	// set the process up for success
-	current_pcb->regs.cr3 = (uint64_t)mem_ctx_pgdir(current_pcb->memctx);
+	current_pcb->cpu = cpu_id();
 	current_pcb->state = PROC_STATE_RUNNING;
-	current_pcb->ticks = 3; // ticks per process
 	current_pcb->syscall = 0;
 
+	// a process keeps the rest of its slice across yields and blocking
+	// syscalls, so it only gets a new one once the last was used up
+	if (current_pcb->slice == 0)
+		current_pcb->slice = MLFQ_SLICE(current_pcb->level);
+	cpu_local()->slice_end = clock_ns() + current_pcb->slice;
+
+	// save the last process' fpu state if it is not this one
+	fpu_switch(current_pcb);
+
 	syscall_return();
 }
 
-void pcb_on_tick(void)
+void pcb_save_slice(struct pcb *pcb)
 {
-	// procs not initalized yet
-	if (init_pcb == NULL)
-		return;
+	uint64_t end = cpu_local()->slice_end;
+	uint64_t now = clock_ns();
 
-	// update on sleeping
-	do {
-		struct pcb *pcb;
+	pcb->slice = end > now ? end - now : 0;
+}
 
-		if (pcb_queue_empty(syscall_queue[SYS_sleep]))
-			break;
+void pcb_on_cpu_tick(void)
+{
+	struct pcb *pcb = current_pcb;
 
-		pcb = pcb_queue_peek(syscall_queue[SYS_sleep]);
-		assert(pcb != NULL, "sleeping queue should not be empty");
+	if (pcb == NULL)
+		return;
 
-		if (pcb->wakeup >= ticks)
-			break;
+	// killed by another cpu while it was running here
+	if (pcb->killed) {
+		current_pcb = NULL;
+		pcb_zombify(pcb);
+		dispatch();
+	}
 
-		if (pcb_queue_remove(syscall_queue[SYS_sleep], pcb))
-			panic("failed to wake sleeping process: %d", pcb->pid);
+	if (clock_ns() >= cpu_local()->slice_end) {
+		// used its whole slice, demote it
+		if (pcb->level < N_PRIO_LEVELS - 1)
+			pcb->level++;
+		pcb->slice = 0;
 
+		// schedule another process
+		current_pcb = NULL;
 		schedule(pcb);
-	} while (1);
-
-	if (current_pcb) {
-		current_pcb->ticks--;
-		if (current_pcb->ticks < 1) {
-			// schedule another process
-			schedule(current_pcb);
-			current_pcb = NULL;
-			dispatch();
-		}
+		dispatch();
 	}
 }
@@ -6,16 +6,15 @@
 #include <comus/input.h>
 #include <comus/drivers/acpi.h>
 #include <comus/drivers/gpu.h>
-#include <comus/drivers/pit.h>
 #include <comus/memory.h>
 #include <comus/procs.h>
 #include <comus/time.h>
+#include <comus/tick.h>
+#include <comus/fpu.h>
 #include <comus/error.h>
 #include <lib.h>
 #include <stddef.h>
 
-static struct pcb *pcb;
-
 #define RET(type, name) type *name = (type *)(&pcb->regs.rax)
 #define ARG1(type, name) type name = (type)(pcb->regs.rdi)
 #define ARG2(type, name) type name = (type)(pcb->regs.rsi)
@@ -26,7 +25,10 @@ static struct pcb *pcb;
 #define stdout 1
 #define stderr 2
 
-static struct file *get_file_ptr(int fd)
+// read and write copy through a kernel buffer this big
+#define IO_CHUNK 512
+
+static struct file *get_file_ptr(struct pcb *pcb, int fd)
 {
 	// valid index?
 	if (fd < 3 || fd >= (N_OPEN_FILES + 3))
@@ -36,7 +38,24 @@ static struct file *get_file_ptr(int fd)
 	return pcb->open_files[fd - 3];
 }
 
-__attribute__((noreturn)) static int sys_exit(void)
+// copy a nul terminated string from a process, that fits in size bytes
+static int read_user_str(struct pcb *pcb, char *buf, const char *str,
+						 size_t size)
+{
+	long len;
+
+	len = strnlen_user(pcb->memctx, str, size);
+	if (len < 0 || (size_t)len == size)
+		return 1;
+
+	if (copy_from_user(pcb->memctx, buf, str, len))
+		return 1;
+
+	buf[len] = '\0';
+	return 0;
+}
+
+__attribute__((noreturn)) static int sys_exit(struct pcb *pcb)
 {
 	ARG1(int, status);
 
@@ -47,33 +66,28 @@ __attribute__((noreturn)) static int sys_exit(void)
 	dispatch();
 }
 
-static int sys_waitpid(void)
+static int sys_waitpid(struct pcb *pcb)
 {
 	ARG1(pid_t, pid);
 	ARG2(int *, status);
 
 	struct pcb *child;
-	for (int i = 0; i < N_PROCS; i++) {
-		child = &ptable[i];
-		if (child->state != PROC_STATE_ZOMBIE)
-			continue;
-		if (child->parent != pcb)
-			continue;
-
-		// we found a child!
-		if (pid && pid != child->pid)
-			continue;
+	pid_t child_pid;
 
+	child = pcb_find_zombie(pcb, pid);
+	if (child != NULL) {
 		// set status
-		mem_ctx_switch(pcb->memctx);
-		*status = child->exit_status;
-		mem_ctx_switch(kernel_mem_ctx);
+		if (status != NULL &&
+			copy_to_user(pcb->memctx, status, &child->exit_status,
+						 sizeof(int)))
+			return -1;
 
 		// clean up child process
+		child_pid = child->pid;
 		pcb_cleanup(child);
 
 		// return
-		return child->pid;
+		return child_pid;
 	}
 
 	// arguments are read later
@@ -86,7 +100,7 @@ static int sys_waitpid(void)
 	dispatch();
 }
 
-static int sys_fork(void)
+static int sys_fork(struct pcb *pcb)
 {
 	struct pcb *child;
 
@@ -100,7 +114,7 @@ static int sys_fork(void)
 	return 0;
 }
 
-static int sys_exec(void)
+static int sys_exec(struct pcb *pcb)
 {
 	ARG1(const char *, in_filename);
 	ARG2(const char **, in_args);
@@ -115,9 +129,8 @@ static int sys_exec(void)
 	save = *pcb;
 
 	// read filename
-	mem_ctx_switch(pcb->memctx);
-	memcpy(filename, in_filename, strlen(in_filename) + 1);
-	mem_ctx_switch(kernel_mem_ctx);
+	if (read_user_str(pcb, filename, in_filename, N_FILE_NAME))
+		goto fail;
 
 	// get binary
 	fs = fs_get_root_file_system();
@@ -132,6 +145,7 @@ static int sys_exec(void)
 		goto fail;
 	file->close(file);
 	mem_ctx_free(save.memctx);
+	fpu_release(pcb);
 	schedule(pcb);
 	dispatch();
 
@@ -142,7 +156,7 @@ fail:
 	return 1;
 }
 
-static int sys_open(void)
+static int sys_open(struct pcb *pcb)
 {
 	ARG1(const char *, in_filename);
 	ARG2(int, flags);
@@ -153,9 +167,8 @@ static int sys_open(void)
 	int fd;
 
 	// read filename
-	mem_ctx_switch(pcb->memctx);
-	memcpy(filename, in_filename, strlen(in_filename));
-	mem_ctx_switch(kernel_mem_ctx);
+	if (read_user_str(pcb, filename, in_filename, N_FILE_NAME))
+		return -1;
 
 	// get fd
 	for (fd = 3; fd < (N_OPEN_FILES + 3); fd++) {
@@ -180,12 +193,12 @@ static int sys_open(void)
 	return fd;
 }
 
-static int sys_close(void)
+static int sys_close(struct pcb *pcb)
 {
 	ARG1(int, fd);
 
 	struct file *file;
-	file = get_file_ptr(fd);
+	file = get_file_ptr(pcb, fd);
 	if (file == NULL)
 		return 1;
 
@@ -193,41 +206,46 @@ static int sys_close(void)
 	return 0;
 }
 
-static int sys_read(void)
+static int sys_read(struct pcb *pcb)
 {
 	ARG1(int, fd);
 	ARG2(void *, buffer);
 	ARG3(size_t, nbytes);
 
 	struct file *file;
-	char *map_buf;
-
-	map_buf = kmapuseraddr(pcb->memctx, buffer, nbytes);
-	if (map_buf == NULL)
-		return -1;
+	char buf[IO_CHUNK];
+	size_t done, chunk;
+	int n;
 
-	file = get_file_ptr(fd);
+	file = get_file_ptr(pcb, fd);
 	if (file == NULL)
-		goto fail;
+		return -1;
 
-	nbytes = file->read(file, map_buf, nbytes);
-	kunmapaddr(map_buf);
-	return nbytes;
+	for (done = 0; done < nbytes; done += n) {
+		chunk = MIN(nbytes - done, IO_CHUNK);
+		n = file->read(file, buf, chunk);
+		if (n < 0)
+			return done ? (int)done : -1;
+		if (copy_to_user(pcb->memctx, (char *)buffer + done, buf, n))
+			return -1;
+		// end of file
+		if ((size_t)n < chunk) {
+			done += n;
+			break;
+		}
+	}
 
-fail:
-	kunmapaddr(map_buf);
-	return -1;
+	return done;
 }
 
-static int sys_write(void)
+static int sys_write(struct pcb *pcb)
 {
 	ARG1(int, fd);
 	ARG2(const void *, buffer);
 	ARG3(size_t, nbytes);
 
-	const char *map_buf = kmapuseraddr(pcb->memctx, buffer, nbytes);
-	if (map_buf == NULL)
-		return 0;
+	char buf[IO_CHUNK];
+	size_t chunk;
 
 	// cannot write to stdin
 	if (fd == 0)
@@ -235,8 +253,14 @@ static int sys_write(void)
 
 	// write to stdout / stderr
 	else if (fd == stdout || fd == stderr) {
-		for (size_t i = 0; i < nbytes; i++)
-			kputc(map_buf[i]);
+		for (size_t done = 0; done < nbytes; done += chunk) {
+			chunk = MIN(nbytes - done, IO_CHUNK);
+			if (copy_from_user(pcb->memctx, buf, (char *)buffer + done,
+							   chunk))
+				return done;
+			for (size_t i = 0; i < chunk; i++)
+				kputc(buf[i]);
+		}
 	}
 
 	// files
@@ -245,17 +269,15 @@ static int sys_write(void)
 		nbytes = 0;
 	}
 
-	kunmapaddr(map_buf);
-
 	return nbytes;
 }
 
-static int sys_getpid(void)
+static int sys_getpid(struct pcb *pcb)
 {
 	return pcb->pid;
 }
 
-static int sys_getppid(void)
+static int sys_getppid(struct pcb *pcb)
 {
 	// init's parent is itself
 	if (pcb->parent == NULL)
@@ -263,21 +285,21 @@ static int sys_getppid(void)
 	return pcb->parent->pid;
 }
 
-static int sys_gettime(void)
+static int sys_gettime(struct pcb *pcb)
 {
 	RET(unsigned long, time);
-	*time = unixtime();
+	*time = clock_unix();
 	return 0;
 }
 
-static int sys_getprio(void)
+static int sys_getprio(struct pcb *pcb)
 {
 	RET(unsigned int, prio);
 	*prio = pcb->priority;
 	return 0;
 }
 
-static int sys_setprio(void)
+static int sys_setprio(struct pcb *pcb)
 {
 	RET(unsigned int, old);
 	ARG1(unsigned int, new);
@@ -287,7 +309,7 @@ static int sys_setprio(void)
 	return 0;
 }
 
-static int sys_kill(void)
+static int sys_kill(struct pcb *pcb)
 {
 	ARG1(pid_t, pid);
 	struct pcb *victim, *parent;
@@ -317,18 +339,30 @@ static int sys_kill(void)
 	case PROC_STATE_READY:
 		// remove from ready queue
 		victim->exit_status = 1;
-		pcb_queue_remove(ready_queue, victim);
+		run_queue_remove(ready_queues[victim->cpu], victim);
 		pcb_zombify(victim);
 		return 0;
 
 	case PROC_STATE_BLOCKED:
-		// remove from syscall queue
+		// remove from whatever it is waiting on, sleepers
+		// only have a timer, futex waiters can have both
 		victim->exit_status = 1;
-		pcb_queue_remove(syscall_queue[victim->syscall], victim);
+		timer_cancel(&victim->timer);
+		if (victim->queue != NULL)
+			pcb_queue_remove(victim->queue, victim);
 		pcb_zombify(victim);
 		return 0;
 
 	case PROC_STATE_RUNNING:
+		// running in userspace on another cpu, that cpu
+		// zombifies it next time it enters the kernel
+		if (victim != pcb) {
+			victim->exit_status = 1;
+			victim->killed = true;
+			cpu_kick(victim->cpu);
+			return 0;
+		}
+
 		// we have met the enemy, and it is us!
 		pcb->exit_status = 1;
 		pcb_zombify(pcb);
@@ -344,7 +378,7 @@ static int sys_kill(void)
 	return 0;
 }
 
-static int sys_sleep(void)
+static int sys_sleep(struct pcb *pcb)
 {
 	RET(int, ret);
 	ARG1(unsigned long, ms);
@@ -355,64 +389,64 @@ static int sys_sleep(void)
 		dispatch();
 	}
 
-	pcb->wakeup = ticks + ms;
-	if (pcb_queue_insert(syscall_queue[SYS_sleep], pcb)) {
-		WARN("sleep pcb insert failed");
-		return 1;
-	}
+	pcb->wakeup = clock_ns() + ms * NS_PER_MS;
+	timer_arm(&pcb->timer, pcb->wakeup);
+	pcb->state = PROC_STATE_BLOCKED;
+
+	// calling pcb is waiting on its timer,
+	// we must call a new one
+	dispatch();
+}
+
+static int sys_sleepuntil(struct pcb *pcb)
+{
+	ARG1(uint64_t, deadline);
+
+	// already passed
+	if (deadline <= clock_ns())
+		return 0;
+
+	pcb->wakeup = deadline;
+	timer_arm(&pcb->timer, pcb->wakeup);
 	pcb->state = PROC_STATE_BLOCKED;
 
-	// calling pcb is in sleeping queue,
+	// calling pcb is waiting on its timer,
 	// we must call a new one
 	dispatch();
 }
 
-__attribute__((noreturn)) static int sys_poweroff(void)
+__attribute__((noreturn)) static int sys_poweroff(struct pcb *pcb)
 {
+	(void)pcb;
+
 	// TODO: we should probably
 	// kill all user processes
 	// and then sync the fs
 	acpi_shutdown();
 }
 
-static void *pcb_update_heap(intptr_t increment)
+static void *pcb_update_heap(struct pcb *pcb, intptr_t increment)
 {
 	char *curr_brk;
-	size_t curr_pages, new_pages, new_len;
+	size_t new_pages, new_len;
 
 	new_len = pcb->heap_len + increment;
 	new_pages = (new_len + PAGE_SIZE - 1) / PAGE_SIZE;
-
 	curr_brk = pcb->heap_start + pcb->heap_len;
-	curr_pages = (pcb->heap_len + PAGE_SIZE - 1) / PAGE_SIZE;
-	if (pcb->heap_len == 0)
-		curr_pages = 0;
 
 	// do nothing i guess
-	if (increment == 0 || new_pages == curr_pages)
+	if (increment == 0)
 		return curr_brk;
 
-	// unmap pages if decreasing
-	if (new_pages < curr_pages) {
-		void *new_end = pcb->heap_start + new_pages * PAGE_SIZE;
-		mem_free_pages(pcb->memctx, new_end);
-		pcb->heap_len = new_pages * PAGE_SIZE;
-	}
-
-	// map pages if increasing
-	else {
-		void *curr_end = pcb->heap_start + curr_pages * PAGE_SIZE;
-		if (mem_alloc_pages_at(pcb->memctx, new_pages - curr_pages, curr_end,
-							   F_PRESENT | F_WRITEABLE | F_UNPRIVILEGED) ==
-			NULL)
-			return NULL;
-		pcb->heap_len = new_pages * PAGE_SIZE;
-	}
+	// pages are only given memory once they are touched
+	if (mem_area_resize(pcb->memctx, pcb->heap_start, new_pages))
+		return NULL;
+	pcb->heap_len = new_len;
 
 	return curr_brk;
 }
 
-static int sys_brk(void)
+static int sys_brk(struct pcb *pcb)
 {
 	RET(void *, brk);
 	ARG1(const void *, addr);
@@ -423,21 +457,21 @@ static int sys_brk(void)
 		return 0;
 	}
 
-	*brk = pcb_update_heap((intptr_t)addr -
-						   ((intptr_t)pcb->heap_start + pcb->heap_len));
+	*brk = pcb_update_heap(pcb, (intptr_t)addr - ((intptr_t)pcb->heap_start +
+												 pcb->heap_len));
 	return 0;
 }
 
-static int sys_sbrk(void)
+static int sys_sbrk(struct pcb *pcb)
 {
 	RET(void *, brk);
 	ARG1(intptr_t, increment);
 
-	*brk = pcb_update_heap(increment);
+	*brk = pcb_update_heap(pcb, increment);
 	return 0;
 }
 
-static int sys_drm(void)
+static int sys_drm(struct pcb *pcb)
 {
 	ARG1(void **, res_fb);
 	ARG2(int *, res_width);
@@ -457,7 +491,7 @@ static int sys_drm(void)
 	if (pADDR == NULL)
 		return 1;
 
-	vADDR = mem_mapaddr(pcb->memctx, pADDR, (void *)0x1000000000, len,
+	vADDR = mem_mapaddr(pcb->memctx, pADDR, (void *)0x200000000000, len,
 						F_PRESENT | F_WRITEABLE | F_UNPRIVILEGED);
 	if (vADDR == NULL)
 		return 1;
@@ -466,24 +500,105 @@ static int sys_drm(void)
 	height = gpu_dev->height;
 	bpp = gpu_dev->bit_depth;
 
-	mem_ctx_switch(pcb->memctx);
-	*res_fb = vADDR;
-	*res_width = width;
-	*res_height = height;
-	*res_bpp = bpp;
-	mem_ctx_switch(kernel_mem_ctx);
+	if (copy_to_user(pcb->memctx, res_fb, &vADDR, sizeof(void *)) ||
+		copy_to_user(pcb->memctx, res_width, &width, sizeof(int)) ||
+		copy_to_user(pcb->memctx, res_height, &height, sizeof(int)) ||
+		copy_to_user(pcb->memctx, res_bpp, &bpp, sizeof(int)))
+		return 1;
 
 	return 0;
 }
 
-static int sys_ticks(void)
+static int sys_ticks(struct pcb *pcb)
 {
 	RET(uint64_t, res_ticks);
-	*res_ticks = ticks;
+	*res_ticks = clock_ms();
+	return 0;
+}
+
+static int sys_nanotime(struct pcb *pcb)
+{
+	RET(uint64_t, res_ns);
+	*res_ns = clock_ns();
+	return 0;
+}
+
+static int sys_proclimit(struct pcb *pcb)
+{
+	RET(size_t, old);
+	ARG1(size_t, max);
+
+	*old = pcb_limit();
+	if (max != 0 && pcb_set_limit(max) != SUCCESS)
+		*old = 0;
+	return 0;
+}
+
+// physical address of a futex word, or NULL if it is not mapped
+static void *futex_key(struct pcb *pcb, const uint32_t *addr)
+{
+	if ((uintptr_t)addr % sizeof(uint32_t) != 0)
+		return NULL;
+	return mem_get_phys(pcb->memctx, addr);
+}
+
+static int sys_futexwait(struct pcb *pcb)
+{
+	RET(int, ret);
+	ARG1(uint32_t *, addr);
+	ARG2(uint32_t, val);
+	ARG3(uint64_t, timeout);
+	void *key;
+	uint32_t cur;
+
+	key = futex_key(pcb, addr);
+	if (key == NULL) {
+		*ret = E_BAD_PARAM;
+		return 0;
+	}
+
+	if (timeout != 0 && timeout <= clock_ns()) {
+		*ret = E_TIMEOUT;
+		return 0;
+	}
+
+	// other cpus can only wake us once we are queued, and they
+	// need the kernel lock for that, so no wakeup is lost
+	if (copy_from_user(pcb->memctx, &cur, addr, sizeof(uint32_t))) {
+		*ret = E_BAD_PARAM;
+		return 0;
+	}
+
+	if (cur != val) {
+		*ret = E_AGAIN;
+		return 0;
+	}
+
+	pcb_wait(pcb, (uint64_t)key, timeout);
+
+	// calling pcb is waiting to be woken,
+	// we must call a new one
+	dispatch();
+}
+
+static int sys_futexwake(struct pcb *pcb)
+{
+	RET(int, woken);
+	ARG1(uint32_t *, addr);
+	ARG2(int, n);
+	void *key;
+
+	key = futex_key(pcb, addr);
+	if (key == NULL || n < 0) {
+		*woken = E_BAD_PARAM;
+		return 0;
+	}
+
+	*woken = pcb_wake((uint64_t)key, n);
 	return 0;
 }
 
-static int sys_popsharedmem(void)
+static int sys_popsharedmem(struct pcb *pcb)
 {
 	RET(void *, res_mem);
 	*res_mem = NULL;
@@ -499,10 +614,9 @@ static int sys_popsharedmem(void)
 		return 1;
 	}
 
-	void *result =
-		mem_mapaddr(pcb->memctx, mem_get_phys(sharer->memctx, pcb->shared_mem),
-					pcb->shared_mem, pcb->shared_mem_pages * PAGE_SIZE,
-					F_WRITEABLE | F_UNPRIVILEGED);
+	void *result = mem_mapshared(pcb->memctx, sharer->memctx, pcb->shared_mem,
+								 pcb->shared_mem_pages,
+								 F_WRITEABLE | F_UNPRIVILEGED);
 
 	// if (!result) {
 	//  alert the other process that we cannot get its allocation?
@@ -517,7 +631,7 @@ static int sys_popsharedmem(void)
 	return 0;
 }
 
-static int sys_allocshared(void)
+static int sys_allocshared(struct pcb *pcb)
 {
 	ARG1(size_t, num_pages);
 	ARG2(unsigned short, otherpid); // same as pid_t
@@ -540,8 +654,11 @@ static int sys_allocshared(void)
 		return 1;
 	}
 
+	// popsharedmem maps it by its first physical address
 	void *alloced =
-		mem_alloc_pages(pcb->memctx, num_pages, F_WRITEABLE | F_UNPRIVILEGED);
+		mem_alloc_pages_contig(pcb->memctx, num_pages,
+							   F_WRITEABLE | F_UNPRIVILEGED | F_SHARED |
+								   F_ZERO);
 
 	if (!alloced) {
 		return 1;
@@ -557,26 +674,26 @@ static int sys_allocshared(void)
 }
 
 // NOTE: observes AND consumes the key event
-static int sys_keypoll(void)
+static int sys_keypoll(struct pcb *pcb)
 {
 	ARG1(struct keycode *, keyev);
 	RET(int, waspressed);
 
-	void *ouraddr = kmapuseraddr(pcb->memctx, keyev, sizeof(struct keycode));
+	struct keycode ev;
 
-	if (keycode_pop(ouraddr)) {
-		kunmapaddr(ouraddr);
+	if (keycode_pop(&ev)) {
 		*waspressed = false;
 		return 0;
 	}
 
-	kunmapaddr(ouraddr);
+	if (copy_to_user(pcb->memctx, keyev, &ev, sizeof(struct keycode)))
+		return 1;
 
 	*waspressed = true;
 	return 0;
 }
 
-static int sys_seek(void)
+static int sys_seek(struct pcb *pcb)
 {
 	RET(long int, ret);
 	ARG1(int, fd);
@@ -584,7 +701,7 @@ static int sys_seek(void)
 	ARG3(int, whence);
 
 	struct file *file;
-	file = get_file_ptr(fd);
+	file = get_file_ptr(pcb, fd);
 	if (file == NULL)
 		return -1;
 
@@ -593,7 +710,7 @@ static int sys_seek(void)
 }
 
 // clang-format off
-static int (*syscall_tbl[N_SYSCALLS])(void) = {
+static int (*syscall_tbl[N_SYSCALLS])(struct pcb *) = {
 	[SYS_exit] = sys_exit,		 [SYS_waitpid] = sys_waitpid,
 	[SYS_fork] = sys_fork,		 [SYS_exec] = sys_exec,
 	[SYS_open] = sys_open,		 [SYS_close] = sys_close,
@@ -606,13 +723,17 @@ static int (*syscall_tbl[N_SYSCALLS])(void) = {
 	[SYS_drm] = sys_drm,		 [SYS_ticks] = sys_ticks,
 	[SYS_seek] = sys_seek,       [SYS_allocshared] = sys_allocshared,
 	[SYS_popsharedmem] = sys_popsharedmem, [SYS_keypoll] = sys_keypoll,
+	[SYS_nanotime] = sys_nanotime, [SYS_sleepuntil] = sys_sleepuntil,
+	[SYS_proclimit] = sys_proclimit, [SYS_futexwait] = sys_futexwait,
+	[SYS_futexwake] = sys_futexwake,
 };
 // clang-format on
 
 void syscall_handler(void)
 {
+	struct pcb *pcb;
 	uint64_t num;
-	int (*handler)(void);
+	int (*handler)(struct pcb *);
 	int ret = 1;
 
 	// update data
@@ -622,8 +743,12 @@ void syscall_handler(void)
 	pcb->syscall = num;
 	current_pcb = NULL;
 
-	// check for invalid syscall
-	if (num >= N_SYSCALLS) {
+	// keep the rest of the slice if the syscall blocks
+	pcb_save_slice(pcb);
+
+	// check for invalid syscall, or if we were
+	// killed while running on this cpu
+	if (num >= N_SYSCALLS || pcb->killed) {
 		// kill process
 		pcb->exit_status = 1;
 		pcb_zombify(pcb);
@@ -634,7 +759,7 @@ void syscall_handler(void)
 	// run syscall handler
 	handler = syscall_tbl[num];
 	if (handler != NULL)
-		ret = handler();
+		ret = handler(pcb);
 
 	// on failure, set rax
 	if (ret)
@@ -0,0 +1,292 @@
+#include <lib.h>
+#include <comus/asm.h>
+#include <comus/cpu.h>
+#include <comus/tick.h>
+#include <comus/timer.h>
+#include <comus/time.h>
+#include <comus/timepage.h>
+#include <comus/memory.h>
+#include <comus/procs.h>
+#include <comus/drivers/pit.h>
+#include <comus/drivers/hpet.h>
+#include <comus/drivers/lapic.h>
+
+// how many ms to measure the tsc over
+#define CALIBRATE_MS 20
+
+// fraction bits of clock_mult
+#define CLOCK_SHIFT 32
+
+/// counter the kernel clock is read from
+enum clock_source {
+	CLOCK_TSC,
+	CLOCK_HPET,
+};
+
+/// what fires the timer interrupt
+enum tick_mode {
+	// the pit at 1 kHz, when there is nothing better
+	TICK_PERIODIC,
+	// local apic timer counting down
+	TICK_LAPIC,
+	// local apic timer firing at a tsc value
+	TICK_DEADLINE,
+	// hpet comparator on the legacy pit irq
+	TICK_HPET,
+};
+
+static enum clock_source source = CLOCK_TSC;
+static enum tick_mode mode = TICK_PERIODIC;
+
+// counter value at clock_init, and counts per second
+static uint64_t clock_base = 0;
+static uint64_t clock_freq = 0;
+
+// nanoseconds per count, fixed point with CLOCK_SHIFT fraction bits,
+// so reading the clock does not divide
+static uint64_t clock_mult = 0;
+
+// in the kernel image, so it is never copied when a memory
+// context is cloned
+static struct time_page time_page __attribute__((aligned(PAGE_SIZE)));
+
+// same math userspace does with the time page
+static inline uint64_t count_to_ns(uint64_t count)
+{
+	__extension__ typedef unsigned __int128 uint128_t;
+	return ((uint128_t)count * clock_mult) >> CLOCK_SHIFT;
+}
+
+// split up to avoid overflowing 64 bits
+static inline uint64_t ns_to_count(uint64_t ns, uint64_t freq)
+{
+	return (ns / NS_PER_SEC) * freq + (ns % NS_PER_SEC) * freq / NS_PER_SEC;
+}
+
+static inline uint64_t clock_read(void)
+{
+	if (source == CLOCK_HPET)
+		return hpet_read();
+	return rdtsc();
+}
+
+static uint64_t tsc_calibrate(void)
+{
+	uint64_t tsc_start, tsc_end;
+	uint64_t start, end, target;
+
+	// the hpet is exact, so use it if we can
+	if (hpet_present()) {
+		start = hpet_read();
+		target = start + hpet_freq() * CALIBRATE_MS / 1000;
+		tsc_start = rdtsc();
+		while ((end = hpet_read()) < target)
+			cpu_relax();
+		tsc_end = rdtsc();
+		return (tsc_end - tsc_start) * hpet_freq() / (end - start);
+	}
+
+	// line up with the start of a pit period
+	kspin_milliseconds(1);
+
+	tsc_start = rdtsc();
+	kspin_milliseconds(CALIBRATE_MS);
+	tsc_end = rdtsc();
+	return (tsc_end - tsc_start) * 1000 / CALIBRATE_MS;
+}
+
+void clock_init(void)
+{
+	struct cpu_feat feats;
+	uint64_t freq;
+
+	cpu_feats(&feats);
+
+	if (feats.invariant_tsc || !hpet_present()) {
+		if (!feats.invariant_tsc)
+			WARN("tsc is not invariant, the clock may drift");
+		source = CLOCK_TSC;
+		freq = tsc_calibrate();
+	} else {
+		source = CLOCK_HPET;
+		freq = hpet_freq();
+	}
+
+	// clock_running flips once the frequency is set
+	clock_mult = (NS_PER_SEC << CLOCK_SHIFT) / freq;
+	clock_base = clock_read();
+	clock_freq = freq;
+
+	// processes can only read the tsc, the hpet is not mapped for them
+	time_page.seq++;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	time_page.clock = source == CLOCK_TSC ? TIME_CLOCK_TSC :
+											TIME_CLOCK_SYSCALL;
+	time_page.tsc_base = clock_base;
+	time_page.mult = clock_mult;
+	time_page.shift = CLOCK_SHIFT;
+	time_page.boot_unix = unixtime() - clock_ns() / NS_PER_SEC;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	time_page.seq++;
+}
+
+bool clock_running(void)
+{
+	return clock_freq != 0;
+}
+
+uint64_t clock_ns(void)
+{
+	uint64_t count = clock_read();
+
+	assert(clock_freq != 0, "clock_ns: clock not running");
+
+	// tsc values of other cpus may be slightly behind
+	if (count < clock_base)
+		return 0;
+	return count_to_ns(count - clock_base);
+}
+
+uint64_t clock_unix(void)
+{
+	return time_page.boot_unix + clock_ns() / NS_PER_SEC;
+}
+
+int clock_map(mem_ctx_t ctx)
+{
+	void *phys = kget_phys(&time_page);
+
+	if (mem_mapaddr(ctx, phys, (void *)TIME_PAGE_ADDR, PAGE_SIZE,
+					F_UNPRIVILEGED) == NULL)
+		return 1;
+	return 0;
+}
+
+static void tick_start(void)
+{
+	cpu_local()->next_event = UINT64_MAX;
+
+	switch (mode) {
+	case TICK_PERIODIC:
+		break;
+	case TICK_LAPIC:
+		lapic_timer_oneshot(false);
+		break;
+	case TICK_DEADLINE:
+		lapic_timer_oneshot(true);
+		break;
+	case TICK_HPET:
+		hpet_event_enable();
+		break;
+	}
+}
+
+void tick_init(void)
+{
+	struct cpu_feat feats;
+
+	cpu_feats(&feats);
+
+	if (lapic_present()) {
+		// tsc-deadline needs the tsc to be the clock source,
+		// since deadlines are converted from clock time
+		if (source == CLOCK_TSC && feats.tsc_deadline)
+			mode = TICK_DEADLINE;
+		else
+			mode = TICK_LAPIC;
+	} else if (hpet_present()) {
+		mode = TICK_HPET;
+	} else {
+		WARN("no one-shot timer, using the periodic pit");
+		mode = TICK_PERIODIC;
+		return;
+	}
+
+	tick_start();
+
+	// legacy routing already takes irq 0 from the pit
+	if (mode != TICK_HPET)
+		pit_stop(CHAN_TIMER);
+}
+
+void tick_init_ap(void)
+{
+	tick_start();
+}
+
+void tick_handler(void)
+{
+	// the pit ticks during boot before there is a clock
+	if (!clock_running())
+		return;
+
+	// one-shot timers are spent once they fire
+	cpu_local()->next_event = UINT64_MAX;
+
+	// the bsp keeps time for everyone
+	if (cpu_id() == 0)
+		timer_tick(clock_ns());
+
+	pcb_on_cpu_tick();
+}
+
+static void tick_set(uint64_t next)
+{
+	uint64_t now;
+
+	switch (mode) {
+	case TICK_PERIODIC:
+		break;
+	case TICK_LAPIC:
+		if (next == UINT64_MAX) {
+			lapic_timer_arm(0);
+			break;
+		}
+		now = clock_ns();
+		lapic_timer_arm(next > now ? next - now : 1);
+		break;
+	case TICK_DEADLINE:
+		if (next == UINT64_MAX) {
+			lapic_timer_deadline(0);
+			break;
+		}
+		lapic_timer_deadline(clock_base + ns_to_count(next, clock_freq));
+		break;
+	case TICK_HPET:
+		if (next == UINT64_MAX) {
+			hpet_event_stop();
+			break;
+		}
+		now = clock_ns();
+		hpet_event_set(hpet_read() +
+					   ns_to_count(next > now ? next - now : 0, hpet_freq()));
+		break;
+	}
+}
+
+void tick_program(void)
+{
+	struct cpu_local *local = cpu_local();
+	uint64_t next = UINT64_MAX;
+	uint64_t expiry;
+
+	if (mode == TICK_PERIODIC)
+		return;
+
+	if (current_pcb != NULL)
+		next = local->slice_end;
+
+	// the bsp runs the kernel timers, other cpus only have
+	// to let it know when they armed an earlier one
+	expiry = timer_next_expiry();
+	if (local->id == 0)
+		next = MIN(next, expiry);
+	else if (expiry < cpu_get(0)->next_event)
+		cpu_kick(0);
+
+	if (next == local->next_event)
+		return;
+
+	local->next_event = next;
+	tick_set(next);
+}
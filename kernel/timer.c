@@ -0,0 +1,203 @@
+#include <lib.h>
+#include <comus/timer.h>
+
+// each level of the wheel has 64 slots, and each slot of a level
+// covers a whole rotation of the level below it
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 6
+
+// the wheel turns once every microsecond
+#define WHEEL_NS 1000
+
+// wheel ticks covered by a slot of the given level
+#define LEVEL_SPAN(level) (1ULL << (WHEEL_BITS * (level)))
+
+// furthest in the future a timer can be placed, timers past this
+// are placed at the end and re-placed when they cascade
+#define WHEEL_MAX_DELTA (LEVEL_SPAN(WHEEL_LEVELS) - 1)
+
+static struct timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+// bit n is set if slot n of the level has timers
+static uint64_t wheel_bitmap[WHEEL_LEVELS];
+
+// next wheel tick to be run
+static uint64_t wheel_now = 0;
+
+// wheel tick a timer expiring at ns is run on, rounded
+// up so that timers never fire early
+static inline uint64_t wheel_tick(uint64_t ns)
+{
+	return ns / WHEEL_NS + (ns % WHEEL_NS != 0);
+}
+
+static void wheel_insert(struct timer *timer)
+{
+	uint64_t expires, delta;
+	struct timer **slot;
+	size_t level, idx;
+
+	// expired timers are run on the next tick
+	expires = MAX(wheel_tick(timer->expires), wheel_now);
+	delta = expires - wheel_now;
+	if (delta > WHEEL_MAX_DELTA) {
+		delta = WHEEL_MAX_DELTA;
+		expires = wheel_now + delta;
+	}
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (delta < LEVEL_SPAN(level + 1))
+			break;
+
+	idx = (expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	slot = &wheel[level][idx];
+	timer->next = *slot;
+	if (timer->next != NULL)
+		timer->next->pprev = &timer->next;
+	timer->pprev = slot;
+	timer->slot = level * WHEEL_SIZE + idx;
+	*slot = timer;
+	wheel_bitmap[level] |= 1ULL << idx;
+}
+
+static void wheel_remove(struct timer *timer)
+{
+	size_t level = timer->slot / WHEEL_SIZE;
+	size_t idx = timer->slot % WHEEL_SIZE;
+
+	*timer->pprev = timer->next;
+	if (timer->next != NULL)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+	if (wheel[level][idx] == NULL)
+		wheel_bitmap[level] &= ~(1ULL << idx);
+}
+
+// earliest wheel tick that has anything to do, either running timers
+// on level 0 or cascading a slot of a higher level
+static uint64_t wheel_next(void)
+{
+	uint64_t next = UINT64_MAX;
+
+	for (size_t level = 0; level < WHEEL_LEVELS; level++) {
+		size_t shift = WHEEL_BITS * level;
+		uint64_t bitmap = wheel_bitmap[level];
+		uint64_t block;
+		size_t idx;
+
+		if (bitmap == 0)
+			continue;
+
+		// first slot of this level that has not started yet
+		block = (wheel_now + LEVEL_SPAN(level) - 1) >> shift;
+		idx = block & WHEEL_MASK;
+
+		// rotate the bitmap so that slot is bit 0
+		if (idx != 0)
+			bitmap = (bitmap >> idx) | (bitmap << (WHEEL_SIZE - idx));
+		block += __builtin_ctzll(bitmap);
+
+		next = MIN(next, block << shift);
+	}
+
+	return next;
+}
+
+// move timers down from the slots of higher levels that start now
+static void wheel_cascade(void)
+{
+	for (size_t level = 1; level < WHEEL_LEVELS; level++) {
+		size_t idx = (wheel_now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+		struct timer *timer = wheel[level][idx];
+		wheel[level][idx] = NULL;
+		wheel_bitmap[level] &= ~(1ULL << idx);
+
+		while (timer != NULL) {
+			struct timer *next = timer->next;
+			wheel_insert(timer);
+			timer = next;
+		}
+
+		// the next level only starts a new slot when this one wraps
+		if (idx != 0)
+			break;
+	}
+}
+
+void timer_init(struct timer *timer, void (*callback)(struct timer *),
+				void *data)
+{
+	assert(timer != NULL, "timer_init: timer is null");
+	timer->expires = 0;
+	timer->callback = callback;
+	timer->data = data;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+void timer_arm(struct timer *timer, uint64_t expires)
+{
+	assert(timer != NULL, "timer_arm: timer is null");
+	assert(timer->callback != NULL, "timer_arm: timer has no callback");
+
+	if (timer_armed(timer))
+		wheel_remove(timer);
+	timer->expires = expires;
+	wheel_insert(timer);
+}
+
+void timer_cancel(struct timer *timer)
+{
+	assert(timer != NULL, "timer_cancel: timer is null");
+
+	if (timer_armed(timer))
+		wheel_remove(timer);
+}
+
+bool timer_armed(const struct timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+uint64_t timer_next_expiry(void)
+{
+	uint64_t next = wheel_next();
+	if (next == UINT64_MAX)
+		return UINT64_MAX;
+	return next * WHEEL_NS;
+}
+
+void timer_tick(uint64_t now)
+{
+	uint64_t until = now / WHEEL_NS;
+
+	while (wheel_now <= until) {
+		uint64_t next = wheel_next();
+		struct timer *timer;
+		size_t idx;
+
+		// skip straight over ticks with nothing to do
+		if (next > until) {
+			wheel_now = until + 1;
+			break;
+		}
+		wheel_now = next;
+
+		idx = wheel_now & WHEEL_MASK;
+		if (idx == 0)
+			wheel_cascade();
+
+		// callbacks may arm or cancel other timers,
+		// so take them off one at a time
+		while ((timer = wheel[0][idx]) != NULL) {
+			wheel_remove(timer);
+			timer->callback(timer);
+		}
+
+		wheel_now++;
+	}
+}
@@ -3,6 +3,8 @@
 #include <comus/procs.h>
 #include <comus/memory.h>
 #include <comus/user.h>
+#include <comus/fpu.h>
+#include <comus/tick.h>
 #include <elf.h>
 
 /// FIXME: the following code is using direct
@@ -11,14 +13,26 @@
 /// This MUST be changed once we have files.
 /// - Freya
 
-#define USER_STACK_TOP 0x800000000000
+#define USER_STACK_TOP USER_SPACE_END
 #define USER_STACK_LEN (4 * PAGE_SIZE)
+// the stack grows into its guard page up to this size
+#define USER_STACK_MAX (8 * 1024 * 1024)
+// brk fails past this
+#define USER_HEAP_MAX (64ULL * 1024 * 1024 * 1024)
 
 #define BLOCK_SIZE (PAGE_SIZE * 1000)
 static uint8_t *load_buffer = NULL;
 
-#define USER_CODE 0x18
-#define USER_DATA 0x20
+/// elf metadata of the program being loaded, it is only
+/// needed while loading so it is not kept in the pcb
+static struct {
+	Elf64_Ehdr header;
+	Elf64_Phdr segments[N_ELF_SEGMENTS];
+	Elf64_Half n_segments;
+} load_elf;
+
+#define USER_CODE 0x20
+#define USER_DATA 0x18
 #define RING3 3
 
 static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
@@ -28,7 +42,7 @@ static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
 	size_t file_bytes, file_pages;
 	uint8_t *mapADDR;
 
-	hdr = pcb->elf_segments[idx];
+	hdr = load_elf.segments[idx];
 
 	// return if this is not a lodable segment
 	if (hdr.p_type != PT_LOAD)
@@ -45,17 +59,25 @@ static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
 	file_pages = (file_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
 
 	// return if were reading no data
-	if (file_pages < 1)
+	if (mem_pages < 1)
 		return 0;
 
-	// allocate memory in user process
-	if (mem_alloc_pages_at(pcb->memctx, mem_pages, (void *)hdr.p_vaddr,
-						   F_WRITEABLE | F_UNPRIVILEGED) == NULL) {
+	// allocate memory in user process, bss pages are only
+	// given memory once the program touches them
+	if (mem_area_alloc(pcb->memctx, (void *)hdr.p_vaddr, mem_pages, mem_pages,
+					   F_WRITEABLE | F_UNPRIVILEGED) == NULL) {
 		ERROR("Could not allocate memory for elf segment");
 		return 1;
 	}
 
-	mapADDR = kmapuseraddr(pcb->memctx, (void *)hdr.p_vaddr, mem_bytes);
+	// update heap end
+	if (hdr.p_vaddr + mem_pages * PAGE_SIZE > (uint64_t)pcb->heap_start)
+		pcb->heap_start = (void *)(hdr.p_vaddr + mem_pages * PAGE_SIZE);
+
+	if (file_pages < 1)
+		return 0;
+
+	mapADDR = kmapuseraddr(pcb->memctx, (void *)hdr.p_vaddr, file_bytes);
 	if (mapADDR == NULL) {
 		ERROR("Could load memory for elf segment");
 		return 1;
@@ -63,6 +85,7 @@ static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
 
 	// seek to start of segment
 	if (file->seek(file, hdr.p_offset, SEEK_SET) < 0) {
+		kunmapuseraddr(pcb->memctx, mapADDR);
 		ERROR("Could not load elf segment");
 		return 1;
 	}
@@ -75,7 +98,7 @@ static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
 			read = file_bytes - total_read;
 		TRACE("Reading %zu bytes...", read);
 		if ((read = file->read(file, load_buffer, read)) < 1) {
-			kunmapaddr(mapADDR);
+			kunmapuseraddr(pcb->memctx, mapADDR);
 			ERROR("Could not load elf segment");
 			return 1;
 		}
@@ -84,11 +107,7 @@ static int user_load_segment(struct pcb *pcb, struct file *file, int idx)
 		total_read += read;
 	}
 
-	// update heap end
-	if (hdr.p_vaddr + mem_pages * PAGE_SIZE > (uint64_t)pcb->heap_start)
-		pcb->heap_start = (void *)(hdr.p_vaddr + mem_pages * PAGE_SIZE);
-
-	kunmapaddr(mapADDR);
+	kunmapuseraddr(pcb->memctx, mapADDR);
 	return 0;
 }
 
@@ -107,8 +126,8 @@ static int user_load_segments(struct pcb *pcb, struct file *file)
 		}
 	}
 
-	TRACE("Loading %u elf segments", pcb->n_elf_segments);
-	for (int i = 0; i < pcb->n_elf_segments; i++)
+	TRACE("Loading %u elf segments", load_elf.n_segments);
+	for (int i = 0; i < load_elf.n_segments; i++)
 		if ((ret = user_load_segment(pcb, file, i)))
 			return ret;
 
@@ -117,12 +136,20 @@ static int user_load_segments(struct pcb *pcb, struct file *file)
 		return 1;
 	};
 
+	// the heap is reserved now and grown by brk
+	if (mem_area_alloc(pcb->memctx, pcb->heap_start, 0,
+					   USER_HEAP_MAX / PAGE_SIZE,
+					   F_WRITEABLE | F_UNPRIVILEGED) == NULL) {
+		ERROR("Could not reserve user heap");
+		return 1;
+	}
+
 	return 0;
 }
 
-static int validate_elf_hdr(struct pcb *pcb)
+static int validate_elf_hdr(void)
 {
-	Elf64_Ehdr *ehdr = &pcb->elf_header;
+	Elf64_Ehdr *ehdr = &load_elf.header;
 
 	if (strncmp((const char *)ehdr->e_ident, ELFMAG, SELFMAG)) {
 		ERROR("Invalid ELF File.");
@@ -162,7 +189,7 @@ static int validate_elf_hdr(struct pcb *pcb)
 	return 0;
 }
 
-static int user_load_elf(struct pcb *pcb, struct file *file)
+static int user_load_elf(struct file *file)
 {
 	int ret = 0;
 
@@ -170,22 +197,22 @@ static int user_load_elf(struct pcb *pcb, struct file *file)
 		ERROR("Cannot read ELF header.");
 		return 1;
 	}
-	ret = file->read(file, &pcb->elf_header, sizeof(Elf64_Ehdr));
+	ret = file->read(file, &load_elf.header, sizeof(Elf64_Ehdr));
 	if (ret < 0) {
 		ERROR("Cannot read ELF header.");
 		return 1;
 	}
 
-	if (validate_elf_hdr(pcb))
+	if (validate_elf_hdr())
 		return 1;
 
-	pcb->n_elf_segments = pcb->elf_header.e_phnum;
-	if (file->seek(file, pcb->elf_header.e_phoff, SEEK_SET) < 0) {
+	load_elf.n_segments = load_elf.header.e_phnum;
+	if (file->seek(file, load_elf.header.e_phoff, SEEK_SET) < 0) {
 		ERROR("Cannot read ELF segemts");
 		return 1;
 	}
-	ret = file->read(file, &pcb->elf_segments,
-					 sizeof(Elf64_Phdr) * pcb->elf_header.e_phnum);
+	ret = file->read(file, &load_elf.segments,
+					 sizeof(Elf64_Phdr) * load_elf.header.e_phnum);
 	if (ret < 0) {
 		ERROR("Cannot read ELF segemts");
 		return 1;
@@ -200,11 +227,16 @@ static int user_setup_stack(struct pcb *pcb, const char **args,
 	/* args */
 	int argbytes = 0;
 	int argc = 0;
+	const char *arg;
 
-	mem_ctx_switch(args_ctx);
-
-	while (args[argc] != NULL) {
-		int n = strlen(args[argc]) + 1;
+	while (1) {
+		if (copy_from_user(args_ctx, &arg, &args[argc], sizeof(char *)))
+			return 1;
+		if (arg == NULL)
+			break;
+		long n = strnlen_user(args_ctx, arg, USER_STACK_LEN) + 1;
+		if (n < 1)
+			return 1;
 		if ((argbytes + n) > USER_STACK_LEN) {
 			// oops - ignore this and any others
 			break;
@@ -226,8 +258,12 @@ static int user_setup_stack(struct pcb *pcb, const char **args,
 	// each one in our argv.
 	char *tmp = argstrings;
 	for (int i = 0; i < argc; ++i) {
-		int nb = strlen(args[i]) + 1;
-		strcpy(tmp, args[i]);
+		if (copy_from_user(args_ctx, &arg, &args[i], sizeof(char *)))
+			return 1;
+		long nb = strnlen_user(args_ctx, arg, USER_STACK_LEN) + 1;
+		if (nb < 1 || tmp + nb > argstrings + argbytes ||
+			copy_from_user(args_ctx, tmp, arg, nb - 1))
+			return 1;
 		argv[i] = tmp;
 		tmp += nb;
 	}
@@ -235,12 +271,10 @@ static int user_setup_stack(struct pcb *pcb, const char **args,
 	// trailing NULL pointer
 	argv[argc] = NULL;
 
-	mem_ctx_switch(kernel_mem_ctx);
-
 	/* stack */
-	if (mem_alloc_pages_at(pcb->memctx, USER_STACK_LEN / PAGE_SIZE,
-						   (void *)(USER_STACK_TOP - USER_STACK_LEN),
-						   F_WRITEABLE | F_UNPRIVILEGED) == NULL) {
+	if (mem_stack_alloc(pcb->memctx, (void *)USER_STACK_TOP,
+						USER_STACK_LEN / PAGE_SIZE, USER_STACK_MAX / PAGE_SIZE,
+						F_WRITEABLE | F_UNPRIVILEGED) == NULL) {
 		ERROR("Could not allocate user stack");
 		return 1;
 	}
@@ -259,7 +293,7 @@ static int user_setup_stack(struct pcb *pcb, const char **args,
 	pcb->regs.rdi = argc; // argc
 	pcb->regs.rsi = 0; // argv
 	// intruction pointer
-	pcb->regs.rip = pcb->elf_header.e_entry;
+	pcb->regs.rip = load_elf.header.e_entry;
 	// code segment
 	pcb->regs.cs = USER_CODE | RING3;
 	// rflags
@@ -284,8 +318,12 @@ int user_load(struct pcb *pcb, struct file *file, const char **args,
 	if (pcb->memctx == NULL)
 		goto fail;
 
+	// map the time page
+	if (clock_map(pcb->memctx))
+		goto fail;
+
 	// load elf information
-	if (user_load_elf(pcb, file))
+	if (user_load_elf(file))
 		goto fail;
 
 	// load segments into memory
@@ -314,24 +352,25 @@ struct pcb *user_clone(struct pcb *pcb)
 	// copy context
 	memcpy(&child->regs, &pcb->regs, sizeof(struct cpu_regs));
 	child->memctx = mem_ctx_clone(pcb->memctx, true);
-	if (child->memctx == NULL)
+	if (child->memctx == NULL) {
+		pcb_free(child);
 		return NULL;
+	}
+	if (fpu_clone(child, pcb)) {
+		pcb_cleanup(child);
+		return NULL;
+	}
 
 	// set metadata
-	child->parent = pcb;
+	pcb_set_parent(child, pcb);
 	child->state = PROC_STATE_READY;
 	child->priority = pcb->priority;
-	child->ticks = 0;
+	child->slice = 0;
 
 	// copy heap
 	child->heap_start = pcb->heap_start;
 	child->heap_len = pcb->heap_len;
 
-	// copy elf data
-	memcpy(&child->elf_header, &pcb->elf_header, sizeof(Elf64_Ehdr));
-	memcpy(&child->elf_segments, &pcb->elf_segments, sizeof(Elf64_Ehdr));
-	child->n_elf_segments = pcb->n_elf_segments;
-
 	return child;
 }
 
@@ -11,6 +11,7 @@ INCBIN(APPLE, "data/apple.bin");
 #define APPLE_FPS 30
 #define APPLE_FRAMES 6572
 #define VSYNC_FPS 60
+#define FRAME_NS (1000000000ULL / APPLE_FPS)
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
@@ -32,8 +33,8 @@ static unsigned char frame_buf[APPLE_WIDTH * APPLE_HEIGHT];
 // backbuffer
 static uint32_t *back_fb;
 
-// start tick
-static size_t tick_start;
+// start time (ns)
+static uint64_t time_start;
 
 static unsigned char read_byte(void)
 {
@@ -94,7 +95,7 @@ int main(void)
 		return 1;
 	}
 
-	tick_start = ticks();
+	time_start = nanotime();
 	scale = MIN(width / APPLE_WIDTH, height / APPLE_HEIGHT);
 
 	while (1) {
@@ -105,7 +106,10 @@ int main(void)
 		}
 
 		last_frame = frame;
-		frame = ((ticks() - tick_start) / (1000 / APPLE_FPS));
+
+		// sleep until the next frame is due instead of spinning
+		sleepuntil(time_start + (frame + 1) * FRAME_NS);
+		frame = (nanotime() - time_start) / FRAME_NS;
 		if (frame >= APPLE_FRAMES)
 			break;
 	}
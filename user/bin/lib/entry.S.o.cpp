@@ -0,0 +1,25 @@
+# 0 "lib/entry.S"
+# 0 "<built-in>"
+# 0 "<command-line>"
+# 1 "/usr/include/stdc-predef.h" 1 3 4
+# 0 "<command-line>" 2
+# 1 "lib/entry.S"
+ .globl _start
+ .extern main
+ .extern exit
+ .extern syscall_fast
+
+ .section .text
+ .code64
+_start:
+ # check for the syscall instruction, argc and argv
+ # are in rdi and rsi which cpuid leaves alone
+ movl $0x80000001, %eax
+ cpuid
+ shrl $11, %edx
+ andb $1, %dl
+ movb %dl, syscall_fast(%rip)
+
+ call main
+ movq %rax, %rdi
+ call exit
@@ -0,0 +1,63 @@
+# 0 "lib/syscall.S"
+# 0 "<built-in>"
+# 0 "<command-line>"
+# 1 "/usr/include/stdc-predef.h" 1 3 4
+# 0 "<command-line>" 2
+# 1 "lib/syscall.S"
+# 1 "include/syscalls.h" 1
+# 2 "lib/syscall.S" 2
+
+ .globl syscall_fast
+
+ .section .data
+# set by _start if the cpu has the syscall instruction
+syscall_fast:
+ .byte 0
+
+ .section .text
+.macro SYSCALL name num
+ .align 8
+ .globl \name
+\name:
+ movq $\num, %rax
+ testb $1, syscall_fast(%rip)
+ jz 1f
+ # syscall overwrites rcx with the return address
+ movq %rcx, %r10
+ # the syscall instruction, gas would expand this macro instead
+ .byte 0x0f, 0x05
+ ret
+1:
+ int $0x80
+ ret
+.endm
+
+SYSCALL exit 0
+SYSCALL waitpid 1
+SYSCALL fork 2
+SYSCALL exec 3
+SYSCALL open 4
+SYSCALL close 5
+SYSCALL read 6
+SYSCALL write 7
+SYSCALL getpid 8
+SYSCALL getppid 9
+SYSCALL sys_gettime 10
+SYSCALL getprio 11
+SYSCALL setprio 12
+SYSCALL kill 13
+SYSCALL sleep 14
+SYSCALL brk 15
+SYSCALL sbrk 16
+SYSCALL poweroff 17
+SYSCALL drm 18
+SYSCALL sys_ticks 19
+SYSCALL seek 20
+SYSCALL allocshared 21
+SYSCALL popsharedmem 22
+SYSCALL keypoll 23
+SYSCALL sys_nanotime 24
+SYSCALL sleepuntil 25
+SYSCALL proclimit 26
+SYSCALL futexwait 27
+SYSCALL futexwake 28
@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sync.h>
 #include "../kernel/include/comus/keycodes.h"
 
 #define DBG
@@ -49,15 +50,6 @@ typedef struct {
 	enum tile_type type;
 } tile;
 
-#define CLIENT_BIT (1)
-#define SERVER_BIT (2)
-#define CLIENT_WAITING_BIT (1)
-#define SERVER_WAITING_BIT (2)
-
-typedef struct {
-	volatile uint8_t inner;
-} spinlock;
-
 enum key_state {
 	KEY_STATE_PRESSED,
 	KEY_STATE_UNPRESSED,
@@ -67,10 +59,9 @@ enum key_state {
 typedef struct {
 	volatile size_t frame;
 	volatile size_t dummy_counter;
-	volatile uint8_t client_barrier;
-	volatile uint8_t server_barrier;
+	struct barrier start;
 	volatile enum key_state key_status[255];
-	spinlock player_lock;
+	struct mutex player_lock;
 	volatile vec player_pos;
 	volatile vec player_vel;
 	volatile tile tiles[GAME_HEIGHT_TILES * GAME_WIDTH_TILES];
@@ -79,11 +70,8 @@ typedef struct {
 
 static int display_server_entry(sharedmem *);
 static int client_entry(sharedmem *);
-static void barrier_wait(sharedmem *, int isclient);
 static volatile tile *tile_at(sharedmem *, size_t x, size_t y);
 static int is_inbounds(size_t x, size_t y);
-static void spinlock_lock(volatile spinlock *lock, int isclient);
-static void spinlock_unlock(volatile spinlock *lock, int isclient);
 
 int main(void)
 {
@@ -209,7 +197,7 @@ static int display_server_entry(sharedmem *shared)
 
 	fb.size = (fb.width * fb.height * fb.bpp) / 8;
 
-	barrier_wait(shared, 0);
+	barrier_wait(&shared->start, 2);
 
 	while (1) {
 		struct keycode keycode;
@@ -225,9 +213,9 @@ static int display_server_entry(sharedmem *shared)
 
 		draw_tiles(shared, &fb);
 
-		spinlock_lock(&shared->player_lock, 0);
+		mutex_lock(&shared->player_lock);
 		draw_player(&fb, shared->player_pos);
-		spinlock_unlock(&shared->player_lock, 0);
+		mutex_unlock(&shared->player_lock);
 	}
 
 	return 0;
@@ -241,11 +229,11 @@ static int client_entry(sharedmem *shared)
 
 	double last_time = get_total_time(start_ticks);
 
-	barrier_wait(shared, 1);
+	barrier_wait(&shared->start, 2);
 	do {
 		double time = get_total_time(start_ticks);
 		double delta_time = time - last_time;
-		spinlock_lock(&shared->player_lock, 1);
+		mutex_lock(&shared->player_lock);
 
 		shared->player_vel.y -= 9.8 * delta_time;
 
@@ -273,7 +261,7 @@ static int client_entry(sharedmem *shared)
 		} else if (shared->key_status[KEY_B] == KEY_STATE_PRESSED) {
 			shared->player_vel.y = -10;
 		}
-		spinlock_unlock(&shared->player_lock, 1);
+		mutex_unlock(&shared->player_lock);
 
 	} while (1);
 
@@ -297,67 +285,3 @@ static int is_inbounds(size_t x, size_t y)
 	const size_t idx = x + (y * GAME_WIDTH_TILES);
 	return idx < (GAME_WIDTH_TILES * GAME_HEIGHT_TILES);
 }
-
-static void spinlock_lock(volatile spinlock *lock, int isclient)
-{
-	const uint8_t bit = isclient ? CLIENT_BIT : SERVER_BIT;
-	const uint8_t otherbit = isclient ? SERVER_BIT : CLIENT_BIT;
-
-	// wait for us to be the only waiter
-	while (1) {
-		if (lock->inner == 0) {
-			lock->inner |= bit;
-			// recover from the possibility that something happened between that
-			// if statement and the |= operation. check for other bits being set
-			if ((lock->inner ^ bit) != 0) {
-				// okay, somebody messed with something, undo what we did and
-				// keep waiting
-				lock->inner ^= bit;
-				continue;
-			}
-
-			// okay all good, we are the exclusive owner
-			break;
-		}
-	}
-
-#ifdef DBG
-	// when we own the lock, only our bit should be active and the other proc's
-	// bit should not be active
-	if (lock->inner & otherbit || !(lock->inner & bit)) {
-		printf("SPINLOCK BAD\n");
-		exit(1);
-	}
-#endif
-}
-
-static void spinlock_unlock(volatile spinlock *lock, int isclient)
-{
-	const uint8_t bit = isclient ? CLIENT_BIT : SERVER_BIT;
-
-	// assume our thread of execution (process) is the only one changing our
-	// bit. this can be screwed over if the other process lies about whether
-	// it is server or client
-	lock->inner ^= bit;
-}
-
-static void barrier_wait(sharedmem *shared, int isclient)
-{
-	if (isclient) {
-		if (shared->server_barrier) {
-			shared->server_barrier = 0;
-		} else {
-			shared->client_barrier = 1;
-			while (shared->client_barrier)
-				;
-		}
-	} else {
-		if (shared->client_barrier) {
-			shared->client_barrier = 0;
-		} else {
-			shared->server_barrier = 1;
-			while (shared->server_barrier)
-				;
-		}
-	}
-}
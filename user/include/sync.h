@@ -0,0 +1,97 @@
+/**
+ * @file sync.h
+ *
+ * Mutexes, condition variables and barriers built on futexes. They
+ * work between processes sharing memory, and a zeroed one is ready to
+ * use, so they can be placed in memory from allocshared.
+ */
+
+#ifndef _SYNC_H
+#define _SYNC_H
+
+#include <stdint.h>
+
+struct mutex {
+	// 0 unlocked, 1 locked, 2 locked with waiters
+	uint32_t state;
+};
+
+struct cond {
+	// bumped on every signal
+	uint32_t seq;
+};
+
+struct barrier {
+	// processes that have arrived in this round
+	uint32_t waiting;
+	// bumped when a round completes
+	uint32_t round;
+};
+
+/**
+ * Lock a mutex, sleeping while another process holds it
+ *
+ * @param mutex - the mutex to lock
+ */
+extern void mutex_lock(struct mutex *mutex);
+
+/**
+ * Lock a mutex if it is free
+ *
+ * @param mutex - the mutex to lock
+ * @returns 1 if the mutex was locked, 0 if it is held
+ */
+extern int mutex_trylock(struct mutex *mutex);
+
+/**
+ * Unlock a mutex held by this process, waking one waiter
+ *
+ * @param mutex - the mutex to unlock
+ */
+extern void mutex_unlock(struct mutex *mutex);
+
+/**
+ * Unlock a mutex and sleep until the condition is signaled, then lock
+ * the mutex again. Wakeups can be spurious.
+ *
+ * @param cond - the condition to wait on
+ * @param mutex - the held mutex protecting the condition
+ */
+extern void cond_wait(struct cond *cond, struct mutex *mutex);
+
+/**
+ * cond_wait with a timeout
+ *
+ * @param cond - the condition to wait on
+ * @param mutex - the held mutex protecting the condition
+ * @param timeout - time to give up at, on the same clock as nanotime()
+ * @returns 0 when signaled, or E_TIMEOUT
+ */
+extern int cond_timedwait(struct cond *cond, struct mutex *mutex,
+						  uint64_t timeout);
+
+/**
+ * Wake one process waiting on a condition
+ *
+ * @param cond - the condition
+ */
+extern void cond_signal(struct cond *cond);
+
+/**
+ * Wake every process waiting on a condition
+ *
+ * @param cond - the condition
+ */
+extern void cond_broadcast(struct cond *cond);
+
+/**
+ * Sleep until count processes have reached the barrier. Every process
+ * must pass the same count, and the barrier can be reused right away.
+ *
+ * @param barrier - the barrier
+ * @param count - number of processes that meet at the barrier
+ * @returns 1 in the last process to arrive, 0 in the others
+ */
+extern int barrier_wait(struct barrier *barrier, uint32_t count);
+
+#endif /* sync.h */
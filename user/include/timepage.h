@@ -0,0 +1 @@
+../../kernel/include/comus/timepage.h
\ No newline at end of file
@@ -176,6 +176,14 @@ extern int kill(pid_t pid);
  */
 extern int sleep(unsigned long ms);
 
+/**
+ * put the current process to sleep until an absolute time
+ *
+ * @param ns - time to wake up at, on the same clock as nanotime()
+ * @return 0
+ */
+extern int sleepuntil(uint64_t ns);
+
 /**
  * Set the heap break to addr
  *
@@ -247,4 +255,40 @@ extern int drm(void **fb, int *width, int *height, int *bbp);
  */
 extern uint64_t ticks(void);
 
+/**
+ * @returns number of nanoseconds the system has been up for
+ */
+extern uint64_t nanotime(void);
+
+/**
+ * Get or set the max number of processes that can exist at once
+ *
+ * @param max - the new limit, or 0 to leave it unchanged
+ * @returns the limit before the call, or 0 if max is out of range
+ */
+extern size_t proclimit(size_t max);
+
+/**
+ * Sleep while the word at addr is val, until futexwake is called on it.
+ * Words are matched by physical address, so this works across processes
+ * sharing memory.
+ *
+ * @param addr - the word to wait on, 4 byte aligned
+ * @param val - the value the word is expected to have
+ * @param timeout - time to give up at, on the same clock as nanotime(),
+ *                  or 0 to wait forever
+ * @returns 0 when woken, E_AGAIN if the word was not val, E_TIMEOUT if
+ *          the timeout passed, or E_BAD_PARAM if addr is invalid
+ */
+extern int futexwait(uint32_t *addr, uint32_t val, uint64_t timeout);
+
+/**
+ * Wake processes sleeping in futexwait on a word
+ *
+ * @param addr - the word they are waiting on
+ * @param n - the most processes to wake
+ * @returns the number of processes woken, or E_BAD_PARAM
+ */
+extern int futexwake(uint32_t *addr, int n);
+
 #endif /* unistd.h */
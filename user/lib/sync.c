@@ -0,0 +1,107 @@
+#include <sync.h>
+#include <error.h>
+#include <unistd.h>
+
+#define UNLOCKED 0
+#define LOCKED 1
+#define CONTENDED 2
+
+// wake everyone
+#define WAKE_ALL 0x7FFFFFFF
+
+static void mutex_lock_contended(struct mutex *mutex)
+{
+	uint32_t state;
+
+	// whoever unlocks next has to wake someone, since
+	// there may be other waiters besides us
+	state = __atomic_exchange_n(&mutex->state, CONTENDED, __ATOMIC_ACQUIRE);
+	while (state != UNLOCKED) {
+		futexwait(&mutex->state, CONTENDED, 0);
+		state =
+			__atomic_exchange_n(&mutex->state, CONTENDED, __ATOMIC_ACQUIRE);
+	}
+}
+
+void mutex_lock(struct mutex *mutex)
+{
+	uint32_t state = UNLOCKED;
+
+	// no system call if nobody holds it
+	if (__atomic_compare_exchange_n(&mutex->state, &state, LOCKED, 0,
+									__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	mutex_lock_contended(mutex);
+}
+
+int mutex_trylock(struct mutex *mutex)
+{
+	uint32_t state = UNLOCKED;
+
+	return __atomic_compare_exchange_n(&mutex->state, &state, LOCKED, 0,
+									   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_unlock(struct mutex *mutex)
+{
+	// no system call if nobody is waiting
+	if (__atomic_exchange_n(&mutex->state, UNLOCKED, __ATOMIC_RELEASE) ==
+		CONTENDED)
+		futexwake(&mutex->state, 1);
+}
+
+int cond_timedwait(struct cond *cond, struct mutex *mutex, uint64_t timeout)
+{
+	uint32_t seq;
+	int ret;
+
+	// a signal after this point changes seq, so
+	// futexwait returns right away instead of missing it
+	seq = __atomic_load_n(&cond->seq, __ATOMIC_ACQUIRE);
+	mutex_unlock(mutex);
+
+	ret = futexwait(&cond->seq, seq, timeout);
+
+	mutex_lock_contended(mutex);
+
+	return ret == E_TIMEOUT ? E_TIMEOUT : 0;
+}
+
+void cond_wait(struct cond *cond, struct mutex *mutex)
+{
+	cond_timedwait(cond, mutex, 0);
+}
+
+void cond_signal(struct cond *cond)
+{
+	__atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+	futexwake(&cond->seq, 1);
+}
+
+void cond_broadcast(struct cond *cond)
+{
+	__atomic_add_fetch(&cond->seq, 1, __ATOMIC_RELEASE);
+	futexwake(&cond->seq, WAKE_ALL);
+}
+
+int barrier_wait(struct barrier *barrier, uint32_t count)
+{
+	uint32_t round;
+
+	round = __atomic_load_n(&barrier->round, __ATOMIC_ACQUIRE);
+
+	// last one in starts the next round, nobody can
+	// arrive for it until round changes
+	if (__atomic_add_fetch(&barrier->waiting, 1, __ATOMIC_ACQ_REL) >= count) {
+		__atomic_store_n(&barrier->waiting, 0, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&barrier->round, 1, __ATOMIC_RELEASE);
+		futexwake(&barrier->round, WAKE_ALL);
+		return 1;
+	}
+
+	while (__atomic_load_n(&barrier->round, __ATOMIC_ACQUIRE) == round)
+		futexwait(&barrier->round, round, 0);
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <timepage.h>
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+// system call stubs, for when the clock cannot be read directly
+extern unsigned long sys_gettime(void);
+extern uint64_t sys_ticks(void);
+extern uint64_t sys_nanotime(void);
+
+static volatile const struct time_page *const page =
+	(volatile const struct time_page *)TIME_PAGE_ADDR;
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+// reads the nanosecond clock and boot time from the time page,
+// returns 0 if the clock has to be read with a system call
+static int clock_read(uint64_t *ns, uint64_t *boot_unix)
+{
+	__extension__ typedef unsigned __int128 uint128_t;
+	uint32_t seq;
+	uint64_t tsc;
+
+	do {
+		seq = page->seq;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (page->clock != TIME_CLOCK_TSC)
+			return 0;
+
+		tsc = rdtsc();
+		// tsc values of other cpus may be slightly behind
+		if (tsc < page->tsc_base)
+			tsc = page->tsc_base;
+		*ns = ((uint128_t)(tsc - page->tsc_base) * page->mult) >> page->shift;
+		*boot_unix = page->boot_unix;
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != page->seq);
+
+	return 1;
+}
+
+uint64_t nanotime(void)
+{
+	uint64_t ns, boot_unix;
+
+	if (!clock_read(&ns, &boot_unix))
+		return sys_nanotime();
+	return ns;
+}
+
+uint64_t ticks(void)
+{
+	uint64_t ns, boot_unix;
+
+	if (!clock_read(&ns, &boot_unix))
+		return sys_ticks();
+	return ns / NS_PER_MS;
+}
+
+unsigned long gettime(void)
+{
+	uint64_t ns, boot_unix;
+
+	if (!clock_read(&ns, &boot_unix))
+		return sys_gettime();
+	return boot_unix + ns / NS_PER_SEC;
+}
@@ -0,0 +1,108 @@
+/*
+ * Shares enough pages with a child to be mapped with 2M pages, and checks
+ * both processes (and a process forked from the child) see each other's
+ * writes. Each process exits while another still maps the pages, which must
+ * only free them once.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define SHARED_PAGES 1024
+#define PAGE_SIZE 4096
+#define PAGE_WORDS (PAGE_SIZE / sizeof(size_t))
+
+typedef struct {
+	volatile size_t ready;
+	volatile size_t done;
+} header;
+
+static int child_entry(void)
+{
+	volatile size_t *shared;
+	header *hdr;
+	int status;
+
+	while (!(shared = popsharedmem()))
+		sleep(1);
+
+	hdr = (header *)shared;
+	while (!hdr->ready)
+		sleep(1);
+
+	for (size_t i = 1; i < SHARED_PAGES; i++) {
+		if (shared[i * PAGE_WORDS] != i) {
+			fprintf(stderr, "child: page %zu has the wrong value\n", i);
+			return 1;
+		}
+	}
+
+	// forking keeps the memory shared, so the parent sees these writes
+	int pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "child: fork failed!\n");
+		return 1;
+	}
+
+	if (pid == 0) {
+		for (size_t i = 1; i < SHARED_PAGES; i++)
+			shared[i * PAGE_WORDS + 1] = ~i;
+		return 0;
+	}
+
+	if (waitpid(pid, &status) < 0 || status != 0) {
+		fprintf(stderr, "child: grandchild failed\n");
+		return 1;
+	}
+
+	hdr->done = 1;
+	return 0;
+}
+
+int main(void)
+{
+	volatile size_t *shared;
+	header *hdr;
+	int status;
+
+	int child = fork();
+	if (child < 0) {
+		fprintf(stderr, "fork failed!\n");
+		return 1;
+	}
+
+	if (child == 0)
+		return child_entry();
+
+	shared = allocshared(SHARED_PAGES, child);
+	if (!shared) {
+		fprintf(stderr, "memory share failure\n");
+		return 1;
+	}
+
+	hdr = (header *)shared;
+	for (size_t i = 1; i < SHARED_PAGES; i++)
+		shared[i * PAGE_WORDS] = i;
+	hdr->ready = 1;
+
+	if (waitpid(child, &status) < 0 || status != 0) {
+		fprintf(stderr, "child failed\n");
+		return 1;
+	}
+
+	// the child has exited, the pages must still be ours
+	if (!hdr->done) {
+		fprintf(stderr, "child did not finish\n");
+		return 1;
+	}
+
+	for (size_t i = 1; i < SHARED_PAGES; i++) {
+		if (shared[i * PAGE_WORDS + 1] != ~i) {
+			fprintf(stderr, "page %zu has the wrong value\n", i);
+			return 1;
+		}
+	}
+
+	printf("shared %d pages\n", SHARED_PAGES);
+	return 0;
+}